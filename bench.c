@@ -0,0 +1,728 @@
+#define RETRO_NO_MAIN
+
+#include "data.h"
+#include "functions.h"
+#include "retro.c"
+
+// Micro-benchmarks for the engine and game hot kernels, on synthetic inputs.
+//
+//   bench [--out FILE] [--filter NAME] [--baseline FILE] [--threshold PERCENT] [--threads N]
+//
+// Results are written as JSON (to stdout without --out). With --baseline the results are
+// compared against an earlier JSON output, and any kernel slower by more than the threshold
+// (default 10%) is flagged and the exit code is 1. If the baseline can't be read, the exit
+// code is 2.
+
+#ifndef BENCH_MIN_SECONDS
+#define BENCH_MIN_SECONDS 0.25
+#endif
+
+#ifndef BENCH_MAX_RESULTS
+#define BENCH_MAX_RESULTS 64
+#endif
+
+#define BENCH_BOX_COUNT 1024
+#define BENCH_BOX_MASK  (BENCH_BOX_COUNT - 1)
+#define BENCH_LEVEL_SECTIONS 200
+#define BENCH_LEVEL_NAME "bench_level.tmx"
+#define BENCH_CROWD_COUNT 2048
+#define BENCH_CROWD_CHECK_TICKS 200
+#define BENCH_ROLLBACK_TICKS 8
+#define BENCH_ROLLBACK_SPAWNS 4
+
+Font   FONT_KAGESANS;
+Bitmap SPRITESHEET;
+Bitmap CHARACTERS;
+u32    COUNTER_FRAME;
+u32    COUNTER_SECOND;
+
+void Init(Settings* settings)
+{
+  RETRO_UNUSED(settings);
+}
+
+void Start()
+{
+}
+
+void Step()
+{
+}
+
+void Draw()
+{
+}
+
+void Sound_PlayHit()
+{
+}
+
+typedef u32 (*BenchFn)(u32 iterations);
+
+typedef struct
+{
+  const char* name;
+  u64         iterations;
+  f64         nsPerOp;
+} BenchResult;
+
+BenchResult    sResults[BENCH_MAX_RESULTS];
+u32            sResultCount;
+const char*    sFilter;
+volatile u32   sSink;
+
+Hitbox         sBoxesA[BENCH_BOX_COUNT];
+Hitbox         sBoxesB[BENCH_BOX_COUNT];
+i32            sBoxesBX[BENCH_BOX_COUNT], sBoxesBY[BENCH_BOX_COUNT], sBoxesBW[BENCH_BOX_COUNT], sBoxesBH[BENCH_BOX_COUNT];
+HitboxArray    sBoxesBArray;
+u32            sBoxMask[HITBOX_MASK_WORDS(BENCH_BOX_COUNT)];
+HitboxResult   sBoxResults[BENCH_BOX_COUNT];
+Font           sFont;
+Sound          sSounds[RETRO_MAX_SOUND_OBJECTS];
+u8*            sMixStream;
+int            sMixStreamLength;
+
+static void Bench_Run(const char* name, BenchFn fn)
+{
+  if (sFilter != NULL && strstr(name, sFilter) == NULL)
+    return;
+
+  assert(sResultCount < BENCH_MAX_RESULTS);
+
+  f64 frequency = (f64) SDL_GetPerformanceFrequency();
+  u32 iterations = 1;
+  f64 seconds = 0.0;
+
+  // Warm up, then double the iteration count until the run is long enough to trust.
+  sSink += fn(1);
+
+  while(true)
+  {
+    u64 begin = SDL_GetPerformanceCounter();
+    sSink += fn(iterations);
+    seconds = (SDL_GetPerformanceCounter() - begin) / frequency;
+
+    if (seconds >= BENCH_MIN_SECONDS || iterations >= (1u << 30))
+      break;
+
+    iterations *= 2;
+  }
+
+  BenchResult* result = &sResults[sResultCount++];
+  result->name = name;
+  result->iterations = iterations;
+  result->nsPerOp = (seconds * 1000000000.0) / iterations;
+
+  fprintf(stderr, "%-32s %12llu ops %12.2f ns/op\n", name, (unsigned long long) iterations, result->nsPerOp);
+}
+
+static i32 Bench_Random(i32 min, i32 max)
+{
+  return min + (i32) Random_Below(RS_Simulation, (u32) (max - min + 1));
+}
+
+static void Bench_MakeBox(Hitbox* box)
+{
+  box->x0 = Bench_Random(0, 32000);
+  box->y0 = Bench_Random(0, 6400);
+  box->x1 = box->x0 + Bench_Random(1600, 4800);
+  box->y1 = box->y0 + Bench_Random(1600, 4800);
+}
+
+static u32 Bench_BoxVsBoxSimple(u32 iterations)
+{
+  u32 hits = 0;
+  for (u32 i=0;i < iterations;i++)
+  {
+    hits += Collision_BoxVsBox_Simple(&sBoxesA[i & BENCH_BOX_MASK], &sBoxesB[(i * 7 + 3) & BENCH_BOX_MASK]);
+  }
+  return hits;
+}
+
+static u32 Bench_BoxVsBox(u32 iterations)
+{
+  u32 hits = 0;
+  HitboxResult result;
+  for (u32 i=0;i < iterations;i++)
+  {
+    if (Collision_BoxVsBox(&result, &sBoxesA[i & BENCH_BOX_MASK], &sBoxesB[(i * 7 + 3) & BENCH_BOX_MASK]))
+      hits += result.delta.x + result.delta.y;
+  }
+  return hits;
+}
+
+// One op is one box against all of sBoxesB.
+static u32 Bench_BoxVsBoxesPairwise(u32 iterations)
+{
+  u32 hits = 0;
+  for (u32 i=0;i < iterations;i++)
+  {
+    Hitbox* self = &sBoxesA[i & BENCH_BOX_MASK];
+    for (u32 j=0;j < BENCH_BOX_COUNT;j++)
+      hits += Collision_BoxVsBox_Simple(self, &sBoxesB[j]);
+  }
+  return hits;
+}
+
+static u32 Bench_BoxVsBoxesScalar(u32 iterations)
+{
+  u32 hits = 0;
+  for (u32 i=0;i < iterations;i++)
+  {
+    hits += Collision_BoxVsBoxes_Scalar(sBoxMask, NULL, &sBoxesA[i & BENCH_BOX_MASK], &sBoxesBArray);
+  }
+  return hits;
+}
+
+static u32 Bench_BoxVsBoxes(u32 iterations)
+{
+  u32 hits = 0;
+  for (u32 i=0;i < iterations;i++)
+  {
+    hits += Collision_BoxVsBoxes(sBoxMask, NULL, &sBoxesA[i & BENCH_BOX_MASK], &sBoxesBArray);
+  }
+  return hits;
+}
+
+// The batched kernels must agree with the pairwise ones, mask and penetration results alike.
+static void Bench_CheckBoxVsBoxes()
+{
+  static u32 mask[HITBOX_MASK_WORDS(BENCH_BOX_COUNT)];
+  static HitboxResult results[BENCH_BOX_COUNT];
+
+  for (u32 i=0;i < BENCH_BOX_COUNT;i++)
+  {
+    Hitbox* self = &sBoxesA[i];
+    u32 hits = Collision_BoxVsBoxes(mask, results, self, &sBoxesBArray);
+    u32 scalarHits = Collision_BoxVsBoxes_Scalar(sBoxMask, sBoxResults, self, &sBoxesBArray);
+    u32 expectedHits = 0;
+
+    for (u32 j=0;j < BENCH_BOX_COUNT;j++)
+    {
+      HitboxResult expected;
+      bool hit = Collision_BoxVsBox(&expected, self, &sBoxesB[j]);
+      bool maskHit = (mask[j >> 5] >> (j & 31)) & 1;
+      bool scalarMaskHit = (sBoxMask[j >> 5] >> (j & 31)) & 1;
+
+      expectedHits += hit;
+
+      if (hit != maskHit || hit != scalarMaskHit || 
+          (hit && (memcmp(&expected, &results[j], sizeof(expected)) != 0 || memcmp(&expected, &sBoxResults[j], sizeof(expected)) != 0)))
+      {
+        fprintf(stderr, "Collision_BoxVsBoxes mismatch for box %u against %u\n", i, j);
+        exit(1);
+      }
+    }
+
+    if (hits != expectedHits || scalarHits != expectedHits)
+    {
+      fprintf(stderr, "Collision_BoxVsBoxes hit count mismatch for box %u\n", i);
+      exit(1);
+    }
+  }
+}
+
+static u32 Bench_AnimationNextFrame(u32 iterations)
+{
+  u8 ticks[16], frames[16], ended[16];
+  memset(ticks, 0, sizeof(ticks));
+  memset(frames, 0, sizeof(frames));
+  memset(ended, 0, sizeof(ended));
+
+  u32 total = 0;
+  for (u32 i=0;i < iterations;i++)
+  {
+    u32 k = i & 15;
+    u8 animation = (u8) (i % (ANIM_StandPunch3 + 1));
+    Animation_NextFrame(&ticks[k], &frames[k], &ended[k], animation);
+    total += frames[k] + ended[k];
+  }
+  return total;
+}
+
+static u32 Bench_SolveVelocity(u32 iterations)
+{
+  i32 velocity = 0;
+  u32 total = 0;
+  for (u32 i=0;i < iterations;i++)
+  {
+    i32 acceleration = (i & 3) == 0 ? 0 : ((i & 8) ? 100 : -100);
+    velocity = SolveVelocity(velocity, acceleration, 50, 400);
+    total += velocity;
+  }
+  return total;
+}
+
+static u32 Bench_LengthStr(u32 iterations)
+{
+  static const char* strings[] = {
+    "RAGE",
+    "LIFE",
+    "PRESS [S] TO PLAY",
+    "CONGRATULATIONS YOU WON!!",
+    "Scope=INIT Mem=12% FPS=30 Dt=33 Snd=4, Mus=51"
+  };
+
+  u32 total = 0;
+  for (u32 i=0;i < iterations;i++)
+  {
+    total += Canvas_LengthStr(&sFont, strings[i % RETRO_ARRAY_COUNT(strings)]);
+  }
+  return total;
+}
+
+static u32 Bench_MixSoundObjects(u32 iterations)
+{
+  for (u32 i=0;i < iterations;i++)
+  {
+    for (u32 j=0;j < RETRO_MAX_SOUND_OBJECTS;j++)
+    {
+      if (gSoundObject[j].sound == NULL)
+      {
+        gSoundObject[j].sound = &sSounds[j];
+        gSoundObject[j].p = 0;
+        gSoundObject[j].volume = RETRO_SOUND_DEFAULT_VOLUME;
+      }
+    }
+
+    SDL_memset(sMixStream, 0, sMixStreamLength);
+    Retro_MixSoundObjects(sMixStream, sMixStreamLength);
+  }
+  return sMixStream[0];
+}
+
+static void Bench_SetupCrowd()
+{
+  Random_Seed(4321);
+
+  Objects_SetCapacity(1 + BENCH_CROWD_COUNT);
+  Objects_Setup();
+
+  u32 player = Objects_Create(OT_Player, 0xFF);
+  Objects_SetPosition(player, 160 * 100, 32 * 100);
+
+  for (u32 i=0;i < BENCH_CROWD_COUNT;i++)
+  {
+    u32 id = Objects_Create(OT_Enemy, 0);
+    Objects_SetPosition(id, Bench_Random(0, 320 * 100), (u16) Bench_Random(0, 64 * 100));
+  }
+
+  Objects_SetTrackingObjectType(OT_Enemy, player);
+}
+
+static u32 Bench_ObjectsTick(u32 iterations)
+{
+  for (u32 i=0;i < iterations;i++)
+  {
+    Objects_PreTick();
+    Objects_Tick(true);
+  }
+  return Objects_FindFirstOf(OT_Enemy);
+}
+
+static u32 Bench_CrowdHash(u32 threadCount)
+{
+  Jobs_Shutdown();
+  Jobs_Init(threadCount);
+  Bench_SetupCrowd();
+
+  for (u32 i=0;i < BENCH_CROWD_CHECK_TICKS;i++)
+  {
+    Objects_PreTick();
+    Objects_Tick(true);
+  }
+
+  return Objects_Hash();
+}
+
+// The parallel tick must give exactly the same objects as the single threaded one.
+static void Bench_CheckCrowd()
+{
+  u32 expected = Bench_CrowdHash(1);
+  u32 hash = Bench_CrowdHash(gJobThreads);
+
+  if (hash != expected)
+  {
+    fprintf(stderr, "Objects_Tick with %u threads diverged from 1 thread (%08x vs %08x)\n", Jobs_GetWorkerCount(), hash, expected);
+    exit(1);
+  }
+}
+
+// The grid must find the same hit as a scan over every object, for every object in the crowd.
+static void Bench_CheckBroadphase()
+{
+  Bench_SetupCrowd();
+
+  for (u32 i=0;i < BENCH_CROWD_CHECK_TICKS;i++)
+  {
+    Objects_PreTick();
+    Objects_Tick(true);
+
+    u32 mismatches = Objects_CheckBroadphase();
+
+    if (mismatches > 0)
+    {
+      fprintf(stderr, "Broadphase grid disagreed with the full scan for %u objects on tick %u\n", mismatches, i);
+      exit(1);
+    }
+  }
+}
+
+// A tick, its capture and a rollback to before it, so every iteration ticks the same state.
+static u32 Bench_SnapshotRollback(u32 iterations)
+{
+  for (u32 i=0;i < iterations;i++)
+  {
+    Objects_PreTick();
+    Objects_Tick(true);
+    Snapshot_Capture();
+    Snapshot_Restore(1);
+  }
+  return Snapshot_GetDepth();
+}
+
+// Enemies are spawned past the end of the crowd, destroyed and spawned again, so the ticks use
+// slots that were not in use at the capture.
+static void Bench_TickWithSpawns(u32* ids, bool capture)
+{
+  for (u32 i=0;i < BENCH_ROLLBACK_TICKS;i++)
+  {
+    for (u32 j=0;j < BENCH_ROLLBACK_SPAWNS;j++)
+    {
+      if (i == 1 || i == 5)
+      {
+        u32 id = Objects_Create(OT_Enemy, 0);
+        Objects_SetPosition(id, (100 + j * 20) * 100, 40 * 100);
+        ids[(i == 5) * BENCH_ROLLBACK_SPAWNS + j] = id;
+      }
+      else if (i == 3)
+      {
+        Objects_Destroy(ids[j]);
+      }
+    }
+
+    Objects_PreTick();
+    Objects_Tick(true);
+
+    if (capture)
+      Snapshot_Capture();
+  }
+}
+
+// Rolling back and ticking again must give back the same objects, with the same ids.
+static void Bench_CheckSnapshot()
+{
+  u32 ids[2][2 * BENCH_ROLLBACK_SPAWNS];
+
+  Snapshot_SetFunction(Objects_Snapshot);
+  Bench_SetupCrowd();
+  Snapshot_Capture();
+
+  u32 before = Objects_Hash();
+  Bench_TickWithSpawns(ids[0], true);
+
+  u32 after = Objects_Hash();
+  Snapshot_Restore(BENCH_ROLLBACK_TICKS);
+  u32 restored = Objects_Hash();
+
+  Bench_TickWithSpawns(ids[1], false);
+
+  if (restored != before || Objects_Hash() != after)
+  {
+    fprintf(stderr, "Snapshot_Restore did not give back the same objects (%08x vs %08x)\n", restored, before);
+    exit(1);
+  }
+
+  if (memcmp(ids[0], ids[1], sizeof(ids[0])) != 0)
+  {
+    fprintf(stderr, "Objects spawned after Snapshot_Restore got different ids (%04x vs %04x)\n", ids[1][0], ids[0][0]);
+    exit(1);
+  }
+}
+
+#ifdef RETRO_FILESYSTEM
+
+static void Bench_WriteLevel(const char* filename, u32 sections)
+{
+  u32 width = sections * 20;
+
+  FILE* f = fopen(filename, "w");
+  assert(f);
+
+  fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  fprintf(f, "<map version=\"1.0\" orientation=\"orthogonal\" renderorder=\"right-down\" width=\"%u\" height=\"14\" tilewidth=\"16\" tileheight=\"16\">\n", width);
+  fprintf(f, " <layer name=\"TILES\" width=\"%u\" height=\"14\">\n  <data encoding=\"csv\">\n", width);
+
+  for (u32 y=0;y < 14;y++)
+  {
+    for (u32 x=0;x < width;x++)
+    {
+      fprintf(f, "%u%s", 1 + Bench_Random(0, 511), (x + 1 == width && y == 13) ? "" : ",");
+    }
+    fprintf(f, "\n");
+  }
+
+  fprintf(f, "</data>\n </layer>\n <objectgroup name=\"OBJECTS\">\n");
+
+  u32 id = 1;
+  for (u32 i=0;i < sections;i++)
+  {
+    for (u32 j=0;j < 8;j++)
+    {
+      fprintf(f, "  <object id=\"%u\" gid=\"%u\" x=\"%u\" y=\"%u\" width=\"16\" height=\"16\"/>\n", id++, j == 0 ? 4 : 5, i * 320 + j * 32 + 8, 150 + j * 6);
+    }
+  }
+
+  fprintf(f, " </objectgroup>\n</map>\n");
+  fclose(f);
+}
+
+static u32 Bench_LevelLoad(u32 iterations)
+{
+  for (u32 i=0;i < iterations;i++)
+  {
+    Level_Load(BENCH_LEVEL_NAME);
+    Level_Unload();
+  }
+  return iterations;
+}
+
+#endif
+
+static void Bench_Setup()
+{
+  Random_Seed(1234);
+
+  for (u32 i=0;i < BENCH_BOX_COUNT;i++)
+  {
+    Bench_MakeBox(&sBoxesA[i]);
+    Bench_MakeBox(&sBoxesB[i]);
+  }
+
+  sBoxesBArray.x = sBoxesBX;
+  sBoxesBArray.y = sBoxesBY;
+  sBoxesBArray.halfWidth = sBoxesBW;
+  sBoxesBArray.halfHeight = sBoxesBH;
+  sBoxesBArray.count = BENCH_BOX_COUNT;
+
+  for (u32 i=0;i < BENCH_BOX_COUNT;i++)
+    HitboxArray_Set(&sBoxesBArray, i, &sBoxesB[i]);
+
+  Bench_CheckBoxVsBoxes();
+
+  Font_Make(&sFont);
+  sFont.height = 8;
+  for (u32 i=0;i < 256;i++)
+  {
+    sFont.widths[i] = (u8) Bench_Random(3, 8);
+    sFont.x[i] = (u16) (i * 8);
+  }
+
+  gSoundDevice.specification.freq = RETRO_AUDIO_FREQUENCY;
+  gSoundDevice.specification.format = AUDIO_S16;
+  gSoundDevice.specification.channels = RETRO_AUDIO_CHANNELS;
+  gSoundDevice.specification.samples = RETRO_AUDIO_SAMPLES;
+
+  sMixStreamLength = RETRO_AUDIO_SAMPLES * RETRO_AUDIO_CHANNELS * sizeof(i16);
+  sMixStream = malloc(sMixStreamLength);
+
+  for (u32 i=0;i < RETRO_MAX_SOUND_OBJECTS;i++)
+  {
+    Sound* sound = &sSounds[i];
+    sound->spec = gSoundDevice.specification;
+    sound->length = RETRO_AUDIO_FREQUENCY * RETRO_AUDIO_CHANNELS * sizeof(i16);
+    sound->buffer = malloc(sound->length);
+
+    i16* samples = (i16*) sound->buffer;
+    for (i32 j=0;j < sound->length / 2;j++)
+      samples[j] = (i16) Bench_Random(-8000, 8000);
+  }
+
+  memset(gSoundObject, 0, sizeof(gSoundObject));
+
+#ifdef RETRO_FILESYSTEM
+  gAssetDirectory[0] = 0;
+  Bench_WriteLevel(BENCH_LEVEL_NAME, BENCH_LEVEL_SECTIONS);
+#endif
+}
+
+static char* Bench_ReadFile(const char* filename)
+{
+  FILE* f = fopen(filename, "rb");
+
+  if (f == NULL)
+    return NULL;
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  char* data = malloc(size + 1);
+  fread(data, size, 1, f);
+  fclose(f);
+  data[size] = 0;
+
+  return data;
+}
+
+static bool Bench_FindBaseline(const char* json, const char* name, f64* outNsPerOp)
+{
+  char key[128];
+  snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+
+  const char* entry = strstr(json, key);
+  if (entry == NULL)
+    return false;
+
+  const char* value = strstr(entry, "\"ns_per_op\":");
+  if (value == NULL)
+    return false;
+
+  *outNsPerOp = strtod(value + strlen("\"ns_per_op\":"), NULL);
+  return true;
+}
+
+// The number of regressions, or -1 if the baseline can't be read.
+static i32 Bench_Compare(const char* baselineFilename, f64 thresholdPercent)
+{
+  char* json = Bench_ReadFile(baselineFilename);
+
+  if (json == NULL)
+  {
+    fprintf(stderr, "Cannot read baseline %s\n", baselineFilename);
+    return -1;
+  }
+
+  i32 regressions = 0;
+
+  fprintf(stderr, "\n%-32s %12s %12s %9s\n", "kernel", "baseline", "current", "change");
+
+  for (u32 i=0;i < sResultCount;i++)
+  {
+    BenchResult* result = &sResults[i];
+    f64 baseline = 0.0;
+
+    if (Bench_FindBaseline(json, result->name, &baseline) == false || baseline <= 0.0)
+    {
+      fprintf(stderr, "%-32s %12s %12.2f %9s\n", result->name, "-", result->nsPerOp, "new");
+      continue;
+    }
+
+    f64 change = ((result->nsPerOp - baseline) / baseline) * 100.0;
+    bool regressed = change > thresholdPercent;
+
+    if (regressed)
+      regressions++;
+
+    fprintf(stderr, "%-32s %12.2f %12.2f %+8.1f%%%s\n", result->name, baseline, result->nsPerOp, change, regressed ? "  REGRESSION" : "");
+  }
+
+  free(json);
+  return regressions;
+}
+
+static void Bench_WriteJson(FILE* f)
+{
+  fprintf(f, "{\n  \"benchmarks\": [\n");
+
+  for (u32 i=0;i < sResultCount;i++)
+  {
+    BenchResult* result = &sResults[i];
+    fprintf(f, "    { \"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.4f }%s\n",
+      result->name,
+      (unsigned long long) result->iterations,
+      result->nsPerOp,
+      (i + 1 == sResultCount) ? "" : ","
+    );
+  }
+
+  fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+  const char* outFilename = NULL;
+  const char* baselineFilename = NULL;
+  f64 thresholdPercent = 10.0;
+
+  for (int i=1;i < argc;i++)
+  {
+    if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+      outFilename = argv[++i];
+    else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+      baselineFilename = argv[++i];
+    else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+      thresholdPercent = strtod(argv[++i], NULL);
+    else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+      sFilter = argv[++i];
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+      gJobThreads = strtoul(argv[++i], NULL, 10);
+    else
+      fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+  }
+
+  SDL_Init(SDL_INIT_TIMER);
+
+  Bench_Setup();
+
+  Bench_Run("Collision_BoxVsBox_Simple", Bench_BoxVsBoxSimple);
+  Bench_Run("Collision_BoxVsBox",        Bench_BoxVsBox);
+  Bench_Run("Collision_BoxVsBoxes (pairwise)", Bench_BoxVsBoxesPairwise);
+  Bench_Run("Collision_BoxVsBoxes (scalar)",   Bench_BoxVsBoxesScalar);
+  Bench_Run("Collision_BoxVsBoxes",            Bench_BoxVsBoxes);
+  Bench_Run("Animation_NextFrame",       Bench_AnimationNextFrame);
+  Bench_Run("SolveVelocity",             Bench_SolveVelocity);
+  Bench_Run("Canvas_LengthStr",          Bench_LengthStr);
+  Bench_Run("Retro_MixSoundObjects",     Bench_MixSoundObjects);
+
+  Jobs_Init(1);
+  Bench_SetupCrowd();
+  Bench_Run("Objects_Tick (crowd)",      Bench_ObjectsTick);
+
+  BroadphaseStats broadphase;
+  Objects_GetBroadphaseStats(&broadphase);
+  if (broadphase.objects > 0)
+    fprintf(stderr, "%-32s %u objects, %u queries, %u candidates, %u pairs per tick\n", "  broadphase", broadphase.objects, broadphase.queries, broadphase.candidates, broadphase.pairs);
+
+  Bench_CheckBroadphase();
+  Bench_CheckCrowd();
+  Bench_SetupCrowd();
+  Bench_Run("Objects_Tick (crowd, threaded)", Bench_ObjectsTick);
+
+  Bench_CheckSnapshot();
+  Bench_Run("Objects_Tick + rollback (crowd)", Bench_SnapshotRollback);
+  Jobs_Shutdown();
+#ifdef RETRO_FILESYSTEM
+  Bench_Run("Level_Load",                Bench_LevelLoad);
+  remove(BENCH_LEVEL_NAME);
+#endif
+
+  if (outFilename != NULL)
+  {
+    FILE* f = fopen(outFilename, "w");
+    assert(f);
+    Bench_WriteJson(f);
+    fclose(f);
+  }
+  else
+  {
+    Bench_WriteJson(stdout);
+  }
+
+  i32 regressions = 0;
+
+  if (baselineFilename != NULL)
+  {
+    regressions = Bench_Compare(baselineFilename, thresholdPercent);
+
+    if (regressions >= 0)
+      fprintf(stderr, "%i regression(s) over %.1f%%\n", regressions, thresholdPercent);
+  }
+
+  SDL_Quit();
+
+  if (regressions < 0)
+    return 2;
+
+  return regressions > 0 ? 1 : 0;
+}
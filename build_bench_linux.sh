@@ -0,0 +1,3 @@
+#!/bin/sh
+mkdir -p bin
+cc bench.c collision.c draw.c object.c level.c -O2 $CFLAGS -I. -Iref $(sdl2-config --cflags) -o bin/bench $(sdl2-config --libs) -lm
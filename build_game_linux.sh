@@ -0,0 +1,3 @@
+#!/bin/sh
+mkdir -p bin
+cc main.c collision.c draw.c object.c level.c -O2 $CFLAGS -I. -Iref $(sdl2-config --cflags) -o bin/game $(sdl2-config --libs) -lm
@@ -3,7 +3,7 @@ call "C:\Program Files (x86)\Microsoft Visual Studio 14.0\VC\vcvarsall" x86
 
 setlocal enableextensions enabledelayedexpansion
 set common_c=..\main.c -nologo -D_WIN32_WINNT=0x0501 -MTd -TC -FC -EHa- -I..\ref -I..\ref\SDL2\include\
-set common_l=/link /OPT:REF user32.lib gdi32.lib winmm.lib SDL2.lib SDL2main.lib resources.res /LIBPATH:..\ref\SDL2\lib\x86\ /LIBPATH:..\_build\ /LIBPATH:.. /SUBSYSTEM:CONSOLE
+set common_l=/link /OPT:REF user32.lib gdi32.lib winmm.lib psapi.lib SDL2.lib SDL2main.lib resources.res /LIBPATH:..\ref\SDL2\lib\x86\ /LIBPATH:..\_build\ /LIBPATH:.. /SUBSYSTEM:CONSOLE
 
 echo Building resources...
 
@@ -1,5 +1,13 @@
 #include "functions.h"
 
+#if !defined(COLLISION_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define COLLISION_AVX2
+#elif !defined(COLLISION_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define COLLISION_SSE2
+#endif
+
 #define Sign(V) ((0 < (V)) - ((V) < 0))
 
 static bool Intersection_BoxVsBox(HitboxResult* outHit, HitboxTest* self, HitboxTest* other)
@@ -99,4 +107,185 @@ bool Collision_BoxVsBox(HitboxResult* outHit, Hitbox* self, Hitbox* other)
   o.halfHeight = (other->y1 - other->y0) / 2;
 
   return Intersection_BoxVsBox(outHit, &s, &o);
-}
\ No newline at end of file
+}
+static inline void Collision_MakeTest(HitboxTest* outTest, Hitbox* box)
+{
+  outTest->x = (box->x1 + box->x0) / 2;
+  outTest->y = (box->y1 + box->y0) / 2;
+  outTest->halfWidth = (box->x1 - box->x0) / 2;
+  outTest->halfHeight = (box->y1 - box->y0) / 2;
+}
+
+void HitboxArray_Set(HitboxArray* array, u32 index, Hitbox* box)
+{
+  HitboxTest t;
+  Collision_MakeTest(&t, box);
+  array->x[index] = t.x;
+  array->y[index] = t.y;
+  array->halfWidth[index] = t.halfWidth;
+  array->halfHeight[index] = t.halfHeight;
+}
+
+static inline void HitboxArray_Get(HitboxTest* outTest, HitboxArray* array, u32 index)
+{
+  outTest->x = array->x[index];
+  outTest->y = array->y[index];
+  outTest->halfWidth = array->halfWidth[index];
+  outTest->halfHeight = array->halfHeight[index];
+}
+
+static inline u32 Collision_CountBits(u32 v)
+{
+  v = v - ((v >> 1) & 0x55555555u);
+  v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+  return (((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+}
+
+// Penetration results for the boxes set in the mask.
+static u32 Collision_FillResults(HitboxResult* outHits, HitboxTest* self, HitboxArray* others, u32* mask)
+{
+  u32 hits = 0;
+
+  for (u32 w = 0; w < HITBOX_MASK_WORDS(others->count); w++)
+  {
+    u32 bits = mask[w];
+
+    if (bits == 0)
+      continue;
+
+    hits += Collision_CountBits(bits);
+
+    if (outHits == NULL)
+      continue;
+
+    for (u32 b = 0; b < 32; b++)
+    {
+      if (bits & (1u << b))
+      {
+        HitboxTest o;
+        u32 i = w * 32 + b;
+        HitboxArray_Get(&o, others, i);
+        Intersection_BoxVsBox(&outHits[i], self, &o);
+      }
+    }
+  }
+
+  return hits;
+}
+
+// outMask has HITBOX_MASK_WORDS(count) words. outHits is optional, and has count entries of which
+// only the hits are written. Returns the number of hits.
+u32 Collision_BoxVsBoxes_Scalar(u32* outMask, HitboxResult* outHits, Hitbox* self, HitboxArray* others)
+{
+  HitboxTest s;
+  Collision_MakeTest(&s, self);
+
+  SDL_memset(outMask, 0, HITBOX_MASK_WORDS(others->count) * sizeof(u32));
+
+  for (u32 i = 0; i < others->count; i++)
+  {
+    HitboxTest o;
+    HitboxArray_Get(&o, others, i);
+
+    if (intersectionOnly(&s, &o))
+      outMask[i >> 5] |= 1u << (i & 31);
+  }
+
+  return Collision_FillResults(outHits, &s, others, outMask);
+}
+
+#if defined(COLLISION_AVX2)
+
+u32 Collision_BoxVsBoxes(u32* outMask, HitboxResult* outHits, Hitbox* self, HitboxArray* others)
+{
+  HitboxTest s;
+  Collision_MakeTest(&s, self);
+
+  SDL_memset(outMask, 0, HITBOX_MASK_WORDS(others->count) * sizeof(u32));
+
+  __m256i sx = _mm256_set1_epi32(s.x);
+  __m256i sy = _mm256_set1_epi32(s.y);
+  __m256i sw = _mm256_set1_epi32(s.halfWidth);
+  __m256i sh = _mm256_set1_epi32(s.halfHeight);
+  __m256i zero = _mm256_setzero_si256();
+
+  u32 i = 0;
+  for (; i + 8 <= others->count; i += 8)
+  {
+    __m256i dx = _mm256_sub_epi32(_mm256_loadu_si256((__m256i*) &others->x[i]), sx);
+    __m256i dy = _mm256_sub_epi32(_mm256_loadu_si256((__m256i*) &others->y[i]), sy);
+    __m256i px = _mm256_sub_epi32(_mm256_add_epi32(_mm256_loadu_si256((__m256i*) &others->halfWidth[i]), sw), _mm256_abs_epi32(dx));
+    __m256i py = _mm256_sub_epi32(_mm256_add_epi32(_mm256_loadu_si256((__m256i*) &others->halfHeight[i]), sh), _mm256_abs_epi32(dy));
+    __m256i hit = _mm256_and_si256(_mm256_cmpgt_epi32(px, zero), _mm256_cmpgt_epi32(py, zero));
+
+    u32 bits = (u32) _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+    outMask[i >> 5] |= bits << (i & 31);
+  }
+
+  for (; i < others->count; i++)
+  {
+    HitboxTest o;
+    HitboxArray_Get(&o, others, i);
+
+    if (intersectionOnly(&s, &o))
+      outMask[i >> 5] |= 1u << (i & 31);
+  }
+
+  return Collision_FillResults(outHits, &s, others, outMask);
+}
+
+#elif defined(COLLISION_SSE2)
+
+// SSE2 has no 32-bit abs, so it is done as (v ^ sign) - sign.
+static inline __m128i Collision_Abs(__m128i v)
+{
+  __m128i sign = _mm_srai_epi32(v, 31);
+  return _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+}
+
+u32 Collision_BoxVsBoxes(u32* outMask, HitboxResult* outHits, Hitbox* self, HitboxArray* others)
+{
+  HitboxTest s;
+  Collision_MakeTest(&s, self);
+
+  SDL_memset(outMask, 0, HITBOX_MASK_WORDS(others->count) * sizeof(u32));
+
+  __m128i sx = _mm_set1_epi32(s.x);
+  __m128i sy = _mm_set1_epi32(s.y);
+  __m128i sw = _mm_set1_epi32(s.halfWidth);
+  __m128i sh = _mm_set1_epi32(s.halfHeight);
+  __m128i zero = _mm_setzero_si128();
+
+  u32 i = 0;
+  for (; i + 4 <= others->count; i += 4)
+  {
+    __m128i dx = _mm_sub_epi32(_mm_loadu_si128((__m128i*) &others->x[i]), sx);
+    __m128i dy = _mm_sub_epi32(_mm_loadu_si128((__m128i*) &others->y[i]), sy);
+    __m128i px = _mm_sub_epi32(_mm_add_epi32(_mm_loadu_si128((__m128i*) &others->halfWidth[i]), sw), Collision_Abs(dx));
+    __m128i py = _mm_sub_epi32(_mm_add_epi32(_mm_loadu_si128((__m128i*) &others->halfHeight[i]), sh), Collision_Abs(dy));
+    __m128i hit = _mm_and_si128(_mm_cmpgt_epi32(px, zero), _mm_cmpgt_epi32(py, zero));
+
+    u32 bits = (u32) _mm_movemask_ps(_mm_castsi128_ps(hit));
+    outMask[i >> 5] |= bits << (i & 31);
+  }
+
+  for (; i < others->count; i++)
+  {
+    HitboxTest o;
+    HitboxArray_Get(&o, others, i);
+
+    if (intersectionOnly(&s, &o))
+      outMask[i >> 5] |= 1u << (i & 31);
+  }
+
+  return Collision_FillResults(outHits, &s, others, outMask);
+}
+
+#else
+
+u32 Collision_BoxVsBoxes(u32* outMask, HitboxResult* outHits, Hitbox* self, HitboxArray* others)
+{
+  return Collision_BoxVsBoxes_Scalar(outMask, outHits, self, others);
+}
+
+#endif
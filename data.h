@@ -17,6 +17,7 @@
 #define CHARACTER_FRAME_SPRITESHEET_ORIGIN_X (0)
 #define CHARACTER_FRAME_SPRITESHEET_ORIGIN_Y (16)
 #define SCREEN_BOTTOM_EDGE 16
+#define CHARACTER_DEPTHS 4
 
 #include "retro.h"
 
@@ -90,7 +91,8 @@ typedef enum
   CTRL_HIT,
   CTRL_BLOCK,
   CTRL_CHEAT,
-  CTRL_MUSIC
+  CTRL_MUSIC,
+  CTRL_DEBUG
 } Control;
 
 typedef struct
@@ -108,10 +110,33 @@ typedef struct
   i32 x0, y0, x1, y1;
 } Hitbox;
 
+// Centre/half-extent boxes in structure-of-arrays form, for testing one box against many.
+typedef struct
+{
+  i32* x;
+  i32* y;
+  i32* halfWidth;
+  i32* halfHeight;
+  u32  count;
+} HitboxArray;
+
+#define HITBOX_MASK_WORDS(COUNT) (((COUNT) + 31) / 32)
+
+typedef struct
+{
+  u32 objects;       // Objects binned into the grid
+  u32 queries;       // Hit queries made
+  u32 cells;         // Grid buckets walked
+  u32 candidates;    // Narrow-phase box tests
+  u32 pairs;         // Overlapping pairs found
+  u32 microseconds;  // Grid build and query time
+  u64 ticks;
+} BroadphaseStats;
+
 
 extern Font   FONT_KAGESANS;
 extern Bitmap SPRITESHEET;
-extern Bitmap ANIMATIONS[OT_COUNT];
+extern Bitmap CHARACTERS;
 
 extern u32    COUNTER_FRAME;
 extern u32    COUNTER_SECOND;
@@ -50,26 +50,20 @@ void Draw_Animation(i32 x, i32 y, u8 type, u32 animation, u32 frame, i8 directio
   dst.w = src.w;
   dst.h = src.h;
 
-  u8 r, g, b;
+  if (depth >= CHARACTER_DEPTHS)
+    depth = CHARACTER_DEPTHS - 1;
 
-  if (depth >= 3)
-    depth = 3;
-
-  switch(depth)
-  {
-    case 0: r = 0xFF; g = 0xFF; b = 0xFF; break;
-    case 1: r = 0xAA; g = 0xAA; b = 0xAA; break;
-    case 2: r = 0x88; g = 0x88; b = 0x88; break;
-    case 3: r = 0x44; g = 0x44; b = 0x44; break;
-  }
+  // The character atlas has a column per object type, and a row per depth shade.
+  src.x += (type - 1) * (CHARACTERS.w / OT_COUNT);
+  src.y += depth * (CHARACTERS.h / CHARACTER_DEPTHS);
 
   if (direction == 1)
   {
-    Canvas_Splat3Colour(&ANIMATIONS[type - 1], &dst, &src, r, g, b);
+    Canvas_Splat3(&CHARACTERS, &dst, &src);
   }
   else
   {
-    Canvas_SplatFlipColour(&ANIMATIONS[type - 1], &dst, &src, SDL_FLIP_HORIZONTAL, r, g, b);
+    Canvas_SplatFlip(&CHARACTERS, &dst, &src, SDL_FLIP_HORIZONTAL);
   }
 }
 
@@ -10,6 +10,7 @@
 void Init(Settings* settings);
 void Start();
 void Step();
+void Draw();
 
 void Draw_Animation(i32 x, i32 y, u8 type, u32 animation, u32 frame, i8 direction, u8 depth);
 
@@ -20,6 +21,8 @@ bool Animation_IsEnded(u8 frame, u8 ticks, u8 animation);
 void Animation_NextFrame(u8* ticks, u8* frame, u8* ended, u8 animation);
 
 void Level_Load(const char* name);
+void Level_Unload();
+void Level_ReleaseLayers();
 
 void Level_Draw(i32 offset);
 void Level_Splat(u8 level);
@@ -28,32 +31,43 @@ void Level_StartSection(u8 sectionIdx);
 void Level_PrevSection();
 bool Level_NextSection();
 void Level_PostNextSection();
+void Level_Snapshot();
 
 void Sound_PlayHit();
 
 bool Collision_BoxVsBox_Simple(Hitbox* self, Hitbox* other);
 bool Collision_BoxVsBox(HitboxResult* outHit, Hitbox* self, Hitbox* other);
+void HitboxArray_Set(HitboxArray* array, u32 index, Hitbox* box);
+u32  Collision_BoxVsBoxes(u32* outMask, HitboxResult* outHits, Hitbox* self, HitboxArray* others);
+u32  Collision_BoxVsBoxes_Scalar(u32* outMask, HitboxResult* outHits, Hitbox* self, HitboxArray* others);
 
 void Objects_Setup();
 void Objects_Teardown();
 void Objects_PreTick();
 void Objects_Tick(bool stillScreen);
-void Objects_Draw(i32 xOffset);
+void Objects_Draw(i32 xOffset, f32 alpha);
+void Objects_GetBroadphaseStats(BroadphaseStats* outStats);
+u32  Objects_CheckBroadphase();
+u32  Objects_Hash();
+void Objects_Snapshot();
 void Objects_Clear();
 void Objects_ClearExcept(u8 type);
 
-u16  Objects_FindFirstOf(u8 type);
-u16  Objects_Create(u8 type, u8 section);
-void Objects_Destroy(u16 id);
+u32  Objects_FindFirstOf(u8 type);
+bool Objects_SetCapacity(u32 capacity);
+u32  Objects_Create(u8 type, u8 section);
+void Objects_Destroy(u32 id);
 void Objects_DestroySection(u8 section);
 void Objects_KO(u8 type);
 void Objects_Heal(u8 type);
 
-void Objects_SetTrackingObject(u16 id, u16 other);
-void Objects_SetTrackingObjectType(u8 type, u16 other);
-void Objects_SetPosition(u16 object, i32 x, u16 depth);
+void Objects_SetTrackingObject(u32 id, u32 other);
+void Objects_SetTrackingObjectType(u8 type, u32 other);
+void Objects_SetPosition(u32 object, i32 x, u16 depth);
 void Objects_ModPositions();
-void Objects_SetMovementVector(u16 object, u8 movementVector);
-void Objects_SetMovementAction(u16 object, u8 movementAction);
+void Objects_SetMovementVector(u32 object, u8 movementVector);
+void Objects_SetMovementAction(u32 object, u8 movementAction);
+
+i32  SolveVelocity(i32 velocity, i32 acceleration, i32 drag, i32 maxVelocity);
 
 #endif
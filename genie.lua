@@ -23,12 +23,26 @@ solution "RAGE"
           objdir          "_build"
           flags           { "FatalWarnings", "NoExceptions", "NoRTTI", "WinMain" }
           defines         { "GLEW_STATIC" }
-          links           { "SDL2", "SDL2main", "opengl32", "glew32s" }
+          links           { "SDL2", "SDL2main", "opengl32", "glew32s", "psapi" }
           includedirs     { "ref/SDL2/include", "ref/", "ref/glew/include" }
           libdirs         { "ref/SDL2/lib/x86/", "ref/glew/lib/Release/Win32/" }
 
           files           { "retro.c", "retro*.h", "*.c", "*.h", "ref/*.c", "ref/*.h", "genia.lua", "README.md", "bin/game.html", "resources.rc", "resources.rc", "assets/*.png", "assets/*.wav", "assets/*.mod" }
-          excludes        { "retro.c", "ref/*.c", "ref/*.h" }
+          excludes        { "retro.c", "bench.c", "ref/*.c", "ref/*.h" }
+
+      --------------------------------------------------------------------------
+
+      project "RAGE_Bench"
+          kind            "ConsoleApp"
+          language        "C"
+          objdir          "_build"
+          flags           { "NoExceptions", "NoRTTI" }
+          links           { "SDL2", "SDL2main", "psapi" }
+          includedirs     { "ref/SDL2/include", "ref/" }
+          libdirs         { "ref/SDL2/lib/x86/" }
+
+          files           { "bench.c", "collision.c", "draw.c", "object.c", "level.c", "retro.c", "retro*.h", "*.h" }
+          excludes        { "retro.c" }
 
       --------------------------------------------------------------------------
 
@@ -5,6 +5,8 @@
 #define SECTION_H 14
 #define MAX_OBJECTS_PER_SECTION 16
 #define SECTION_PX_W (SECTION_W * TILE_SIZE)
+#define SECTION_PX_H (SECTION_H * TILE_SIZE)
+#define SKY_H 128
 
 static char* skipWhitespace(char* s)
 {
@@ -67,6 +69,8 @@ typedef struct
   u8          numObjects;
   u16         tiles[SECTION_W * SECTION_H];
   ObjectSpawn objects[MAX_OBJECTS_PER_SECTION];
+  bool        baked;
+  Bitmap      layer;
 } Section;
 
 typedef struct
@@ -74,6 +78,8 @@ typedef struct
   u8       numSections;
   u8       currentSection;
   Section* sections;
+  bool     skyBaked;
+  Bitmap   sky;
 } Level;
 
 Level sLevel;
@@ -81,7 +87,8 @@ Level sLevel;
 void Level_Load(const char* t)
 {
   u32 dataSize;
-  char* data = TextFile_Load(t, &dataSize);
+  char* text = TextFile_Load(t, &dataSize);
+  char* data = text;
   SDL_assert(data);
   
   skipToString(data, &data, "width=\"");
@@ -188,6 +195,41 @@ void Level_Load(const char* t)
 
    // sLevel.numSections = 2;
 
+  free(text);
+}
+
+static void ReleaseSectionLayer(Section* section)
+{
+  if (section->baked == false)
+    return;
+
+  Bitmap_Destroy(&section->layer);
+  section->baked = false;
+}
+
+// Every layer is baked again when next drawn.
+void Level_ReleaseLayers()
+{
+  for (u32 i=0;i < sLevel.numSections;i++)
+  {
+    ReleaseSectionLayer(&sLevel.sections[i]);
+  }
+
+  if (sLevel.skyBaked)
+  {
+    Bitmap_Destroy(&sLevel.sky);
+    sLevel.skyBaked = false;
+  }
+}
+
+void Level_Unload()
+{
+  Level_ReleaseLayers();
+
+  free(sLevel.sections);
+  sLevel.sections = NULL;
+  sLevel.numSections = 0;
+  sLevel.currentSection = 0;
 }
 
 static void DrawLevel(Section* section, i32 xOffset)
@@ -223,7 +265,7 @@ static void DrawLevel(Section* section, i32 xOffset)
 
 }
 
-void Level_Draw(i32 offsetX)
+static void DrawSky()
 {
   SDL_Rect src, dst;
 
@@ -231,54 +273,89 @@ void Level_Draw(i32 offsetX)
   src.x = 416;
   src.y = 16;
   src.w = 80;
-  src.h = 128;
+  src.h = SKY_H;
 
   dst.y = 0;
   dst.w = src.w;
   dst.h = src.h;
 
-  for (int i = 0; i < (320 / 80); i++)
+  for (int i = 0; i < (SECTION_PX_W / 80); i++)
   {
     dst.x = i * 80;
     Canvas_Splat3(&SPRITESHEET, &dst, &src);
   }
+}
+
+// The sky and the tiles of each section are drawn once into their own bitmaps, and then
+// splatted whole. Section layers are released again in Level_PostNextSection.
+static void SplatSky()
+{
+  if (sLevel.skyBaked == false)
+  {
+    Bitmap_Create(&sLevel.sky, SECTION_PX_W, SKY_H);
+    Canvas_BeginBitmap(&sLevel.sky);
+    DrawSky();
+    Canvas_EndBitmap();
+    sLevel.skyBaked = true;
+  }
+
+  SDL_Rect src;
+  src.x = 0;
+  src.y = 0;
+  src.w = SECTION_PX_W;
+  src.h = SKY_H;
+
+  Canvas_Splat2(&sLevel.sky, 0, 0, &src);
+}
+
+static void SplatSection(Section* section, i32 xOffset)
+{
+  if (section->baked == false)
+  {
+    Bitmap_Create(&section->layer, SECTION_PX_W, SECTION_PX_H);
+    Canvas_BeginBitmap(&section->layer);
+    DrawLevel(section, 0);
+    Canvas_EndBitmap();
+    section->baked = true;
+  }
+
+  SDL_Rect src;
+  src.x = 0;
+  src.y = 0;
+  src.w = SECTION_PX_W;
+  src.h = SECTION_PX_H;
+
+  Canvas_Splat2(&section->layer, xOffset, 0, &src);
+}
+
+void Level_Draw(i32 offsetX)
+{
+  RETRO_ZONE_BEGIN(Level_Draw);
+
+  SplatSky();
 
   if (offsetX != 0)
   {
     Section* sectionLast = &sLevel.sections[sLevel.currentSection - 1];
-    DrawLevel(sectionLast, -offsetX);
+    SplatSection(sectionLast, -offsetX);
     Section* section = &sLevel.sections[sLevel.currentSection];
-    DrawLevel(section, 320 - offsetX);
+    SplatSection(section, 320 - offsetX);
   }
   else
   {
     Section* section = &sLevel.sections[sLevel.currentSection];
-    DrawLevel(section, 0);
+    SplatSection(section, 0);
   }
+
+  RETRO_ZONE_END(Level_Draw);
 }
 
 void Level_Splat(u8 level)
 {
-  SDL_Rect src, dst;
-
-  // Background Sky
-  src.x = 416;
-  src.y = 16;
-  src.w = 80;
-  src.h = 128;
-
-  dst.y = 0;
-  dst.w = src.w;
-  dst.h = src.h;
-
-  for (int i = 0; i < (320 / 80); i++)
-  {
-    dst.x = i * 80;
-    Canvas_Splat3(&SPRITESHEET, &dst, &src);
-  }
+  SplatSky();
 
   Section* sectionLast = &sLevel.sections[level];
-  DrawLevel(sectionLast, 0);
+  SplatSection(sectionLast, 0);
 }
 
 
@@ -292,7 +369,7 @@ void Level_StartSection(u8 sectionIdx)
   for(u32 i=0;i < section->numObjects;i++)
   {
     ObjectSpawn* spawn = &section->objects[i];
-    u16 id = 0;
+    u32 id = 0;
     switch(spawn->type)
     {
       case 3:
@@ -357,4 +434,17 @@ void Level_PostNextSection()
   {
     Objects_DestroySection(sLevel.currentSection - 1);
   }
+
+  // Only the current section is visible once the transition has finished.
+  for (u32 i=0;i < sLevel.numSections;i++)
+  {
+    if (i != sLevel.currentSection)
+      ReleaseSectionLayer(&sLevel.sections[i]);
+  }
+}
+
+// Released section layers are baked again when drawn, so only the section is state.
+void Level_Snapshot()
+{
+  Snapshot_Bytes(&sLevel.currentSection, sizeof(sLevel.currentSection));
 }
@@ -4,12 +4,12 @@
 
 Font   FONT_KAGESANS;
 Bitmap SPRITESHEET;
-Bitmap ANIMATIONS[OT_COUNT];
+Bitmap CHARACTERS;
 Sound  HIT_SOUNDS[18];
 
 u32    COUNTER_FRAME;
 u32    COUNTER_SECOND;
-u16    PLAYER;
+u32    PLAYER;
 
 Palette CharacterSrcPalette;
 Palette PlayerPalette;
@@ -23,17 +23,21 @@ int levelOffset = 0;
 void Title();
 void Game();
 void StartGame();
-void Win();
+void DrawTitle();
+void DrawGame(f32 alpha);
+void DrawWin();
+void SnapshotState();
 
 u8 mode = 0;
+bool showDebug = false;
 
-inline Colour Make_RGB(u8 r, u8 g, u8 b)
+static inline Colour Make_RGB(u8 r, u8 g, u8 b)
 {
   Colour c = { r, g, b};
   return c;
 }
 
-inline Rect Make_Rect(i32 x, i32 y, i32 w, i32 h)
+static inline Rect Make_Rect(i32 x, i32 y, i32 w, i32 h)
 {
   Rect r;
   r.left = x;
@@ -43,7 +47,7 @@ inline Rect Make_Rect(i32 x, i32 y, i32 w, i32 h)
   return r;
 }
 
-inline Rect Make_Rect2(i32 l, i32 t, i32 r, i32 b)
+static inline Rect Make_Rect2(i32 l, i32 t, i32 r, i32 b)
 {
   Rect rect;
   rect.left = l;
@@ -74,6 +78,10 @@ void Init(Settings* settings)
   Sound_Load(&HIT_SOUNDS[16], "Hit16.wav");
   Sound_Load(&HIT_SOUNDS[17], "Hit17.wav");
 
+  // Hits overlap a lot in a crowd. Newer ones matter more than the tails of older ones.
+  for (u32 i=0;i < 18;i++)
+    Sound_SetLimits(&HIT_SOUNDS[i], RETRO_SOUND_DEFAULT_PRIORITY, 2);
+
   Palette_Make(&settings->palette);
 
   Palette_LoadFromBitmap("tile.png", &settings->palette);
@@ -103,9 +111,16 @@ void Init(Settings* settings)
   CorpsePalette.colours[2] = Make_RGB(0x46, 0x46, 0x48);
   CorpsePalette.colours[3] = Make_RGB(0x4c, 0x4c, 0x4c);
 
-  Bitmap_Load24_PaletteSwap("character.png", &ANIMATIONS[0], 0xFF, 0x00, 0xFF, &CharacterSrcPalette, &PlayerPalette);
-  Bitmap_Load24_PaletteSwap("character.png", &ANIMATIONS[1], 0xFF, 0x00, 0xFF, &CharacterSrcPalette, &EnemyPalette);
-  Bitmap_Load24_PaletteSwap("character.png", &ANIMATIONS[2], 0xFF, 0x00, 0xFF, &CharacterSrcPalette, &CorpsePalette);
+  // One column per object type, one row per depth shade (nearest to the camera first).
+  Palette* characterPalettes[OT_COUNT] = { &PlayerPalette, &EnemyPalette, &CorpsePalette };
+
+  Colour characterDepths[CHARACTER_DEPTHS];
+  characterDepths[0] = Make_RGB(0xFF, 0xFF, 0xFF);
+  characterDepths[1] = Make_RGB(0xAA, 0xAA, 0xAA);
+  characterDepths[2] = Make_RGB(0x88, 0x88, 0x88);
+  characterDepths[3] = Make_RGB(0x44, 0x44, 0x44);
+
+  Bitmap_Load24_PaletteSwapAtlas("character.png", &CHARACTERS, 0xFF, 0x00, 0xFF, &CharacterSrcPalette, characterPalettes, OT_COUNT, characterDepths, CHARACTER_DEPTHS);
 
   Font_Load("KageSans.png", &FONT_KAGESANS, Colour_Make(0,0,255), Colour_Make(255,0,255));
 
@@ -120,9 +135,14 @@ void Init(Settings* settings)
   Input_BindKey(SDL_SCANCODE_K,      CTRL_BLOCK);
   Input_BindKey(SDL_SCANCODE_1,      CTRL_CHEAT);
   Input_BindKey(SDL_SCANCODE_M,      CTRL_MUSIC);
+  Input_BindKey(SDL_SCANCODE_F1,     CTRL_DEBUG);
 
   Level_Load("level1.tmx");
 
+  Replay_SetStateHash(Objects_Hash);
+  Snapshot_SetFunction(SnapshotState);
+  Bitmap_SetResetFunction(Level_ReleaseLayers);
+
   Music_Play("rage.mod");
 
 }
@@ -145,11 +165,57 @@ void Step()
     Title();
   else if (mode == 1)
     Game();
+
+  if (Input_GetActionReleased(CTRL_DEBUG))
+  {
+    showDebug = !showDebug;
+    Profiler_SetOverlay(showDebug);
+  }
+}
+
+void Draw()
+{
+  if (mode == 0)
+    DrawTitle();
+  else if (mode == 1)
+    DrawGame(Retro_GetTickAlpha());
   else if (mode == 2)
-    Win();
+    DrawWin();
+
+  if (showDebug)
+  {
+    Canvas_Debug(&FONT_KAGESANS);
+
+    BroadphaseStats broadphase;
+    Objects_GetBroadphaseStats(&broadphase);
+    Canvas_PrintF(0, Canvas_GetHeight() - 2 * FONT_KAGESANS.height - 1, &FONT_KAGESANS, 1, "Obj=%u Qry=%u Cell=%u Cand=%u Pair=%u Bp=%uus", broadphase.objects, broadphase.queries, broadphase.cells, broadphase.candidates, broadphase.pairs, broadphase.microseconds);
+  }
+}
+
+// Everything Step() changes, for the snapshot ring.
+void SnapshotState()
+{
+  Snapshot_Bytes(&mode, sizeof(mode));
+  Snapshot_Bytes(&levelState, sizeof(levelState));
+  Snapshot_Bytes(&levelTimer, sizeof(levelTimer));
+  Snapshot_Bytes(&levelOffset, sizeof(levelOffset));
+  Snapshot_Bytes(&PLAYER, sizeof(PLAYER));
+  Snapshot_Bytes(&COUNTER_FRAME, sizeof(COUNTER_FRAME));
+  Snapshot_Bytes(&COUNTER_SECOND, sizeof(COUNTER_SECOND));
+
+  Level_Snapshot();
+  Objects_Snapshot();
 }
 
 void Title()
+{
+  if (Input_GetActionReleased(CTRL_MOVE_DOWN))
+  {
+    StartGame();
+  }
+}
+
+void DrawTitle()
 {
   SDL_Rect src, dst;
   src.w = 128;
@@ -171,15 +237,9 @@ void Title()
     Canvas_PrintStr(80+1, 180+1, &FONT_KAGESANS, 5, "PRESS [S] TO PLAY");
     Canvas_PrintStr(80, 180, &FONT_KAGESANS, 3, "PRESS [S] TO PLAY");
   }
-
-  if (Input_GetActionReleased(CTRL_MOVE_DOWN))
-  {
-    StartGame();
-  }
-
 }
 
-void Win()
+void DrawWin()
 {
   SDL_Rect src, dst;
   src.w = 128;
@@ -317,9 +377,7 @@ void Game()
     levelOffset += 4;
     levelTimer++;
 
-    Level_Draw(levelOffset);
     Objects_Tick(false);
-    Objects_Draw(levelOffset);
 
     if (levelOffset == 320)
     {
@@ -329,9 +387,7 @@ void Game()
   }
   else
   {
-    Level_Draw(0);
     Objects_Tick(true);
-    Objects_Draw(0);
   }
 
   if ( Objects_FindFirstOf(OT_Enemy) == 0)
@@ -363,8 +419,28 @@ void Game()
 
 }
 
+void DrawGame(f32 alpha)
+{
+  if (levelState == 0)
+  {
+    // The screen scrolls 4 pixels a tick. An offset of 0 means not scrolling, so the scroll starts
+    // from 1.
+    i32 offset = levelOffset - 4 + (i32) (4 * alpha);
+    if (offset < 1)
+      offset = 1;
+
+    Level_Draw(offset);
+    Objects_Draw(offset, alpha);
+  }
+  else
+  {
+    Level_Draw(0);
+    Objects_Draw(0, alpha);
+  }
+}
+
 void Sound_PlayHit()
 {
-  int idx = rand() % 17;
+  int idx = Random_Below(RS_Audio, 17);
   Sound_Play(&HIT_SOUNDS[idx], RETRO_SOUND_DEFAULT_VOLUME);
 }
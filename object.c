@@ -1,6 +1,18 @@
 #include "functions.h"
 
-#define MAX_OBJECTS 20
+#define OBJECTS_DEFAULT_CAPACITY 20
+#define OBJECT_INDEX_BITS        16
+#define OBJECT_INDEX_MASK        ((1 << OBJECT_INDEX_BITS) - 1)
+#define OBJECT_GENERATION_MASK   ((1 << (32 - OBJECT_INDEX_BITS)) - 1)
+#define OBJECTS_MAX_CAPACITY     OBJECT_INDEX_MASK
+#define OBJECT_FREE_WORDS(n)     (((n) + 31) >> 5)
+#define OBJECT_GRID_CELL_W       (32 * 100)
+#define OBJECT_GRID_CELL_H       (16 * 100)
+#define OBJECT_GRID_BUCKET_BITS  10
+#define OBJECT_GRID_BUCKETS      (1 << OBJECT_GRID_BUCKET_BITS)
+#define OBJECT_GRID_MAX_QUERY    64
+#define OBJECTS_TICK_GRAIN       64
+#define OBJECTS_SNAPSHOT_RESERVE Kilobytes(4)   // Snapshot room for the engine, level and game state
 #define SCALE 100
 #define RAGE_TIMER 25
 #define RAGE_VUN 14
@@ -16,6 +28,25 @@ typedef enum
   MS_KO
 } MoveState;
 
+typedef enum
+{
+  OL_Type,
+  OL_Section,
+  OL_Grid,
+  OL_COUNT
+} ObjectList;
+
+// Links within an intrusive list, as slots (index + 1), 0 is the end of the list.
+typedef struct
+{
+  u16 next, prev;
+} ObjectLink;
+
+typedef struct
+{
+  u16 head, tail;
+} ObjectListEnds;
+
 typedef struct
 {
   i32 sx, sy;
@@ -44,14 +75,7 @@ typedef struct
   u8  rage;
   u8  rageTimer;
 
-  i32 x;
-  i32 y;
-  i16 velocityX;
-  i16 velocityY;
-  i16 accelerationX;
-  i16 accelerationY;
-
-  u16 trackingObject;
+  u32 trackingObject;
   
   u32 bDirection                 : 1;
   u32 bIsHitting                 : 1;
@@ -64,15 +88,195 @@ typedef struct
   u32 bAiIsHead                  : 1;
   u32 bAiStayDistance            : 1;
   u32 bFrameAnimationEnded       : 1;
+  u32 bKOPending                 : 1;
 
-  u16 nextDrawId;
+  u16 hitTarget;                 // Slot hit this tick, applied by Object_Resolve
+  u32 random;
 
-  Hitbox bounds, boundsHit, aiDetection;
+  ObjectLink links[OL_COUNT];
   
 } Object;
 
-Object  sObjects[MAX_OBJECTS];
-u16     sDrawOrder[64];
+// Hot fields, read every tick, are kept apart from the rest of the Object in
+// parallel arrays, indexed the same as sObjects.
+typedef struct
+{
+  i32 x;
+  i32 y;
+  i32 prevX;                     // Position at the start of the tick, for drawing between ticks
+  i32 prevY;
+  i16 velocityX;
+  i16 velocityY;
+  i16 accelerationX;
+  i16 accelerationY;
+} ObjectMotion;
+
+typedef struct
+{
+  Hitbox bounds, boundsHit, aiDetection;
+} ObjectHitboxes;
+
+// What other objects may read of an object while the objects tick in parallel, as it was at the
+// start of the tick.
+typedef struct
+{
+  i32    x, y;
+  Hitbox bounds;
+  u8     type;
+  bool   isDead;
+} ObjectSnapshot;
+
+// The most Objects_Snapshot writes for a store of n objects.
+#define OBJECTS_SNAPSHOT_BYTES(n) ((n) * (sizeof(Object) + sizeof(ObjectMotion) + sizeof(ObjectHitboxes) + 2 * sizeof(u16)) + \
+                                   OBJECT_FREE_WORDS(n) * sizeof(u32) + sizeof(sTypeLists) + sizeof(sSectionLists) + 5 * sizeof(u32))
+
+Object*         sObjects;
+ObjectMotion*   sMotion;
+ObjectHitboxes* sHitboxes;
+u16*            sGenerations;
+u32             sObjectCapacity;
+u32             sObjectCount;     // One past the highest slot ever used.
+u32*            sFreeSlots;       // A bit per slot, set while the slot is free.
+u32             sFreeCount;
+u32             sFreeWord;        // No free slot is below this word.
+ObjectListEnds  sTypeLists[OT_COUNT + 1];
+ObjectListEnds  sSectionLists[256];
+ObjectListEnds  sGridLists[OBJECT_GRID_BUCKETS];
+BroadphaseStats sBroadphase;
+BroadphaseStats sWorkerBroadphase[RETRO_JOB_MAX_THREADS];
+ObjectSnapshot* sSnapshot;
+u16*            sDrawKeys;
+u16*            sDrawSlots;
+u16*            sDrawScratch;
+u16*            sDrawList;        // Slots, back to front.
+u32             sDrawCount;
+
+static inline ObjectMotion* Object_Motion(Object* object)
+{
+  return &sMotion[object - sObjects];
+}
+
+static inline ObjectHitboxes* Object_Hitboxes(Object* object)
+{
+  return &sHitboxes[object - sObjects];
+}
+
+// xorshift32. Each object draws from its own stream, so its rolls don't depend on which thread
+// ticks it, or when.
+static inline i32 Object_Random(Object* object)
+{
+  u32 x = object->random;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  object->random = x;
+  return (i32) (x >> 1);
+}
+
+// Ids are the slot in the low bits, and the slot's generation in the high bits. The generation
+// is bumped on release, so an id kept after its object is destroyed no longer resolves.
+static inline u32 Object_Id(u32 index)
+{
+  return ((u32) sGenerations[index] << OBJECT_INDEX_BITS) | (index + 1);
+}
+
+// A stale id resolves again only once its slot has been reused 65536 times, as the generation
+// wraps at OBJECT_GENERATION_MASK.
+static inline Object* Objects_Get(u32 id)
+{
+  u32 slot = id & OBJECT_INDEX_MASK;
+
+  if (slot == 0 || slot > sObjectCount)
+    return NULL;
+
+  Object* object = &sObjects[slot - 1];
+
+  if (object->type == OT_None || (id >> OBJECT_INDEX_BITS) != sGenerations[slot - 1])
+    return NULL;
+
+  return object;
+}
+
+static inline Object* ObjectList_First(u16 head)
+{
+  return head != 0 ? &sObjects[head - 1] : NULL;
+}
+
+static inline Object* ObjectList_Next(Object* object, u8 list)
+{
+  return ObjectList_First(object->links[list].next);
+}
+
+static void ObjectList_Push(ObjectListEnds* ends, u32 index, u8 list)
+{
+  u16 slot = index + 1;
+  ObjectLink* link = &sObjects[index].links[list];
+  link->prev = ends->tail;
+  link->next = 0;
+
+  if (ends->tail != 0)
+    sObjects[ends->tail - 1].links[list].next = slot;
+  else
+    ends->head = slot;
+
+  ends->tail = slot;
+}
+
+static void ObjectList_Remove(ObjectListEnds* ends, u32 index, u8 list)
+{
+  ObjectLink* link = &sObjects[index].links[list];
+
+  if (link->prev != 0)
+    sObjects[link->prev - 1].links[list].next = link->next;
+  else
+    ends->head = link->next;
+
+  if (link->next != 0)
+    sObjects[link->next - 1].links[list].prev = link->prev;
+  else
+    ends->tail = link->prev;
+
+  link->next = 0;
+  link->prev = 0;
+}
+
+// Lists are in the order objects joined them, not slot order. Where the first of a type matters
+// (the player, the enemy that leads) it is the lowest slot, the one a walk over the slots finds.
+static Object* ObjectList_Lowest(u8 type, bool live)
+{
+  Object* lowest = NULL;
+
+  for (Object* object = ObjectList_First(sTypeLists[type].head); object != NULL; object = ObjectList_Next(object, OL_Type))
+  {
+    if ((live && object->bIsDead) || (lowest != NULL && object > lowest))
+      continue;
+    lowest = object;
+  }
+
+  return lowest;
+}
+
+static inline void Objects_PushFree(u32 index)
+{
+  sFreeSlots[index >> 5] |= 1u << (index & 31);
+  sFreeCount++;
+
+  if ((index >> 5) < sFreeWord)
+    sFreeWord = index >> 5;
+}
+
+// The lowest free slot, so slots are reused in the order they always were.
+static inline u32 Objects_PopFree()
+{
+  while (sFreeSlots[sFreeWord] == 0)
+    sFreeWord++;
+
+  u32 bits = sFreeSlots[sFreeWord];
+  u32 index = (sFreeWord << 5) + SDL_MostSignificantBitIndex32(bits & (~bits + 1));
+  sFreeSlots[sFreeWord] = bits & (bits - 1);
+  sFreeCount--;
+  return index;
+}
 
 static i32 ClampPosition(i32 position, i16* velocity, i32 min, i32 max)
 {
@@ -104,22 +308,22 @@ static inline bool CanMoveForAcceleration(Object* object)
 
 static inline bool IsMovingX(Object* object)
 {
-  return object->velocityX != 0;
+  return Object_Motion(object)->velocityX != 0;
 }
 
 static inline bool IsMovingY(Object* object)
 {
-  return object->velocityY != 0;
+  return Object_Motion(object)->velocityY != 0;
 }
 
 static inline bool IsNotReallyMovingX(Object* object)
 {
-  return abs(object->velocityX) < 25;
+  return abs(Object_Motion(object)->velocityX) < 25;
 }
 
 static inline bool IsNotReallyMovingY(Object* object)
 {
-  return abs(object->velocityY) < 25;
+  return abs(Object_Motion(object)->velocityY) < 25;
 }
 
 static inline bool IsMoving(Object* object)
@@ -139,8 +343,10 @@ static inline bool IsReallyCrouching(Object* object)
 
 
 void Object_PreTick(Object* object);
-void Object_Tick(Object* object, bool stillScreen);
-void Object_Draw(Object* object, i32 xOffset);
+void Object_Tick(Object* object, bool stillScreen, BroadphaseStats* stats);
+void Object_Resolve(Object* object);
+void Object_Draw(Object* object, i32 xOffset, f32 alpha);
+void Object_DrawHud(Object* object);
 void Object_Initialise(Object* object, u8 type, u8 section);
 void Object_Clear(Object* object);
 void Object_SetMoveDelta(Object* object, u8 moveVector);
@@ -151,60 +357,188 @@ void Object_ResetAnim(Object* object, u8 anim);
 
 void GroupEnemyObject_Tick();
 
+bool Objects_SetCapacity(u32 capacity)
+{
+  if (capacity > OBJECTS_MAX_CAPACITY)
+    capacity = OBJECTS_MAX_CAPACITY;
+
+  if (capacity <= sObjectCapacity)
+    return true;
+
+  // With rollback on, the store may only grow as far as a snapshot can hold all of it.
+  if (Snapshot_IsEnabled())
+  {
+    while (capacity > sObjectCapacity && OBJECTS_SNAPSHOT_BYTES(capacity) > RETRO_SNAPSHOT_SIZE - OBJECTS_SNAPSHOT_RESERVE)
+      capacity = sObjectCapacity + (capacity - sObjectCapacity) / 2;
+
+    if (capacity == sObjectCapacity)
+    {
+      printf("Object store can't grow past %u objects and fit in RETRO_SNAPSHOT_SIZE\n", sObjectCapacity);
+      return false;
+    }
+  }
+
+  Object*         objects  = realloc(sObjects,  capacity * sizeof(Object));
+  ObjectMotion*   motion   = objects  ? realloc(sMotion,   capacity * sizeof(ObjectMotion))   : NULL;
+  ObjectHitboxes* hitboxes = motion   ? realloc(sHitboxes, capacity * sizeof(ObjectHitboxes)) : NULL;
+  u16*            generations = hitboxes ? realloc(sGenerations, capacity * sizeof(u16)) : NULL;
+  u32*            freeSlots = generations ? realloc(sFreeSlots, OBJECT_FREE_WORDS(capacity) * sizeof(u32)) : NULL;
+  ObjectSnapshot* snapshot = freeSlots ? realloc(sSnapshot, capacity * sizeof(ObjectSnapshot)) : NULL;
+  u16*            drawKeys    = snapshot  ? realloc(sDrawKeys,    capacity * sizeof(u16)) : NULL;
+  u16*            drawSlots   = drawKeys  ? realloc(sDrawSlots,   capacity * sizeof(u16)) : NULL;
+  u16*            drawScratch = drawSlots ? realloc(sDrawScratch, capacity * sizeof(u16)) : NULL;
+  u16*            drawList    = drawScratch ? realloc(sDrawList,  capacity * sizeof(u16)) : NULL;
+
+  if (objects)     sObjects     = objects;
+  if (motion)      sMotion      = motion;
+  if (hitboxes)    sHitboxes    = hitboxes;
+  if (generations) sGenerations = generations;
+  if (freeSlots)   sFreeSlots   = freeSlots;
+  if (snapshot)    sSnapshot    = snapshot;
+  if (drawKeys)    sDrawKeys    = drawKeys;
+  if (drawSlots)   sDrawSlots   = drawSlots;
+  if (drawScratch) sDrawScratch = drawScratch;
+  if (drawList)    sDrawList    = drawList;
+
+  if (drawList == NULL)
+  {
+    printf("Could not grow object store to %u objects\n", capacity);
+    return false;
+  }
+
+  SDL_memset(sObjects  + sObjectCapacity, 0, (capacity - sObjectCapacity) * sizeof(Object));
+  SDL_memset(sMotion   + sObjectCapacity, 0, (capacity - sObjectCapacity) * sizeof(ObjectMotion));
+  SDL_memset(sHitboxes + sObjectCapacity, 0, (capacity - sObjectCapacity) * sizeof(ObjectHitboxes));
+  SDL_memset(sGenerations + sObjectCapacity, 0, (capacity - sObjectCapacity) * sizeof(u16));
+  SDL_memset(sFreeSlots + OBJECT_FREE_WORDS(sObjectCapacity), 0, (OBJECT_FREE_WORDS(capacity) - OBJECT_FREE_WORDS(sObjectCapacity)) * sizeof(u32));
+  sObjectCapacity = capacity;
+  return true;
+}
+
 void Objects_Setup()
 {
-  SDL_memset(&sObjects, 0, sizeof(sObjects));
+  if (sObjectCapacity < OBJECTS_DEFAULT_CAPACITY)
+    Objects_SetCapacity(OBJECTS_DEFAULT_CAPACITY);
+
+  Objects_Clear();
 }
 
 void Objects_Teardown()
 {
-  SDL_memset(&sObjects, 0, sizeof(sObjects));
+  free(sObjects);
+  free(sMotion);
+  free(sHitboxes);
+  free(sGenerations);
+  free(sFreeSlots);
+  free(sSnapshot);
+  free(sDrawKeys);
+  free(sDrawSlots);
+  free(sDrawScratch);
+  free(sDrawList);
+  sObjects = NULL;
+  sMotion = NULL;
+  sHitboxes = NULL;
+  sGenerations = NULL;
+  sFreeSlots = NULL;
+  sSnapshot = NULL;
+  sDrawKeys = NULL;
+  sDrawSlots = NULL;
+  sDrawScratch = NULL;
+  sDrawList = NULL;
+  sObjectCapacity = 0;
+  sDrawCount = 0;
+  sObjectCount = 0;
+  sFreeCount = 0;
+  sFreeWord = 0;
+  SDL_memset(sTypeLists, 0, sizeof(sTypeLists));
+  SDL_memset(sSectionLists, 0, sizeof(sSectionLists));
+}
+
+static void Objects_Release(u32 index)
+{
+  Object* object = &sObjects[index];
+
+  if (object->type == OT_None)
+    return;
+
+  ObjectList_Remove(&sTypeLists[object->type], index, OL_Type);
+  ObjectList_Remove(&sSectionLists[object->section], index, OL_Section);
+  Object_Clear(object);
+
+  sGenerations[index] = (sGenerations[index] + 1) & OBJECT_GENERATION_MASK;
+
+  Objects_PushFree(index);
 }
 
-u16  Objects_Create(u8 type, u8 section)
+u32  Objects_Create(u8 type, u8 section)
 {
-  for (int i = 0; i < MAX_OBJECTS; i++)
+  u32 index;
+
+  if (sFreeCount != 0)
   {
-    Object* object = &sObjects[i];
-    if (object->type == 0)
+    index = Objects_PopFree();
+  }
+  else
+  {
+    if (sObjectCount == sObjectCapacity)
     {
-      Object_Initialise(object, type, section);
-
-      return 1 + i;
+      if (Objects_SetCapacity(sObjectCapacity < OBJECTS_DEFAULT_CAPACITY ? OBJECTS_DEFAULT_CAPACITY : sObjectCapacity * 2) == false)
+        return 0;
+      if (sObjectCount == sObjectCapacity)
+        return 0;
     }
+
+    index = sObjectCount++;
   }
 
-  return 0;
+  Object_Initialise(&sObjects[index], type, section);
+  ObjectList_Push(&sTypeLists[type], index, OL_Type);
+  ObjectList_Push(&sSectionLists[section], index, OL_Section);
+
+  return Object_Id(index);
 }
 
-void Objects_Destroy(u16 id)
+void Objects_Destroy(u32 id)
 {
-  if (id != 0)
+  Object* object = Objects_Get(id);
+  if (object != NULL)
   {
-    Object_Clear(&sObjects[id - 1]);
+    Objects_Release(object - sObjects);
   }
 }
 
 void Objects_DestroySection(u8 section)
 {
-  for (int i = 0; i < MAX_OBJECTS; i++)
+  Object* object = ObjectList_First(sSectionLists[section].head);
+  while (object != NULL)
   {
-    Object* object = &sObjects[i];
-    if (object->section == section)
-    {
-      Object_Clear(object);
-    }
+    Object* next = ObjectList_Next(object, OL_Section);
+    Objects_Release(object - sObjects);
+    object = next;
   }
 }
 
-void Object_KO(Object* object)
+static void Object_SetType(Object* object, u8 type)
+{
+  u32 index = object - sObjects;
+  ObjectList_Remove(&sTypeLists[object->type], index, OL_Type);
+  object->type = type;
+  ObjectList_Push(&sTypeLists[type], index, OL_Type);
+}
+
+static void Object_MarkKO(Object* object)
 {
   object->bIsDead = true;
   Object_ResetAnim(object, ANIM_Death);
-  object->type = OT_Corpse;
   object->bAiIsHead = 0;
 }
 
+void Object_KO(Object* object)
+{
+  Object_MarkKO(object);
+  Object_SetType(object, OT_Corpse);
+}
+
 void Object_Heal(Object* object)
 {
   object->hp = 4;
@@ -214,99 +548,363 @@ void Object_Heal(Object* object)
 
 void Objects_KO(u8 type)
 {
-  for (int i = 0; i < MAX_OBJECTS; i++)
+  Object* object = ObjectList_First(sTypeLists[type].head);
+  while (object != NULL)
+  {
+    Object* next = ObjectList_Next(object, OL_Type);
+    Object_KO(object);
+    object = next;
+  }
+}
+
+void Objects_Heal(u8 type)
+{
+  for (Object* object = ObjectList_First(sTypeLists[type].head); object != NULL; object = ObjectList_Next(object, OL_Type))
+  {
+    Object_Heal(object);
+  }
+}
+
+void Objects_Clear()
+{
+  for(u32 i=0;i < sObjectCount;i++)
+  {
+    Objects_Release(i);
+  }
+
+  SDL_memset(sFreeSlots, 0, OBJECT_FREE_WORDS(sObjectCount) * sizeof(u32));
+  sObjectCount = 0;
+  sFreeCount = 0;
+  sFreeWord = 0;
+  sDrawCount = 0;
+}
+
+void Objects_ClearExcept(u8 type)
+{
+  for (u8 other = OT_Player; other <= OT_COUNT; other++)
+  {
+    if (other == type)
+      continue;
+
+    while (sTypeLists[other].head != 0)
+    {
+      Objects_Release(sTypeLists[other].head - 1);
+    }
+  }
+}
+
+u32  Objects_FindFirstOf(u8 type)
+{
+  Object* object = ObjectList_Lowest(type, false);
+  return object != NULL ? Object_Id(object - sObjects) : 0;
+}
+
+void Objects_PreTick()
+{
+  RETRO_ZONE_BEGIN(Objects_PreTick);
+
+  for (u32 i = 0; i < sObjectCount; i++)
   {
     Object* object = &sObjects[i];
-    if (object->type == type)
+    if (object->type != 0)
     {
-      Object_KO(object);
+      Object_PreTick(object);
     }
   }
+
+  GroupEnemyObject_Tick();
+
+  RETRO_ZONE_END(Objects_PreTick);
 }
 
-void Objects_Heal(u8 type)
+static inline i32 Grid_Cell(i32 v, i32 size)
+{
+  return v >= 0 ? v / size : -((size - 1 - v) / size);
+}
+
+static inline u32 Grid_Bucket(i32 cx, i32 cy)
+{
+  return (((u32) cx * 0x9E3779B1u) ^ ((u32) cy * 0x85EBCA77u)) >> (32 - OBJECT_GRID_BUCKET_BITS);
+}
+
+// Objects are binned by the top-left of their bounds, into hashed cells over world x and depth.
+// The grid and the snapshot are both taken before anything moves, so queries are only widened by a
+// bounds size, for bounds starting in a neighbouring cell.
+static void Objects_BuildSnapshot(bool grid)
 {
-  for (int i = 0; i < MAX_OBJECTS; i++)
+  u64 begin = SDL_GetPerformanceCounter();
+
+  if (grid)
+  {
+    SDL_memset(sGridLists, 0, sizeof(sGridLists));
+  }
+
+  for (u32 i = 0; i < sObjectCount; i++)
   {
     Object* object = &sObjects[i];
-    if (object->type == type)
+    ObjectSnapshot* snapshot = &sSnapshot[i];
+
+    snapshot->type = object->type;
+
+    if (object->type == OT_None)
+      continue;
+
+    snapshot->x = sMotion[i].x;
+    snapshot->y = sMotion[i].y;
+    sMotion[i].prevX = sMotion[i].x;
+    sMotion[i].prevY = sMotion[i].y;
+    snapshot->bounds = sHitboxes[i].bounds;
+    snapshot->isDead = object->bIsDead;
+
+    if (grid)
     {
-      Object_Heal(object);
+      Hitbox* bounds = &snapshot->bounds;
+      u32 bucket = Grid_Bucket(Grid_Cell(bounds->x0, OBJECT_GRID_CELL_W), Grid_Cell(bounds->y0, OBJECT_GRID_CELL_H));
+      ObjectList_Push(&sGridLists[bucket], i, OL_Grid);
+      sBroadphase.objects++;
     }
   }
+
+  sBroadphase.ticks += SDL_GetPerformanceCounter() - begin;
 }
 
-void Objects_Clear()
+static inline bool Objects_IsTarget(Object* object, Object* other, ObjectSnapshot* snapshot, bool opponents)
+{
+  if (other == object || snapshot->type == OT_None || snapshot->isDead)
+    return false;
+
+  return opponents == false || (snapshot->type == OT_Player) != (object->type == OT_Player);
+}
+
+// The lowest slot live object, other than the querying one, whose bounds at the start of the tick
+// overlap the query box. With opponents, only the other side (player vs. everyone else) counts.
+// The same as Objects_ScanHit, but only over the grid cells it can be in.
+static Object* Objects_QueryHit(Object* object, Hitbox* query, bool opponents, BroadphaseStats* stats)
+{
+  u64 begin = SDL_GetPerformanceCounter();
+  Object* hit = NULL;
+
+  i32 cx0 = Grid_Cell(query->x0 - CHARACTER_FRAME_W * 50, OBJECT_GRID_CELL_W);
+  i32 cx1 = Grid_Cell(query->x1, OBJECT_GRID_CELL_W);
+  i32 cy0 = Grid_Cell(query->y0 - CHARACTER_FRAME_H * 100, OBJECT_GRID_CELL_H);
+  i32 cy1 = Grid_Cell(query->y1, OBJECT_GRID_CELL_H);
+
+  u32 buckets[OBJECT_GRID_MAX_QUERY];
+  u32 bucketCount = 0;
+
+  for (i32 cy = cy0; cy <= cy1; cy++)
+  {
+    for (i32 cx = cx0; cx <= cx1; cx++)
+    {
+      u32 bucket = Grid_Bucket(cx, cy);
+      u32 j = 0;
+
+      // Different cells can share a bucket, each bucket is only walked once.
+      while (j < bucketCount && buckets[j] != bucket)
+        j++;
+
+      if (j == bucketCount && bucketCount < OBJECT_GRID_MAX_QUERY)
+      {
+        buckets[bucketCount++] = bucket;
+      }
+    }
+  }
+
+  // Buckets are in slot order, so each is walked up to its first overlap, or past the best so far.
+  for (u32 i = 0; i < bucketCount; i++)
+  {
+    stats->cells++;
+
+    for (Object* other = ObjectList_First(sGridLists[buckets[i]].head); other != NULL; other = ObjectList_Next(other, OL_Grid))
+    {
+      if (hit != NULL && other > hit)
+        break;
+
+      if (Objects_IsTarget(object, other, &sSnapshot[other - sObjects], opponents) == false)
+        continue;
+
+      stats->candidates++;
+
+      if (Collision_BoxVsBox_Simple(query, &sSnapshot[other - sObjects].bounds))
+      {
+        stats->pairs++;
+        hit = other;
+        break;
+      }
+    }
+  }
+
+  stats->queries++;
+  stats->ticks += SDL_GetPerformanceCounter() - begin;
+  return hit;
+}
+
+static Object* Objects_ScanHit(Object* object, Hitbox* query, bool opponents)
 {
-  for(int i=0;i < MAX_OBJECTS;i++)
+  for (u32 i = 0; i < sObjectCount; i++)
   {
-    Object_Clear(&sObjects[i]);
+    Object* other = &sObjects[i];
+    ObjectSnapshot* snapshot = &sSnapshot[i];
+
+    if (Objects_IsTarget(object, other, snapshot, opponents) == false)
+      continue;
+
+    if (Collision_BoxVsBox_Simple(query, &snapshot->bounds))
+      return other;
   }
+
+  return NULL;
 }
 
-void Objects_ClearExcept(u8 type)
+u32  Objects_CheckBroadphase()
 {
-  for (int i = 0; i < MAX_OBJECTS; i++)
+  BroadphaseStats stats;
+  SDL_memset(&stats, 0, sizeof(stats));
+  u32 mismatches = 0;
+
+  Objects_BuildSnapshot(true);
+
+  for (u32 i = 0; i < sObjectCount; i++)
   {
     Object* object = &sObjects[i];
-    if (object->type != type)
+
+    if (object->type == OT_None)
+      continue;
+
+    Hitbox* query = &Object_Hitboxes(object)->aiDetection;
+
+    for (u32 opponents = 0; opponents < 2; opponents++)
     {
-      Object_Clear(object);
+      if (Objects_QueryHit(object, query, opponents, &stats) != Objects_ScanHit(object, query, opponents))
+        mismatches++;
     }
   }
+
+  return mismatches;
 }
 
-u16  Objects_FindFirstOf(u8 type)
+u32  Objects_Hash()
 {
-  for (int i = 0; i < MAX_OBJECTS; i++)
+  u32 hash = 2166136261u;
+
+  const u8* parts[3] = { (const u8*) sObjects, (const u8*) sMotion, (const u8*) sHitboxes };
+  u32 sizes[3] = { sizeof(Object), sizeof(ObjectMotion), sizeof(ObjectHitboxes) };
+
+  for (u32 p = 0; p < 3; p++)
   {
-    Object* object = &sObjects[i];
-    if (object->type == type)
+    for (u32 i = 0; i < sObjectCount * sizes[p]; i++)
     {
-      return 1 + i;
+      hash = (hash ^ parts[p][i]) * 16777619u;
     }
   }
-  return 0;
+
+  return hash;
 }
 
-void Objects_PreTick()
+// Slots past the count are cleared before use, but appending one takes its generation as it is,
+// so the generations are kept for the whole store. Slots grown since the capture were zero then.
+// The grid and the tick snapshot are rebuilt every tick.
+void Objects_Snapshot()
 {
-  for (int i = 0; i < 64;i++)
+  u32 count = sObjectCount;
+  u32 capacity = sObjectCapacity;
+  Snapshot_Bytes(&count, sizeof(count));
+  Snapshot_Bytes(&capacity, sizeof(capacity));
+
+  if (Snapshot_IsRestoring())
   {
-    sDrawOrder[i] = 0;
+    if (capacity > sObjectCapacity && Objects_SetCapacity(capacity) == false)
+      return;
+    SDL_memset(sGenerations + capacity, 0, (sObjectCapacity - capacity) * sizeof(u16));
+    SDL_memset(sFreeSlots + OBJECT_FREE_WORDS(capacity), 0, (OBJECT_FREE_WORDS(sObjectCapacity) - OBJECT_FREE_WORDS(capacity)) * sizeof(u32));
+    sObjectCount = count;
   }
 
-  for (int i = 0; i < MAX_OBJECTS; i++)
+  Snapshot_Bytes(sObjects, count * sizeof(Object));
+  Snapshot_Bytes(sMotion, count * sizeof(ObjectMotion));
+  Snapshot_Bytes(sHitboxes, count * sizeof(ObjectHitboxes));
+  Snapshot_Bytes(sGenerations, capacity * sizeof(u16));
+  Snapshot_Bytes(sFreeSlots, OBJECT_FREE_WORDS(capacity) * sizeof(u32));
+  Snapshot_Bytes(&sFreeCount, sizeof(sFreeCount));
+  Snapshot_Bytes(&sFreeWord, sizeof(sFreeWord));
+  Snapshot_Bytes(sTypeLists, sizeof(sTypeLists));
+  Snapshot_Bytes(sSectionLists, sizeof(sSectionLists));
+  Snapshot_Bytes(&sDrawCount, sizeof(sDrawCount));
+  Snapshot_Bytes(sDrawList, sDrawCount * sizeof(u16));
+}
+
+void Objects_GetBroadphaseStats(BroadphaseStats* outStats)
+{
+  *outStats = sBroadphase;
+  outStats->microseconds = (u32) ((sBroadphase.ticks * 1000000) / SDL_GetPerformanceFrequency());
+}
+
+static void Objects_TickRange(u32 begin, u32 end, u32 worker, void* user)
+{
+  bool stillScreen = *(bool*) user;
+
+  for (u32 i = begin; i < end; i++)
   {
     Object* object = &sObjects[i];
     if (object->type != 0)
     {
-      Object_PreTick(object);
+      Object_Tick(object, stillScreen, &sWorkerBroadphase[worker]);
     }
   }
-
-  GroupEnemyObject_Tick();
 }
 
 void Objects_Tick(bool stillScreen)
 {
-  for(int i=0;i < MAX_OBJECTS;i++)
+  RETRO_ZONE_BEGIN(Objects_Tick);
+
+  SDL_memset(&sBroadphase, 0, sizeof(sBroadphase));
+  SDL_memset(sWorkerBroadphase, 0, sizeof(sWorkerBroadphase));
+
+  // Objects tick in parallel against the snapshot, changing only themselves. Anything they do to
+  // other objects (hits) or to shared state (KO, sounds) is then resolved in slot order, so the
+  // outcome is the same for any number of threads.
+  Objects_BuildSnapshot(stillScreen);
+
+  Jobs_ParallelFor(sObjectCount, OBJECTS_TICK_GRAIN, Objects_TickRange, &stillScreen);
+
+  for (u32 i = 0; i < RETRO_JOB_MAX_THREADS; i++)
+  {
+    BroadphaseStats* stats = &sWorkerBroadphase[i];
+    sBroadphase.queries += stats->queries;
+    sBroadphase.cells += stats->cells;
+    sBroadphase.candidates += stats->candidates;
+    sBroadphase.pairs += stats->pairs;
+    sBroadphase.ticks += stats->ticks;
+  }
+
+  for (u32 i = 0; i < sObjectCount; i++)
   {
     Object* object = &sObjects[i];
     if (object->type != 0)
     {
-      Object_Tick(object, stillScreen);
+      Object_Resolve(object);
     }
   }
 
-  for (int i = 0; i < MAX_OBJECTS; i++)
+  // Draw order is a two pass LSD radix sort on depth, deepest first. Being stable, objects at the
+  // same depth keep their slot order. Keys and counts are gathered in the same pass as frameDepth.
+  u32 counts[2][256];
+  SDL_memset(counts, 0, sizeof(counts));
+  sDrawCount = 0;
+
+  for (u32 i = 0; i < sObjectCount; i++)
   {
     Object* object = &sObjects[i];
-    u8 y = object->y / 100;
-    if (y < 0)
-     y = 0;
-    else if (y >= 64)
-     y = 63;
+    if (object->type == 0)
+      continue;
+
+    i32 depth = sMotion[i].y;
+    if (depth < 0)
+      depth = 0;
+    else if (depth > 0xFFFF)
+      depth = 0xFFFF;
+
+    u8 y = depth / 100 >= 64 ? 63 : depth / 100;
     
     if (y < 32)
       object->frameDepth = 0;
@@ -317,57 +915,96 @@ void Objects_Tick(bool stillScreen)
     else
       object->frameDepth = 3;
 
-    y = 63 - y;
+    u16 key = (u16) (0xFFFF - depth);
+    counts[0][key & 0xFF]++;
+    counts[1][key >> 8]++;
 
-    u16 head = sDrawOrder[y];
+    sDrawKeys[sDrawCount] = key;
+    sDrawSlots[sDrawCount] = (u16) i;
+    sDrawCount++;
+  }
 
-    if (head != 0)
-    {
-      object->nextDrawId = head;
-    }
-    
-    sDrawOrder[y] = 1 + i;
+  u32 offsets[2] = { 0, 0 };
+  for (u32 i = 0; i < 256; i++)
+  {
+    u32 low = counts[0][i], high = counts[1][i];
+    counts[0][i] = offsets[0];
+    counts[1][i] = offsets[1];
+    offsets[0] += low;
+    offsets[1] += high;
+  }
+
+  for (u32 i = 0; i < sDrawCount; i++)
+  {
+    sDrawScratch[counts[0][sDrawKeys[i] & 0xFF]++] = (u16) i;
   }
 
+  for (u32 i = 0; i < sDrawCount; i++)
+  {
+    u16 n = sDrawScratch[i];
+    sDrawList[counts[1][sDrawKeys[n] >> 8]++] = sDrawSlots[n];
+  }
+
+  RETRO_ZONE_END(Objects_Tick);
 }
 
-void Objects_Draw(i32 xOffset)
+void Objects_Draw(i32 xOffset, f32 alpha)
 {
+  RETRO_ZONE_BEGIN(Objects_Draw);
+
 #if 0
-  for (int i = 0; i < MAX_OBJECTS; i++)
+  for (u32 i = 0; i < sObjectCount; i++)
   {
     Object* object = &sObjects[i];
     if (object->type != 0)
     {
-      Object_Draw(object, xOffset);
+      Object_Draw(object, xOffset, alpha);
     }
   }
 #else
-  for(int i=0;i < 64;i++)
+  Object* player = NULL;
+
+  Canvas_BeginBatch();
+
+  for (u32 i = 0; i < sDrawCount; i++)
   {
-    u16 head = sDrawOrder[i];
-    while(head != 0)
-    {
-      Object* obj = &sObjects[head - 1];
-      Object_Draw(obj, xOffset);
-      head = obj->nextDrawId;
-    }
+    Object* object = &sObjects[sDrawList[i]];
+
+    // Destroyed since the last tick.
+    if (object->type == OT_None)
+      continue;
+
+    Object_Draw(object, xOffset, alpha);
+
+    if (object->type == OT_Player)
+      player = object;
+  }
+
+  // The HUD goes over every sprite, rather than in the middle of the draw order.
+  if (player != NULL)
+  {
+    Object_DrawHud(player);
   }
+
+  Canvas_EndBatch();
 #endif
+
+  RETRO_ZONE_END(Objects_Draw);
 }
 
-void Objects_SetPosition(u16 id, i32 x, u16 y)
+void Objects_SetPosition(u32 id, i32 x, u16 y)
 {
-  if (id != 0)
+  Object* object = Objects_Get(id);
+  if (object != NULL)
   {
-    Object_SetPosition(&sObjects[id - 1], x, y);
+    Object_SetPosition(object, x, y);
   }
 }
 
 void Objects_ModPositions()
 {
 
-  for (int i = 0; i < MAX_OBJECTS; i++)
+  for (u32 i = 0; i < sObjectCount; i++)
   {
     Object* object = &sObjects[i];
     if (object->type != 0)
@@ -378,39 +1015,39 @@ void Objects_ModPositions()
 
 }
 
-void Objects_SetMovementVector(u16 id, u8 movementVector)
+void Objects_SetMovementVector(u32 id, u8 movementVector)
 {
-  if (id != 0)
+  Object* object = Objects_Get(id);
+  if (object != NULL)
   {
-    Object_SetMoveDelta(&sObjects[id - 1], movementVector);
+    Object_SetMoveDelta(object, movementVector);
   }
 }
 
-void Objects_SetMovementAction(u16 id, u8 movementAction)
+void Objects_SetMovementAction(u32 id, u8 movementAction)
 {
-  if (id != 0)
+  Object* object = Objects_Get(id);
+  if (object != NULL)
   {
-    Object_SetMoveAction(&sObjects[id - 1], movementAction);
+    Object_SetMoveAction(object, movementAction);
   }
 }
 
-void Objects_SetTrackingObject(u16 id, u16 other)
+void Objects_SetTrackingObject(u32 id, u32 other)
 {
-  if (id != 0)
+  Object* object = Objects_Get(id);
+  if (object != NULL)
   {
-    Object* object = &sObjects[id - 1];
     object->trackingObject = other;
     object->trackingTimer = 8;
   }
 }
 
-void Objects_SetTrackingObjectType(u8 type, u16 other)
+void Objects_SetTrackingObjectType(u8 type, u32 other)
 {
-  for(int i=0;i < MAX_OBJECTS;i++)
+  for (Object* object = ObjectList_First(sTypeLists[type].head); object != NULL; object = ObjectList_Next(object, OL_Type))
   {
-    Object* object = &sObjects[i];
-
-    if (object->bIsDead == false && object->type == type)
+    if (object->bIsDead == false)
     {
       object->trackingObject = other;
       object->trackingTimer = 8;
@@ -462,25 +1099,20 @@ void GroupEnemyObject_Tick()
   // See if there is a head, if not. Assign first.
   // Others should tick down and move to a random spot around target.
 
-  Object* head = NULL;
-  Object* player = NULL;
+  RETRO_ZONE_BEGIN(GroupEnemyObject_Tick);
 
-  for (int i = 0; i < MAX_OBJECTS; i++)
-  {
-    Object* object = &sObjects[i];
-    if (object->type != OT_Player || object->bIsDead)
-      continue;
-    player = object;
-    break;
-  }
+  Object* head = NULL;
+  Object* player = ObjectList_Lowest(OT_Player, true);
 
   if (player == NULL)
+  {
+    RETRO_ZONE_END(GroupEnemyObject_Tick);
     return;
+  }
 
-  for(int i=0;i < MAX_OBJECTS;i++)
+  for (Object* object = ObjectList_First(sTypeLists[OT_Enemy].head); object != NULL; object = ObjectList_Next(object, OL_Type))
   {
-    Object* object = &sObjects[i];
-    if (object->type != OT_Enemy || object->bIsDead)
+    if (object->bIsDead)
       continue;
     
     if (object->bAiIsHead)
@@ -493,23 +1125,23 @@ void GroupEnemyObject_Tick()
   // No head? We assign one, and with the others, we pick a target around the player.
   if (head == NULL)
   {
-    for (int i = 0; i < MAX_OBJECTS; i++)
+    head = ObjectList_Lowest(OT_Enemy, true);
+
+    for (Object* object = ObjectList_First(sTypeLists[OT_Enemy].head); object != NULL; object = ObjectList_Next(object, OL_Type))
     {
-      Object* object = &sObjects[i];
-      if (object->type != OT_Enemy || object->bIsDead)
+      if (object->bIsDead)
         continue;
 
-      if (head == NULL)
+      if (object == head)
       {
         object->bAiIsHead = 1;
-        head = object;
       }
       else
       {
         object->bAiIsHead = 0;
 
-        object->aiSoftTargetX = ((rand() % 300)) * 100;
-        object->aiSoftTargetY = ((rand() % 64)) * 100;
+        object->aiSoftTargetX = ((i32) Random_Below(RS_Simulation, 300)) * 100;
+        object->aiSoftTargetY = ((i32) Random_Below(RS_Simulation, 64)) * 100;
 
         if (object->aiSoftTargetX < 0)
           object->aiSoftTargetX = 0;
@@ -519,16 +1151,15 @@ void GroupEnemyObject_Tick()
         else if (object->aiSoftTargetY > 6400)
           object->aiSoftTargetY = 6400;
 
-        object->aiSoftTargetTimer = 1 + rand() % (30 * 8);
+        object->aiSoftTargetTimer = 1 + Random_Below(RS_Simulation, 30 * 8);
       }
     }
   }
   else
   {
-    for (int i = 0; i < MAX_OBJECTS; i++)
+    for (Object* object = ObjectList_First(sTypeLists[OT_Enemy].head); object != NULL; object = ObjectList_Next(object, OL_Type))
     {
-      Object* object = &sObjects[i];
-      if (object->type != OT_Enemy || object->bIsDead)
+      if (object->bIsDead)
         continue;
       if (object == head)
       {
@@ -539,10 +1170,10 @@ void GroupEnemyObject_Tick()
 
         if (object->aiSoftTargetTimer == 0)
         {
-          object->aiSoftTargetTimer = 1 + rand() % 15;
+          object->aiSoftTargetTimer = 1 + Random_Below(RS_Simulation, 15);
 
-          object->aiSoftTargetX = ((rand() % 300)) * 100;
-          object->aiSoftTargetY = ((rand() % 64)) * 100;
+          object->aiSoftTargetX = ((i32) Random_Below(RS_Simulation, 300)) * 100;
+          object->aiSoftTargetY = ((i32) Random_Below(RS_Simulation, 64)) * 100;
 
           if (object->aiSoftTargetX < 0)
             object->aiSoftTargetX = 0;
@@ -552,7 +1183,7 @@ void GroupEnemyObject_Tick()
           else if (object->aiSoftTargetY > 6400)
             object->aiSoftTargetY = 6400;
 
-          object->aiSoftTargetTimer = 1 + rand() % (30 * 8);
+          object->aiSoftTargetTimer = 1 + Random_Below(RS_Simulation, 30 * 8);
 
         }
 
@@ -560,6 +1191,7 @@ void GroupEnemyObject_Tick()
     }
   }
 
+  RETRO_ZONE_END(GroupEnemyObject_Tick);
 }
 
 #define SQ_PX(X) ((X * X) * 100)
@@ -601,6 +1233,11 @@ void PlayerObject_Tick(Object* object)
 
 void EnemyObject_Tick(Object* object)
 {
+  ObjectMotion* motion = Object_Motion(object);
+  Object* target = Objects_Get(object->trackingObject);
+
+  if (target == NULL)
+    object->trackingObject = 0;
 
   if (object->trackingObject != 0)
   {
@@ -609,21 +1246,21 @@ void EnemyObject_Tick(Object* object)
     if (object->trackingTimer == 0)
     {
       int distanceX = 0, distanceY = 0;
-      object->trackingTimer = 1 + rand() % 3;
+      object->trackingTimer = 1 + Object_Random(object) % 3;
       
       bool tryHit = false;
       
       if (object->bAiIsHead)
       {
-        Object* other = &sObjects[object->trackingObject - 1];
+        ObjectSnapshot* other = &sSnapshot[target - sObjects];
 
-        distanceX = (other->x - object->x);
-        distanceY = (other->y - object->y);
+        distanceX = (other->x - motion->x);
+        distanceY = (other->y - motion->y);
       }
       else
       {
-        distanceX = (object->aiSoftTargetX - object->x);
-        distanceY = (object->aiSoftTargetY - object->y);
+        distanceX = (object->aiSoftTargetX - motion->x);
+        distanceY = (object->aiSoftTargetY - motion->y);
       }
       
       int distanceSq = (distanceX * distanceX) + (distanceY * distanceY);
@@ -636,10 +1273,8 @@ void EnemyObject_Tick(Object* object)
       
       if (object->bAiIsHead)
       {
-        Object* other = &sObjects[object->trackingObject - 1];
-
         HitboxResult result;
-        if (Collision_BoxVsBox(&result, &object->aiDetection, &other->bounds))
+        if (Collision_BoxVsBox(&result, &Object_Hitboxes(object)->aiDetection, &sSnapshot[target - sObjects].bounds))
         {
           //shouldMove = true;
           //moveAway = true;
@@ -709,36 +1344,40 @@ void MoveFlags2Acceleration(Object* object)
   if (CanMoveForAcceleration(object) == false)
     return;
 
+  ObjectMotion* motion = Object_Motion(object);
+
   if ((object->moveFlags & MV_Left) != 0)
   {
-    object->accelerationX = -object->moveSpeedX;
+    motion->accelerationX = -object->moveSpeedX;
   }
 
   if ((object->moveFlags & MV_Right) != 0)
   {
-    object->accelerationX = object->moveSpeedX;
+    motion->accelerationX = object->moveSpeedX;
   }
 
   if ((object->moveFlags & MV_Up) != 0)
   {
-    object->accelerationY = object->moveSpeedY;
+    motion->accelerationY = object->moveSpeedY;
   }
 
   if ((object->moveFlags & MV_Down) != 0)
   {
-    object->accelerationY = -object->moveSpeedY;
+    motion->accelerationY = -object->moveSpeedY;
   }
 }
 
-void Object_Tick(Object* object, bool stillScreen)
+void Object_Tick(Object* object, bool stillScreen, BroadphaseStats* stats)
 {
+  ObjectMotion*   motion   = Object_Motion(object);
+  ObjectHitboxes* hitboxes = Object_Hitboxes(object);
 
-  i16 velocityX = object->velocityX;
-  i16 velocityY = object->velocityY;
+  i16 velocityX = motion->velocityX;
+  i16 velocityY = motion->velocityY;
   bool wasMoving = IsMoving(object);
 
-  object->accelerationX = 0;
-  object->accelerationY = 0;
+  motion->accelerationX = 0;
+  motion->accelerationY = 0;
 
   if (object->type == OT_Player && !stillScreen)
   {
@@ -768,7 +1407,7 @@ void Object_Tick(Object* object, bool stillScreen)
 
     // printf("** Animate\n");
     
-    if (object->x <= (100 * 10))
+    if (motion->x <= (100 * 10))
     {
       if (object->frameAnimation != ANIM_Walk)
         Object_ResetAnim(object, ANIM_Walk);
@@ -779,8 +1418,8 @@ void Object_Tick(Object* object, bool stillScreen)
     {
       if (object->frameAnimation != ANIM_Stand)
         Object_ResetAnim(object, ANIM_Stand);;
-      object->velocityX = 0;
-      object->velocityY = 0;
+      motion->velocityX = 0;
+      motion->velocityY = 0;
       object->bIsAnimating = false;
     }
 
@@ -815,7 +1454,10 @@ void Object_Tick(Object* object, bool stillScreen)
 
         if (object->hp == 0)
         {
-          Object_KO(object);
+          // Becoming a corpse relinks the type lists, which every object shares, so that part
+          // waits for Object_Resolve.
+          Object_MarkKO(object);
+          object->bKOPending = 1;
           // printf("** DEAD!\n");
         }
         else
@@ -830,11 +1472,11 @@ void Object_Tick(Object* object, bool stillScreen)
       else
       {
         if (object->bDirection == 1)
-          object->accelerationX -= rand() % 6;
+          motion->accelerationX -= Object_Random(object) % 6;
         else
-          object->accelerationX += rand() % 6;
+          motion->accelerationX += Object_Random(object) % 6;
 
-        object->accelerationY += (rand() % 6) - 3;
+        motion->accelerationY += (Object_Random(object) % 6) - 3;
       }
     }
     else
@@ -853,8 +1495,8 @@ void Object_Tick(Object* object, bool stillScreen)
             {
               Object_ResetAnim(object, ANIM_CrouchDown);
               object->moveState = MS_Crouch;
-              object->velocityX = 0;
-              object->velocityY = 0;
+              motion->velocityX = 0;
+              motion->velocityY = 0;
 
 
               // printf("** Down\n");
@@ -932,7 +1574,7 @@ void Object_Tick(Object* object, bool stillScreen)
             Object_ResetAnim(object, ANIM_CrouchPunch);
           else
           {
-            u32 r = rand() % 10;
+            u32 r = Object_Random(object) % 10;
             switch(r)
             {
               case 0:
@@ -980,15 +1622,15 @@ void Object_Tick(Object* object, bool stillScreen)
   
   }
 
-  velocityX = SolveVelocity(velocityX, object->accelerationX, 50, 400);
-  object->velocityX = velocityX;
-  object->x += object->velocityX;
+  velocityX = SolveVelocity(velocityX, motion->accelerationX, 50, 400);
+  motion->velocityX = velocityX;
+  motion->x += motion->velocityX;
 
-  velocityY = SolveVelocity(velocityY, object->accelerationY, 50, 400);
-  object->velocityY = velocityY;
-  object->y += object->velocityY;
-  object->y = ClampPosition(object->y, &object->velocityY, 0, 6400);
-  velocityY = object->velocityY;
+  velocityY = SolveVelocity(velocityY, motion->accelerationY, 50, 400);
+  motion->velocityY = velocityY;
+  motion->y += motion->velocityY;
+  motion->y = ClampPosition(motion->y, &motion->velocityY, 0, 6400);
+  velocityY = motion->velocityY;
 
   if (!object->bIsDead && object->bIsBeingDamaged == false)
   {
@@ -1000,122 +1642,48 @@ void Object_Tick(Object* object, bool stillScreen)
 
   object->moveFlags = 0;
 
-  object->sx = object->x / SCALE;  // (For now doesn't include screen scrolling, clipping, etc.)
-  object->sy = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (object->y / SCALE);
+  object->sx = motion->x / SCALE;  // (For now doesn't include screen scrolling, clipping, etc.)
+  object->sy = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (motion->y / SCALE);
 
-  object->bounds.x0 = object->x + CHARACTER_FRAME_W * 50 - CHARACTER_FRAME_W * 25;
-  object->bounds.y0 = object->y;
-  object->bounds.x1 = object->x + CHARACTER_FRAME_W * 50 + CHARACTER_FRAME_W * 25;
-  object->bounds.y1 = object->y + CHARACTER_FRAME_H * 100;
+  hitboxes->bounds.x0 = motion->x + CHARACTER_FRAME_W * 50 - CHARACTER_FRAME_W * 25;
+  hitboxes->bounds.y0 = motion->y;
+  hitboxes->bounds.x1 = motion->x + CHARACTER_FRAME_W * 50 + CHARACTER_FRAME_W * 25;
+  hitboxes->bounds.y1 = motion->y + CHARACTER_FRAME_H * 100;
 
   if (object->bDirection == 1)
   {
-    object->boundsHit.x0 = object->x + CHARACTER_FRAME_W * 50;
-    object->boundsHit.x1 = object->bounds.x1 + 100 * 16;
-    object->boundsHit.y0 = object->bounds.y0 + 100 * 25;
-    object->boundsHit.y1 = object->bounds.y0 + 100 * 30;
+    hitboxes->boundsHit.x0 = motion->x + CHARACTER_FRAME_W * 50;
+    hitboxes->boundsHit.x1 = hitboxes->bounds.x1 + 100 * 16;
+    hitboxes->boundsHit.y0 = hitboxes->bounds.y0 + 100 * 25;
+    hitboxes->boundsHit.y1 = hitboxes->bounds.y0 + 100 * 30;
   }
   else
   {
-    object->boundsHit.x0 = object->bounds.x0 - 100 * 16;
-    object->boundsHit.x1 = object->x + CHARACTER_FRAME_W * 50;
-    object->boundsHit.y0 = object->bounds.y0 + 100 * 25;
-    object->boundsHit.y1 = object->bounds.y0 + 100 * 30;
+    hitboxes->boundsHit.x0 = hitboxes->bounds.x0 - 100 * 16;
+    hitboxes->boundsHit.x1 = motion->x + CHARACTER_FRAME_W * 50;
+    hitboxes->boundsHit.y0 = hitboxes->bounds.y0 + 100 * 25;
+    hitboxes->boundsHit.y1 = hitboxes->bounds.y0 + 100 * 30;
   }
 
-  object->aiDetection.x0 = object->bounds.x0 - 100 * 16;
-  object->aiDetection.x1 = object->bounds.x1 + 100 * 16;
-  object->aiDetection.y0 = object->y;
-  object->aiDetection.y1 = object->y + CHARACTER_FRAME_H * 100;
+  hitboxes->aiDetection.x0 = hitboxes->bounds.x0 - 100 * 16;
+  hitboxes->aiDetection.x1 = hitboxes->bounds.x1 + 100 * 16;
+  hitboxes->aiDetection.y0 = motion->y;
+  hitboxes->aiDetection.y1 = motion->y + CHARACTER_FRAME_H * 100;
 
   if (stillScreen)
   {
     if (!object->bIsDead && 
         object->bIsHitting && object->hitState == 1)
     {
-      for(u16 i=0;i < MAX_OBJECTS;i++)
-      {
-        Object* other = &sObjects[i];
-        if (other == object)
-          continue;
-        if (other->type == OT_None)
-          continue;
-        if (other->bIsDead)
-          continue;
-
-        i32 x1 = 0;
-      
-        if (object->bDirection == 1)
-          x1 = object->boundsHit.x1;
-        else
-          x1 = object->boundsHit.x0;
-
-        i32 y0 = object->boundsHit.y0;
-        i32 y1 = object->boundsHit.y1;
-
-        if (Collision_BoxVsBox_Simple(&object->aiDetection, &other->bounds))
-        {
-          object->hitState++;
-          object->aiHitTimer = 12;
-
-          if (other->bIsBeingDamaged == false && other->bIsBlocking == false)
-          {
-
-            other->bAiStayDistance = 0;
-
-            other->damageTimer = 8;
-            other->bIsBeingDamaged = 1;
-            if (object->bDirection == 1)
-              other->bDirection = 0;
-            else
-              other->bDirection = 1;
-          
-            if (other->hp > 0)
-            {
-              int amount = 1;
-
-              if (other->bIsDazed)
-              {
-                amount = 2;
-              }
-
-              // Game Mechanic....
-              if (other->type == OT_Player && other->rage < RAGE_VUN)
-              {
-                amount = 0;
-                other->rageTimer = RAGE_TIMER;
-
-                if (other->rage < 4)
-                {
-                  other->rage++;
-                }
-
-              }
-              else if (object->type == OT_Player && other->rage >= RAGE_VUN)
-              {
-                amount = 3;
-              }
-
-              i32 hp = (i32)(other->hp) - amount;
-              if (hp < 0)
-                hp = 0;
-              other->hp = hp;
-
-              Sound_PlayHit();
-            }
-            Object_ResetAnim(other, ANIM_StandHit);
-            // printf("** Damage Begin\n");
-          }
+      // The first opponent in reach is hit, so the player can hurt any enemy, not only the
+      // lowest one, and enemies don't hit each other.
+      Object* other = Objects_QueryHit(object, &hitboxes->aiDetection, true, stats);
 
-          if (other->bIsBlocking)
-          {
-            if (rand() % 20 == 8 && other->rage)
-            {
-              other->rage--;
-            }
-          }
-        }
-        break;
+      if (other != NULL)
+      {
+        object->hitState++;
+        object->aiHitTimer = 12;
+        object->hitTarget = 1 + (other - sObjects);
       }
     }
 
@@ -1145,19 +1713,94 @@ void Object_Tick(Object* object, bool stillScreen)
 
   if (object->type == OT_Player)
   {
- // Canvas_PrintF(0,  50, &FONT_KAGESANS, 3, "%i %i   %i %i", object->velocityX, object->accelerationX, object->velocityY, object->velocityY);
+ // Canvas_PrintF(0,  50, &FONT_KAGESANS, 3, "%i %i   %i %i", motion->velocityX, motion->accelerationX, motion->velocityY, motion->velocityY);
 
-//     Canvas_PrintF(0, 0, &FONT_KAGESANS, 3, "%i %i S %i T %i F %i E %i Cr %i Bl %i Ht %i", object->x / 100, object->y / 100, object->moveState, object->frameTicks, object->frameCurrent, !!object->bFrameAnimationEnded, object->bIsCrouched, object->bIsBlocking, object->bIsHitting);
+//     Canvas_PrintF(0, 0, &FONT_KAGESANS, 3, "%i %i S %i T %i F %i E %i Cr %i Bl %i Ht %i", motion->x / 100, motion->y / 100, object->moveState, object->frameTicks, object->frameCurrent, !!object->bFrameAnimationEnded, object->bIsCrouched, object->bIsBlocking, object->bIsHitting);
   }
 }
 
-void Object_PreTick(Object* object)
+// Applies what the object did this tick to others and to shared state, in slot order.
+void Object_Resolve(Object* object)
 {
-  object->nextDrawId = 0;
+  if (object->bKOPending)
+  {
+    object->bKOPending = 0;
+    Object_SetType(object, OT_Corpse);
+  }
+
+  if (object->hitTarget != 0)
+  {
+    Object* other = &sObjects[object->hitTarget - 1];
+    object->hitTarget = 0;
 
+    // KO'd since the snapshot was taken.
+    if (other->type == OT_None || other->bIsDead)
+      return;
+
+    if (other->bIsBeingDamaged == false && other->bIsBlocking == false)
+    {
+
+      other->bAiStayDistance = 0;
+
+      other->damageTimer = 8;
+      other->bIsBeingDamaged = 1;
+      if (object->bDirection == 1)
+        other->bDirection = 0;
+      else
+        other->bDirection = 1;
+    
+      if (other->hp > 0)
+      {
+        int amount = 1;
+
+        if (other->bIsDazed)
+        {
+          amount = 2;
+        }
+
+        // Game Mechanic....
+        if (other->type == OT_Player && other->rage < RAGE_VUN)
+        {
+          amount = 0;
+          other->rageTimer = RAGE_TIMER;
+
+          if (other->rage < 4)
+          {
+            other->rage++;
+          }
+
+        }
+        else if (object->type == OT_Player && other->rage >= RAGE_VUN)
+        {
+          amount = 3;
+        }
+
+        i32 hp = (i32)(other->hp) - amount;
+        if (hp < 0)
+          hp = 0;
+        other->hp = hp;
+
+        Sound_PlayHit();
+      }
+      Object_ResetAnim(other, ANIM_StandHit);
+      // printf("** Damage Begin\n");
+    }
+
+    if (other->bIsBlocking)
+    {
+      if (Object_Random(object) % 20 == 8 && other->rage)
+      {
+        other->rage--;
+      }
+    }
+  }
+}
+
+void Object_PreTick(Object* object)
+{
   if (object->type == OT_Enemy)
   {
-//    MarkDepth(object->x, object->y);
+//    MarkDepth(Object_Motion(object)->x, Object_Motion(object)->y);
   }
   else if (object->type == OT_Player)
   {
@@ -1168,13 +1811,18 @@ void Object_PreTick(Object* object)
 
 void Object_SetPosition(Object* object, i32 x, u16 y)
 {
-  object->x = x;
-  object->y = y;
+  ObjectMotion* motion = Object_Motion(object);
+  motion->x = x;
+  motion->y = y;
+  motion->prevX = x;
+  motion->prevY = y;
 }
 
 void Object_ModPosition(Object* object)
 {
-  object->x -= (320 * 100);
+  ObjectMotion* motion = Object_Motion(object);
+  motion->x -= (320 * 100);
+  motion->prevX -= (320 * 100);
 }
 
 void Object_SetMoveDelta(Object* object, u8 moveVector)
@@ -1210,82 +1858,24 @@ void Object_SetMoveAction(Object* object, u8 moveAction)
 
 }
 
-void Object_Draw(Object* object, i32 xOffset)
+void Object_Draw(Object* object, i32 xOffset, f32 alpha)
 {
-  
+  ObjectMotion* motion = Object_Motion(object);
+
+  i32 sx = (motion->prevX + (i32) ((motion->x - motion->prevX) * alpha)) / SCALE;
+  i32 sy = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (motion->prevY + (i32) ((motion->y - motion->prevY) * alpha)) / SCALE;
+
   int x = 0;
   if (xOffset == 0) //|| (xOffset != 0 && object->type == OT_Player))
-    x = object->sx;
+    x = sx;
   else if (xOffset != 0)
-    x = 320 - xOffset + object->sx;
-
-  Draw_Animation(x, object->sy - CHARACTER_FRAME_H, object->type, object->frameAnimation, object->frameCurrent, object->bDirection, object->frameDepth);
-
-  if (object->type == OT_Player)
-  {
-    int x = 10;
-    int y = 10;
-
-    if (object->rage >= 16)
-    {
-      x += -10 + (rand() % 20);
-      y += -10 + (rand() % 20);
-    }
-    else if (object->rage >= 12)
-    {
-      x += -3 + (rand() % 6);
-      y += -3 + (rand() % 6);
-    }
-    else if (object->rage >= 8)
-    {
-      x += -2 + (rand() % 4);
-      y += -2 + (rand() % 4);
-    }
-    else if (object->rage >= 4)
-    {
-      x += -1 + (rand() % 2);
-      y += -1 + (rand() % 2);
-    }
+    x = 320 - xOffset + sx;
 
-    Canvas_PrintF(x + 1, y + 1, &FONT_KAGESANS, 5, "RAGE");
-    Canvas_PrintF(x, y, &FONT_KAGESANS, 3, "RAGE");
-
-    Canvas_PrintF(x + 1, y + 12 + 1, &FONT_KAGESANS, 5, "LIFE");
-    Canvas_PrintF(x, y + 12, &FONT_KAGESANS, 3, "LIFE");
-
-
-    Rect rageRect;
-    rageRect.left = x + (8 * 5);
-    rageRect.right = rageRect.left + object->rage * 4;
-    rageRect.top  = y;
-    rageRect.bottom = y+8;
-    Canvas_DrawFilledRectangle(9, rageRect);
-
-    rageRect.left -= 1;
-    rageRect.right = rageRect.left + 65;
-    rageRect.top -=1;
-    rageRect.bottom += 1;
-    Canvas_DrawRectangle(5, rageRect);
-
-    int m = object->hp * 10;
-    if (object->hp == 6)
-      m = 64;
-
-    rageRect.left = x + (8 * 5);
-    rageRect.right = rageRect.left + m;
-    rageRect.top = y + 12;
-    rageRect.bottom = y + 8 + 12;
-    Canvas_DrawFilledRectangle(17, rageRect);
-
-    rageRect.left -= 1;
-    rageRect.right = rageRect.left + 65;
-    rageRect.top -= 1;
-    rageRect.bottom += 1;
-    Canvas_DrawRectangle(5, rageRect);
-
-  }
+  Draw_Animation(x, sy - CHARACTER_FRAME_H, object->type, object->frameAnimation, object->frameCurrent, object->bDirection, object->frameDepth);
 
   #if 0
+  ObjectHitboxes* hitboxes = Object_Hitboxes(object);
+
   if (object->bAiIsHead == 1)
   {
     Rect rect;
@@ -1298,10 +1888,10 @@ void Object_Draw(Object* object, i32 xOffset)
   }
 
   Rect rect;
-  rect.left   = object->bounds.x0 / 100;
-  rect.top    = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (object->bounds.y0 / 100);
-  rect.right  = object->bounds.x1 / 100;
-  rect.bottom = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (object->bounds.y1 / 100);
+  rect.left   = hitboxes->bounds.x0 / 100;
+  rect.top    = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (hitboxes->bounds.y0 / 100);
+  rect.right  = hitboxes->bounds.x1 / 100;
+  rect.bottom = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (hitboxes->bounds.y1 / 100);
 
   u8 colour = 16;
 
@@ -1312,17 +1902,17 @@ void Object_Draw(Object* object, i32 xOffset)
 
   Canvas_DrawRectangle(colour, rect);
 
-  rect.left   = object->boundsHit.x0 / 100;
-  rect.top    = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (object->boundsHit.y0 / 100);
-  rect.right  = object->boundsHit.x1 / 100;
-  rect.bottom = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (object->boundsHit.y1 / 100);
+  rect.left   = hitboxes->boundsHit.x0 / 100;
+  rect.top    = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (hitboxes->boundsHit.y0 / 100);
+  rect.right  = hitboxes->boundsHit.x1 / 100;
+  rect.bottom = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (hitboxes->boundsHit.y1 / 100);
 
   Canvas_DrawRectangle(45, rect);
 
-  rect.left = object->aiDetection.x0 / 100;
-  rect.top = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (object->aiDetection.y0 / 100);
-  rect.right = object->aiDetection.x1 / 100;
-  rect.bottom = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (object->aiDetection.y1 / 100);
+  rect.left = hitboxes->aiDetection.x0 / 100;
+  rect.top = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (hitboxes->aiDetection.y0 / 100);
+  rect.right = hitboxes->aiDetection.x1 / 100;
+  rect.bottom = SCREEN_HEIGHT - SCREEN_BOTTOM_EDGE - (hitboxes->aiDetection.y1 / 100);
 
   Canvas_DrawRectangle(45, rect);
 
@@ -1335,9 +1925,74 @@ void Object_Draw(Object* object, i32 xOffset)
   #endif
 }
 
+void Object_DrawHud(Object* object)
+{
+  int x = 10;
+  int y = 10;
+
+  if (object->rage >= 16)
+  {
+    x += -10 + (i32) Random_Below(RS_Cosmetic, 20);
+    y += -10 + (i32) Random_Below(RS_Cosmetic, 20);
+  }
+  else if (object->rage >= 12)
+  {
+    x += -3 + (i32) Random_Below(RS_Cosmetic, 6);
+    y += -3 + (i32) Random_Below(RS_Cosmetic, 6);
+  }
+  else if (object->rage >= 8)
+  {
+    x += -2 + (i32) Random_Below(RS_Cosmetic, 4);
+    y += -2 + (i32) Random_Below(RS_Cosmetic, 4);
+  }
+  else if (object->rage >= 4)
+  {
+    x += -1 + (i32) Random_Below(RS_Cosmetic, 2);
+    y += -1 + (i32) Random_Below(RS_Cosmetic, 2);
+  }
+
+  Canvas_PrintStr(x + 1, y + 1, &FONT_KAGESANS, 5, "RAGE");
+  Canvas_PrintStr(x, y, &FONT_KAGESANS, 3, "RAGE");
+
+  Canvas_PrintStr(x + 1, y + 12 + 1, &FONT_KAGESANS, 5, "LIFE");
+  Canvas_PrintStr(x, y + 12, &FONT_KAGESANS, 3, "LIFE");
+
+
+  Rect rageRect;
+  rageRect.left = x + (8 * 5);
+  rageRect.right = rageRect.left + object->rage * 4;
+  rageRect.top  = y;
+  rageRect.bottom = y+8;
+  Canvas_DrawFilledRectangle(9, rageRect);
+
+  rageRect.left -= 1;
+  rageRect.right = rageRect.left + 65;
+  rageRect.top -=1;
+  rageRect.bottom += 1;
+  Canvas_DrawRectangle(5, rageRect);
+
+  int m = object->hp * 10;
+  if (object->hp == 6)
+    m = 64;
+
+  rageRect.left = x + (8 * 5);
+  rageRect.right = rageRect.left + m;
+  rageRect.top = y + 12;
+  rageRect.bottom = y + 8 + 12;
+  Canvas_DrawFilledRectangle(17, rageRect);
+
+  rageRect.left -= 1;
+  rageRect.right = rageRect.left + 65;
+  rageRect.top -= 1;
+  rageRect.bottom += 1;
+  Canvas_DrawRectangle(5, rageRect);
+}
+
 void Object_Initialise(Object* object, u8 type, u8 section)
 {
-  SDL_memset(object, 0, sizeof(Object));
+  Object_Clear(object);
+
+  object->random = Random_Next(RS_Simulation) | 1;
   
   object->type = type;
   object->moveSpeedX = 100;
@@ -1358,4 +2013,6 @@ void Object_Initialise(Object* object, u8 type, u8 section)
 void Object_Clear(Object* object)
 {
   SDL_memset(object, 0, sizeof(Object));
+  SDL_memset(Object_Motion(object), 0, sizeof(ObjectMotion));
+  SDL_memset(Object_Hitboxes(object), 0, sizeof(ObjectHitboxes));
 }
@@ -5,6 +5,15 @@
 
 #ifdef RETRO_WINDOWS
 #   include "windows.h"
+#   include "psapi.h"
+#endif
+
+#ifdef RETRO_LINUX
+#   include <sys/resource.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
 #endif
 
 typedef uint8_t u8;
@@ -27,6 +36,15 @@ typedef int64_t s64;
 #include <emscripten.h>
 #endif
 
+#if !defined(RETRO_MIX_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define RETRO_MIX_AVX2
+#define RETRO_MIX_SSE2
+#elif !defined(RETRO_MIX_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define RETRO_MIX_SSE2
+#endif
+
 Colour kDefaultPalette[] = {
   { 0xFF, 0x00, 0xFF },
   { 0x14, 0x0c, 0x1c },
@@ -95,6 +113,78 @@ typedef struct Retro_SoundObject
   u8     volume;
 } SoundObject;
 
+typedef enum
+{
+  AC_Play,
+  AC_Stop,              // A NULL sound stops everything
+  AC_Volume,
+  AC_MusicPauseToggle
+} AudioCommandType;
+
+typedef struct
+{
+  Sound* sound;
+  u8     type;
+  u8     volume;
+} AudioCommand;
+
+// Single producer (the main thread), single consumer (the mixer). Each side only writes its own
+// index, so neither ever waits on the other.
+typedef struct
+{
+  AudioCommand  commands[RETRO_AUDIO_COMMAND_COUNT];
+  SDL_atomic_t  head;   // Next to apply, written by the mixer
+  SDL_atomic_t  tail;   // Next to queue, written by the main thread
+  u32           dropped;
+  SDL_atomic_t  drops, steals;
+} AudioCommandQueue;
+
+// The whole song, rendered once. Until the render thread is done the mixer plays up to
+// `rendered`, and waits there if it catches up.
+typedef struct
+{
+  i16*          samples;
+  u32           length;       // In the units of micromod_sdl_context::length
+  SDL_atomic_t  rendered;     // Written by the render thread
+  SDL_atomic_t  cancel;
+  SDL_Thread*   thread;
+  void*         mapping;      // Set when the samples are mapped from the file
+  u32           mappingSize;
+  u32           moduleHash, moduleSize;
+#ifdef RETRO_FILESYSTEM
+  char          path[256];
+#endif
+} MusicCache;
+
+typedef struct
+{
+  u32 magic;                  // RPCM
+  u32 version;
+  u32 moduleHash, moduleSize;
+  u32 frequency, channels;
+  u32 length;
+} MusicCacheHeader;
+
+// Single producer (the render thread), single consumer (the audio callback). Positions are in
+// frames and run freely; the ring is indexed by their low bits.
+typedef struct
+{
+  u8*           buffer;
+  u32           frameSize;
+  u32           ahead;
+  SDL_atomic_t  head;         // Next to play, written by the callback
+  SDL_atomic_t  tail;         // Next to mix, written by the render thread
+  SDL_atomic_t  lowest;
+  SDL_atomic_t  underruns;
+  SDL_atomic_t  quit;
+  SDL_sem*      wake;
+  SDL_mutex*    lock;         // Held while mixing
+  SDL_Thread*   thread;
+} AudioRing;
+
+#define RETRO_MUSIC_CACHE_MAGIC   0x4D435052
+#define RETRO_MUSIC_CACHE_VERSION 1
+
 SDL_Window*           gWindow;
 SDL_Renderer*         gRenderer;
 SDL_Texture*          gCanvasTexture;
@@ -118,7 +208,15 @@ SoundDevice           gSoundDevice;
 SoundObject           gSoundObject[RETRO_MAX_SOUND_OBJECTS];
 micromod_sdl_context* gMusicContext;
 bool                  gMusicPaused;
-#ifdef RETRO_BROWSER
+MusicCache            gMusicCache;
+bool                  gMusicCacheEnabled = RETRO_MUSIC_CACHE;
+AudioCommandQueue     gAudioCommands;
+SDL_atomic_t          gSoundObjectsPlaying;
+AudioRing             gAudioRing;
+u32                   gAudioAhead = RETRO_AUDIO_THREAD ? RETRO_AUDIO_AHEAD_SAMPLES : 0;
+i32                   gMixAccumulator[RETRO_MIX_CHUNK];
+i16                   gMixMusic[RETRO_MIX_CHUNK];
+#ifdef RETRO_FILESYSTEM
 u8*                   gMusicFileData;
 #endif
 Animation*            gAnimations[256];
@@ -126,8 +224,140 @@ Sprite*               gSprites[256];
 FramePresentation     gFramePresentation;
 float                 gFrameAlpha, gFrameBeta;
 bool                  gStepMode;
+bool                  gRenderEnabled = true;
+bool                  gPresentEnabled = true;
+u32                   gFastForwardFrames;
+u64                   gTickAccumulator, gTickLast;
+f32                   gTickAlpha;
 
 int sMouseX, sMouseY, sMouseButton;
+RenderResetFunction   gRenderResetFunction;
+
+typedef struct
+{
+  u64 ticks[RETRO_PROFILE_FRAMES][PP_COUNT];
+  u32 head, count;
+  u64 phaseBegin, frameBegin;
+  bool inFrame;
+  bool overlay;
+} FrameProfiler;
+
+FrameProfiler         gProfiler;
+char*                 gProfileCsvFilename;
+
+#ifdef RETRO_TRACE
+
+#if defined(_MSC_VER)
+#define RETRO_THREAD_LOCAL __declspec(thread)
+#else
+#define RETRO_THREAD_LOCAL __thread
+#endif
+
+typedef struct
+{
+  const char* name;
+  u64         begin, end;
+} TraceEvent;
+
+typedef struct
+{
+  SDL_threadID  threadId;
+  SDL_atomic_t  count;
+  TraceEvent*   events;
+} TraceThread;
+
+TraceThread           gTraceThreads[RETRO_TRACE_MAX_THREADS];
+TraceThread           gTraceOverflowThread;
+SDL_atomic_t          gTraceThreadCount;
+SDL_atomic_t          gTraceDropped;
+SDL_threadID          gTraceMainThread;
+u64                   gTraceBegin;
+bool                  gTraceEnabled;
+RETRO_THREAD_LOCAL TraceThread* tTraceThread;
+
+#endif
+
+char*                 gTraceFilename;
+
+typedef struct
+{
+  SDL_SpinLock  lock;
+  u32           head, tail;     // Chunks not yet taken. The owner takes the head, thieves the tail.
+  SDL_sem*      start;
+  SDL_Thread*   thread;
+} JobWorker;
+
+typedef struct
+{
+  JobWorker     workers[RETRO_JOB_MAX_THREADS];
+  u32           workerCount;
+  SDL_atomic_t  pending;
+  SDL_atomic_t  quit;
+  SDL_sem*      done;
+  JobFunction   fn;
+  void*         user;
+  u32           count, grain;
+} JobPool;
+
+JobPool               gJobs;
+u32                   gJobThreads;
+
+typedef struct
+{
+  u64 state, inc;
+} RandomState;
+
+RandomState           gRandom[RS_COUNT];
+u32                   gRandomSeed = RETRO_RANDOM_SEED;
+
+#define RETRO_REPLAY_MAGIC   0x4C505252 // RRPL
+#define RETRO_REPLAY_VERSION 1
+
+typedef enum
+{
+  RK_Input,
+  RK_Hash
+} ReplayKind;
+
+typedef struct
+{
+  u8*                data;
+  u32                size, capacity, read;
+  u32                tick, ticks;           // Current tick, and the length of the recording
+  u32                entryTick;             // Tick of the last entry written, or of the next to read
+  u8                 entryKind;
+  u32                entryValue;
+  bool               entryValid;
+  u32                actions;               // Action states, one bit per action
+  u32                hashes, mismatches;
+  bool               recording, replaying;
+  StateHashFunction  hash;
+} Replay;
+
+Replay                gReplay;
+char*                 gRecordFilename;
+char*                 gReplayFilename;
+
+typedef struct
+{
+  u32 offset, encodedSize;
+  u32 size;                                 // Size of the older state it gives back
+} SnapshotDelta;
+
+typedef struct
+{
+  SnapshotFunction fn;
+  u8*              newest;                  // Bytes past the size are always zero
+  u8*              work;
+  u8*              encoded;
+  u8*              pool;                    // Encoded deltas, allocated round and round
+  u32              newestSize, workSize, cursor, poolHead;
+  SnapshotDelta    deltas[RETRO_SNAPSHOT_COUNT];
+  u32              deltaHead, deltaCount;   // Newest delta is at deltaHead - 1
+  bool             valid, restoring, overflow;
+} SnapshotRing;
+
+SnapshotRing          gSnapshots;
 
 typedef union
 {
@@ -170,2022 +400,4790 @@ typedef union
   DST.w = SRC.right - SRC.left;\
   DST.h = SRC.bottom - SRC.top;
 
-#ifdef RETRO_BROWSER
+#ifdef RETRO_FILESYSTEM
 
-char gTempBrowserPath[256];
+char gTempAssetPath[256];
+char gAssetDirectory[200] = RETRO_ASSET_DIRECTORY;
 
-#define RETRO_BROWSER_PATH ((const char*) (gTempBrowserPath))
+#define RETRO_ASSET_PATH ((const char*) (gTempAssetPath))
 
-#define RETRO_MAKE_BROWSER_PATH(N) \
-  gTempBrowserPath[0] = 0; \
-  strcat(gTempBrowserPath, "assets/"); \
-  strcat(gTempBrowserPath, name)
+#define RETRO_MAKE_ASSET_PATH(N) \
+  gTempAssetPath[0] = 0; \
+  strcat(gTempAssetPath, gAssetDirectory); \
+  strcat(gTempAssetPath, N)
 
 #endif
 
+#ifdef RETRO_LINUX
+bool                  gHeadless;
+#endif
 
-void* Resource_Load(const char* name, u32* outSize)
+// Software renderer. Every canvas is a 8-bit buffer of palette indices, which is composited,
+// converted to ARGB through the palette and uploaded as one streaming texture per frame.
+
+typedef struct
 {
-#ifdef RETRO_WINDOWS
-  assert(outSize);
+  u32 rgb;
+  u8  r, g, b;
+  u8  count;
+  u8  lut[256];
+} SoftTint;
 
-  HRSRC handle = FindResource(0, name, "RESOURCE");
-  assert(handle);
+typedef struct
+{
+  u32 rgb;
+  u16 count;
+  u8  index;
+} SoftColourCache;
 
-  HGLOBAL data = LoadResource(0, handle);
-  assert(data);
+typedef struct
+{
+  u8*             canvases[RETRO_CANVAS_COUNT];
+  u8*             target;
+  i32             targetW, targetH;
+  u8*             composite;
+  u8              canvasId;
+  SDL_Texture*    texture;
+  u32             argb[256];
+  u8              fill[256];
+  SoftTint        tints[RETRO_SOFT_TINT_CACHE];
+  u32             nextTint;
+  SoftColourCache colourCache[1024];
+} SoftCanvas;
+
+bool                  gSoftwareRenderer;
+SoftCanvas            gSoft;
+
+// Finds the palette index of a colour, adding it to the palette if there is still room,
+// otherwise the nearest colour is used. The last index is reserved for RETRO_SOFT_HOLE.
+u8 SoftCanvas_IndexOf(Colour colour)
+{
+  Palette* palette = &gSettings.palette;
+  u32 rgb = (colour.r << 16) | (colour.g << 8) | colour.b;
+  SoftColourCache* cache = &gSoft.colourCache[(rgb ^ (rgb >> 10) ^ (rgb >> 20)) & 1023];
 
-  void* ptr = LockResource(data);
-  assert(ptr);
+  if (cache->count == palette->count + 1 && cache->rgb == rgb)
+    return cache->index;
 
-  DWORD dataSize = SizeofResource(0, handle);
-  assert(dataSize);
+  u32 bestIndex = RETRO_SOFT_HOLE;
+  i32 bestDistance = 0x7FFFFFFF;
 
-  (*outSize) = dataSize;
+  for (u32 i=0;i < palette->count;i++)
+  {
+    Colour pal = palette->colours[i];
 
-  return ptr;
-#else
-  RETRO_UNUSED(name);
-  RETRO_UNUSED(outSize);
-  return NULL;
-#endif
-}
+    i32 distance = ((colour.r - pal.r) * (colour.r - pal.r)) +
+                   ((colour.g - pal.g) * (colour.g - pal.g)) +
+                   ((colour.b - pal.b) * (colour.b - pal.b));
 
-char* TextFile_Load(const char* name, u32* outSize)
-{
-  char* data = NULL;
-#if defined(RETRO_WINDOWS)
-  u32 resourceSize = 0;
-  void* resourceData = Resource_Load(name, &resourceSize);
+    if (distance < bestDistance)
+    {
+      bestDistance = distance;
+      bestIndex = i;
 
-  data = (char*) malloc(resourceSize + 1);
-  memcpy(data, resourceData, resourceSize);
-  data[resourceSize] = 0;
+      if (distance == 0)
+        break;
+    }
+  }
 
-  (*outSize) = resourceSize;
+  if (bestDistance != 0 && palette->count < RETRO_SOFT_HOLE)
+  {
+    bestIndex = palette->count;
+    Palette_Add(palette, colour);
+  }
+  else if (bestIndex == RETRO_SOFT_HOLE)
+  {
+    bestIndex = palette->fallback;
+  }
 
-#elif defined(RETRO_BROWSER)
-  RETRO_MAKE_BROWSER_PATH(name);
-  FILE* f = fopen(RETRO_BROWSER_PATH, "rb");
-  fseek(f, 0, SEEK_END);
-  int s = ftell(f);
-  fseek(f, 0, SEEK_SET);
+  cache->rgb = rgb;
+  cache->count = palette->count + 1;
+  cache->index = bestIndex;
 
-  data = (char*) malloc(s + 1);
-  fread(data, s, 1, f);
-  fclose(f);
+  return bestIndex;
+}
 
-  data[s] = 0;
-  (*outSize) = s;
+u8* SoftCanvas_MakeIndices(u32 width, u32 height)
+{
+  if (gSoftwareRenderer == false)
+    return NULL;
 
-  printf("%i, %s\n", s, data);
+  return malloc(width * height);
+}
 
-#endif
+void SoftCanvas_Init()
+{
+  u32 size = gCanvasSize.w * gCanvasSize.h;
 
-  return data;
+  for (u32 i=0;i < RETRO_CANVAS_COUNT;i++)
+  {
+    gSoft.canvases[i] = malloc(size);
+    memset(gSoft.canvases[i], RETRO_SOFT_HOLE, size);
+  }
+
+  gSoft.composite = malloc(size);
+  gSoft.target = gSoft.canvases[0];
+  gSoft.targetW = gCanvasSize.w;
+  gSoft.targetH = gCanvasSize.h;
+  gSoft.canvasId = 0;
+  gSoft.texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, gCanvasSize.w, gCanvasSize.h);
+  SDL_SetTextureBlendMode(gSoft.texture, SDL_BLENDMODE_NONE);
 }
 
-void  Palette_LoadFromBitmap(const char* name, Palette* palette)
+void SoftCanvas_Clear(u8 id)
 {
-  u32 width, height;
+  u8 colour = (gCanvasFlags[id] & CNF_Blend) ? RETRO_SOFT_HOLE : gCanvasBackgroundColour[id];
+  memset(gSoft.canvases[id], colour, gCanvasSize.w * gCanvasSize.h);
+}
 
-  u8* imageData = NULL;
+// Remap table for a colour modulated draw, as SDL_SetTextureColorMod would do.
+const u8* SoftCanvas_TintLut(u8 r, u8 g, u8 b)
+{
+  if (r == 0xFF && g == 0xFF && b == 0xFF)
+    return NULL;
 
-  char n[256];
-  n[0] = 0;
-  strcat(&n[0], "assets/");
-  strcat(&n[0], name);
+  Palette* palette = &gSettings.palette;
+  u32 rgb = (r << 16) | (g << 8) | b;
 
-  #if defined(RETRO_WINDOWS)
-    u32 resourceSize = 0;
-    void* resourceData = Resource_Load(name, &resourceSize);
-    lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
-  #elif defined(RETRO_BROWSER)
-    RETRO_MAKE_BROWSER_PATH(name);
-    lodepng_decode_file(&imageData, &width, &height, RETRO_BROWSER_PATH, LCT_RGB, 8);
-  #endif
+  for (u32 i=0;i < RETRO_SOFT_TINT_CACHE;i++)
+  {
+    SoftTint* tint = &gSoft.tints[i];
+    if (tint->rgb == rgb + 1 && tint->count == palette->count)
+      return tint->lut;
+  }
 
-  assert(imageData);
+  SoftTint* tint = &gSoft.tints[gSoft.nextTint];
+  gSoft.nextTint = (gSoft.nextTint + 1) % RETRO_SOFT_TINT_CACHE;
 
-  //Colour lastColour = Colour_Make(0xCA, 0xFE, 0xBE);
-  
-  for(u32 i=0;i < width * height * 3;i+=3)
-  {
-    Colour colour;
-    colour.r = imageData[i + 0];
-    colour.g = imageData[i + 1];
-    colour.b = imageData[i + 2];
+  u32 count = palette->count;
 
-    if (Palette_HasColour(palette, colour) == false)
+  for (u32 i=0;i < 256;i++)
+  {
+    if (i >= count)
     {
-      Palette_Add(palette, colour);
+      tint->lut[i] = i;
+      continue;
     }
 
+    Colour colour = palette->colours[i];
+    colour.r = (colour.r * r) / 255;
+    colour.g = (colour.g * g) / 255;
+    colour.b = (colour.b * b) / 255;
+    tint->lut[i] = SoftCanvas_IndexOf(colour);
   }
-}
 
+  tint->rgb = rgb + 1;
+  tint->count = palette->count;
 
-void Bitmap_LoadPaletted(const char* name, Bitmap* outBitmap, u8 colourOffset)
+  return tint->lut;
+}
+
+void SoftCanvas_Blit(Bitmap* bitmap, SDL_Rect* dstRectangle, SDL_Rect* srcRectangle, u8 flipFlags, const u8* lut)
 {
-  u32 width, height;
+  if (bitmap->indices == NULL)
+    return;
 
-  u8* imageData = NULL;
+  SDL_Rect src, dst;
 
-#ifdef RETRO_WINDOWS
-  u32 resourceSize = 0;
-  void* resourceData = Resource_Load(name, &resourceSize);
-  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
-#elif defined(RETRO_BROWSER)
-  RETRO_MAKE_BROWSER_PATH(name);
-  lodepng_decode_file(&imageData, &width, &height, RETRO_BROWSER_PATH, LCT_RGB, 8);
-#endif
+  if (srcRectangle == NULL)
+  {
+    src.x = 0;
+    src.y = 0;
+    src.w = bitmap->w;
+    src.h = bitmap->h;
+  }
+  else
+  {
+    src = *srcRectangle;
+  }
 
-  assert(imageData);
-  
-  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, width, height);
+  if (dstRectangle == NULL)
+  {
+    dst.x = 0;
+    dst.y = 0;
+    dst.w = gSoft.targetW;
+    dst.h = gSoft.targetH;
+  }
+  else
+  {
+    dst = *dstRectangle;
+  }
 
-  void* pixelsVoid;
-  int pitch;
-  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
-  u8* pixels = (u8*) pixelsVoid;
+  if (src.w <= 0 || src.h <= 0 || dst.w <= 0 || dst.h <= 0)
+    return;
 
-  for(u32 i=0, j=0;i < width * height;++i, j+=3)
+  if (src.x < 0 || src.y < 0 || src.x + src.w > bitmap->w || src.y + src.h > bitmap->h)
+    return;
+
+  i32 x0 = Max(dst.x, 0);
+  i32 y0 = Max(dst.y, 0);
+  i32 x1 = Min(dst.x + dst.w, gSoft.targetW);
+  i32 y1 = Min(dst.y + dst.h, gSoft.targetH);
+
+  if (x0 >= x1 || y0 >= y1)
+    return;
+
+  // 16.16 fixed point steps through the source, so scaled draws are nearest neighbour.
+  u32 stepX = ((u32) src.w << 16) / dst.w;
+  u32 stepY = ((u32) src.h << 16) / dst.h;
+
+  for (i32 y=y0;y < y1;y++)
   {
-    u32 idx = (imageData[i] + colourOffset) & 0xFF;
-    Colour colour = Palette_GetColour(&gSettings.palette, idx);
+    i32 v = (i32) (((u64) (y - dst.y) * stepY) >> 16);
 
-    pixels[j+0] = colour.r;
-    pixels[j+1] = colour.g;
-    pixels[j+2] = colour.b;
-  }
+    if (flipFlags & FF_FlipVert)
+      v = src.h - 1 - v;
 
-  SDL_UnlockTexture(texture);
+    const u8* row = bitmap->indices + (src.y + v) * bitmap->w + src.x;
+    u8* out = gSoft.target + y * gSoft.targetW;
+    u32 u = (x0 - dst.x) * stepX;
 
-  outBitmap->w = width;
-  outBitmap->h = height;
-  outBitmap->texture = texture;
-  outBitmap->imageData = imageData;
+    if (flipFlags & FF_FlipHorz)
+    {
+      for (i32 x=x0;x < x1;x++, u+=stepX)
+      {
+        u8 c = row[src.w - 1 - (i32) (u >> 16)];
+        if (c != RETRO_SOFT_HOLE)
+          out[x] = lut ? lut[c] : c;
+      }
+    }
+    else
+    {
+      for (i32 x=x0;x < x1;x++, u+=stepX)
+      {
+        u8 c = row[u >> 16];
+        if (c != RETRO_SOFT_HOLE)
+          out[x] = lut ? lut[c] : c;
+      }
+    }
+  }
 }
 
-void Bitmap_Load(const char* name, Bitmap* outBitmap, u8 transparentIndex)
+void SoftCanvas_FillRect(u8 colour, i32 x, i32 y, i32 w, i32 h)
 {
-  u32 width, height;
+  i32 x0 = Max(x, 0);
+  i32 y0 = Max(y, 0);
+  i32 x1 = Min(x + w, gSoft.targetW);
+  i32 y1 = Min(y + h, gSoft.targetH);
 
-  u8* imageData = NULL;
+  if (x0 >= x1 || y0 >= y1)
+    return;
 
-#ifdef RETRO_WINDOWS
-  u32 resourceSize = 0;
-  void* resourceData = Resource_Load(name, &resourceSize);
-  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
-#elif defined(RETRO_BROWSER)
-  RETRO_MAKE_BROWSER_PATH(name);
-  lodepng_decode_file(&imageData, &width, &height, RETRO_BROWSER_PATH, LCT_RGB, 8);
-#endif
+  for (i32 i=y0;i < y1;i++)
+  {
+    memset(gSoft.target + i * gSoft.targetW + x0, colour, x1 - x0);
+  }
+}
 
-  assert(imageData);
+// Composites the canvases and uploads them into the single presentation texture.
+void SoftCanvas_Upload()
+{
+  Palette* palette = &gSettings.palette;
+  u32 size = gCanvasSize.w * gCanvasSize.h;
 
-  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+  for (u32 i=0;i < 256;i++)
+  {
+    Colour colour = i < palette->count ? palette->colours[i] : Colour_Make(0, 0, 0);
+    gSoft.argb[i] = 0xFF000000 | (colour.r << 16) | (colour.g << 8) | colour.b;
+  }
 
-  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-  void* pixelsVoid;
-  int pitch;
-  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
-  u8* pixels = (u8*) pixelsVoid;
+  memset(gSoft.composite, RETRO_SOFT_HOLE, size);
 
-  Palette* palette = &gSettings.palette;
-  
-  for(u32 i=0, j=0;i < (width * height * 3);i+=3, j+=4)
+  for (u32 i=0;i < RETRO_CANVAS_COUNT;i++)
   {
-    Colour col;
-    col.r = imageData[i+0];
-    col.g = imageData[i+1];
-    col.b = imageData[i+2];
+    if ((gCanvasFlags[i] & CNF_Render) == 0)
+      continue;
 
-    int bestIndex = 0x100;
-    int bestDistance = 10000000;
+    u8* canvas = gSoft.canvases[i];
 
-    // Match nearest colour by using a treating the two colours as vectors, and matching against the closest distance between the two.
-    for (u32 k=0;k < palette->count;k++)
+    if ((gCanvasFlags[i] & CNF_Blend) == 0)
     {
-      Colour pal = palette->colours[k];
-
-      int distance = ((col.r - pal.r) * (col.r - pal.r)) + 
-                     ((col.g - pal.g) * (col.g - pal.g)) + 
-                     ((col.b - pal.b) * (col.b - pal.b));
-      
-      if (distance < bestDistance)
-      {
-        bestDistance = distance;
-        bestIndex = k;
-      }
+      memcpy(gSoft.composite, canvas, size);
+      continue;
     }
 
-    if (bestIndex == 0x100)
-      bestIndex = palette->fallback;
-    
-    Colour bestColour = palette->colours[bestIndex];
-
-    if (bestIndex == transparentIndex)
-      bestColour.a = 0.0f;
-    else
-      bestColour.a = 255.0f;
-
-    pixels[j+0] = bestColour.a; 
-    pixels[j+1] = bestColour.b;
-    pixels[j+2] = bestColour.g;
-    pixels[j+3] = bestColour.r;
+    for (u32 j=0;j < size;j++)
+    {
+      if (canvas[j] != RETRO_SOFT_HOLE)
+        gSoft.composite[j] = canvas[j];
+    }
   }
 
-  SDL_UnlockTexture(texture);
-
-  outBitmap->w = width;
-  outBitmap->h = height;
-  outBitmap->texture = texture;
-  outBitmap->imageData = imageData;
-}
-
-void  Bitmap_Load24(const char* name, Bitmap* outBitmap, u8 transparentR, u8 transparentG, u8 transparentB)
-{
-
-  u32 width, height;
-
-  u8* imageData = NULL;
-
-#ifdef RETRO_WINDOWS
-  u32 resourceSize = 0;
-  void* resourceData = Resource_Load(name, &resourceSize);
-  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
-#elif defined(RETRO_BROWSER)
-  RETRO_MAKE_BROWSER_PATH(name);
-  lodepng_decode_file(&imageData, &width, &height, RETRO_BROWSER_PATH, LCT_RGB, 8);
-#endif
-
-  assert(imageData);
-
-  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
-
-  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
   void* pixelsVoid;
   int pitch;
-  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
-  u8* pixels = (u8*) pixelsVoid;
 
-  Palette* palette = &gSettings.palette;
+  if (SDL_LockTexture(gSoft.texture, NULL, &pixelsVoid, &pitch) != 0)
+    return;
 
-  for(u32 i=0, j=0;i < (width * height * 3);i+=3, j+=4)
+  for (i32 y=0;y < gCanvasSize.h;y++)
   {
-    Colour col;
-    col.r = imageData[i+0];
-    col.g = imageData[i+1];
-    col.b = imageData[i+2];
-
-    if (col.r == transparentR && col.g == transparentG && col.b == transparentB)
-      col.a = 0;
-    else
-      col.a = 255;
+    const u8* in = gSoft.composite + y * gCanvasSize.w;
+    u32* out = (u32*) ((u8*) pixelsVoid + y * pitch);
 
-    pixels[j+0] = col.a; 
-    pixels[j+1] = col.b;
-    pixels[j+2] = col.g;
-    pixels[j+3] = col.r;
+    for (i32 x=0;x < gCanvasSize.w;x++)
+      out[x] = gSoft.argb[in[x]];
   }
 
-  SDL_UnlockTexture(texture);
-
-  outBitmap->w = width;
-  outBitmap->h = height;
-  outBitmap->texture = texture;
-  outBitmap->imageData = imageData;
+  SDL_UnlockTexture(gSoft.texture);
 }
 
-void  Bitmap_Load24_PaletteSwap(const char* name, Bitmap* outBitmap, u8 transparentR, u8 transparentG, u8 transparentB, Palette* src, Palette* dst)
-{
+// Sprite batch. Between Canvas_BeginBatch and Canvas_EndBatch splats, text and rectangles are
+// collected as quads, and each run of quads sharing a texture is submitted as one draw.
 
-  u32 width, height;
+#define RETRO_BATCH_GEOMETRY SDL_VERSION_ATLEAST(2, 0, 18)
 
-  u8* imageData = NULL;
+typedef struct
+{
+  SDL_Rect  src, dst;
+  SDL_Color colour;
+  u8        flipFlags;
+} BatchQuad;
 
-#ifdef RETRO_WINDOWS
-  u32 resourceSize = 0;
-  void* resourceData = Resource_Load(name, &resourceSize);
-  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
-#elif defined(RETRO_BROWSER)
-  RETRO_MAKE_BROWSER_PATH(name);
-  lodepng_decode_file(&imageData, &width, &height, RETRO_BROWSER_PATH, LCT_RGB, 8);
+typedef struct
+{
+  bool        active;
+  bool        ready;
+  Bitmap*     bitmap;
+  u32         count;
+  u32         flushes, quads;
+  BatchQuad   batch[RETRO_BATCH_MAX_QUADS];
+#if RETRO_BATCH_GEOMETRY
+  SDL_Vertex  vertices[RETRO_BATCH_MAX_QUADS * 4];
+  int         indices[RETRO_BATCH_MAX_QUADS * 6];
 #endif
+} SpriteBatch;
 
-  assert(imageData);
+SpriteBatch           gBatch;
+u32                   gBatchLastFlushes, gBatchLastQuads;
 
-  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+static void SpriteBatch_Flush()
+{
+  if (gBatch.count == 0)
+    return;
 
-  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-  void* pixelsVoid;
-  int pitch;
-  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
-  u8* pixels = (u8*)pixelsVoid;
+  SDL_Texture* texture = gBatch.bitmap != NULL ? gBatch.bitmap->texture : NULL;
 
-  Palette* palette = &gSettings.palette;
+#if RETRO_BATCH_GEOMETRY
+  f32 invW = gBatch.bitmap != NULL ? 1.0f / gBatch.bitmap->w : 0.0f;
+  f32 invH = gBatch.bitmap != NULL ? 1.0f / gBatch.bitmap->h : 0.0f;
 
-  for (u32 i = 0, j = 0; i < (width * height * 3); i += 3, j += 4)
+  for (u32 i=0;i < gBatch.count;i++)
   {
-    Colour col;
-    col.r = imageData[i + 0];
-    col.g = imageData[i + 1];
-    col.b = imageData[i + 2];
+    BatchQuad* quad = &gBatch.batch[i];
+    SDL_Vertex* v = &gBatch.vertices[i * 4];
 
+    f32 x0 = (f32) quad->dst.x;
+    f32 y0 = (f32) quad->dst.y;
+    f32 x1 = (f32) (quad->dst.x + quad->dst.w);
+    f32 y1 = (f32) (quad->dst.y + quad->dst.h);
 
-    if (col.r == transparentR && col.g == transparentG && col.b == transparentB)
-      col.a = 0;
-    else
-      col.a = 255;
+    f32 u0 = quad->src.x * invW;
+    f32 v0 = quad->src.y * invH;
+    f32 u1 = (quad->src.x + quad->src.w) * invW;
+    f32 v1 = (quad->src.y + quad->src.h) * invH;
 
-    for(int j=0;j < src->count;j++)
+    if (quad->flipFlags & FF_FlipHorz)
     {
-      if (src->colours[j].r == col.r && src->colours[j].g == col.g && src->colours[j].b == col.b)
-      {
-        col.r = dst->colours[j].r;
-        col.g = dst->colours[j].g;
-        col.b = dst->colours[j].b;
-      }
+      f32 t = u0; u0 = u1; u1 = t;
     }
 
-    pixels[j + 0] = col.a;
-    pixels[j + 1] = col.b;
-    pixels[j + 2] = col.g;
-    pixels[j + 3] = col.r;
-  }
-
-  SDL_UnlockTexture(texture);
-
-  outBitmap->w = width;
-  outBitmap->h = height;
-  outBitmap->texture = texture;
-  outBitmap->imageData = imageData;
-}
-
+    if (quad->flipFlags & FF_FlipVert)
+    {
+      f32 t = v0; v0 = v1; v1 = t;
+    }
 
+    v[0].position.x = x0; v[0].position.y = y0; v[0].tex_coord.x = u0; v[0].tex_coord.y = v0;
+    v[1].position.x = x1; v[1].position.y = y0; v[1].tex_coord.x = u1; v[1].tex_coord.y = v0;
+    v[2].position.x = x0; v[2].position.y = y1; v[2].tex_coord.x = u0; v[2].tex_coord.y = v1;
+    v[3].position.x = x1; v[3].position.y = y1; v[3].tex_coord.x = u1; v[3].tex_coord.y = v1;
+    v[0].color = v[1].color = v[2].color = v[3].color = quad->colour;
+  }
 
-SpriteHandle SpriteHandle_Set(Sprite* sprite)
-{
-  for (u32 i=0;i < 256;i++)
+  SDL_RenderGeometry(gRenderer, texture, gBatch.vertices, gBatch.count * 4, gBatch.indices, gBatch.count * 6);
+#else
+  // Older SDL has no geometry submission, so fall back to a copy per quad.
+  for (u32 i=0;i < gBatch.count;i++)
   {
-    if (gSprites[i] == NULL)
+    BatchQuad* quad = &gBatch.batch[i];
+
+    if (texture == NULL)
     {
-      gSprites[i] = sprite;
-      return i;
+      SDL_SetRenderDrawColor(gRenderer, quad->colour.r, quad->colour.g, quad->colour.b, 0xFF);
+      SDL_RenderFillRect(gRenderer, &quad->dst);
+      continue;
     }
+
+    SDL_SetTextureColorMod(texture, quad->colour.r, quad->colour.g, quad->colour.b);
+    SDL_RenderCopyEx(gRenderer, texture, &quad->src, &quad->dst, 0.0f, NULL, quad->flipFlags);
   }
-  assert(true);
-  return 0xFF;
+
+  if (texture != NULL)
+    SDL_SetTextureColorMod(texture, 0xFF, 0xFF, 0xFF);
+  else
+    SDL_SetRenderDrawColor(gRenderer, 0xFF, 0xFF, 0xFF, 0x00);
+#endif
+
+  gBatch.flushes++;
+  gBatch.quads += gBatch.count;
+  gBatch.count = 0;
 }
 
-Sprite* SpriteHandle_Get(SpriteHandle handle)
+// Adds a quad to the batch. A NULL bitmap is a solid rectangle in the given colour.
+static void SpriteBatch_Add(Bitmap* bitmap, SDL_Rect* dstRectangle, SDL_Rect* srcRectangle, u8 flipFlags, u8 r, u8 g, u8 b)
 {
-  return gSprites[handle];
-} 
+  if (gBatch.count > 0 && (gBatch.bitmap != bitmap || gBatch.count == RETRO_BATCH_MAX_QUADS))
+    SpriteBatch_Flush();
 
-void Sprite_Make(Sprite* inSprite, Bitmap* bitmap, u32 x, u32 y, u32 w, u32 h)
-{
-  assert(bitmap);
+  gBatch.bitmap = bitmap;
 
-  SpriteHandle spriteHandle = SpriteHandle_Set(inSprite);
-  
-  inSprite->spriteHandle = spriteHandle;
-  inSprite->bitmap = bitmap;
-  inSprite->rect.x = x;
-  inSprite->rect.y = y;
-  inSprite->rect.w = w;
-  inSprite->rect.h = h;
+  BatchQuad* quad = &gBatch.batch[gBatch.count++];
 
-}
+  if (srcRectangle != NULL)
+  {
+    quad->src = *srcRectangle;
+  }
+  else
+  {
+    quad->src.x = 0;
+    quad->src.y = 0;
+    quad->src.w = bitmap != NULL ? bitmap->w : 0;
+    quad->src.h = bitmap != NULL ? bitmap->h : 0;
+  }
 
-AnimationHandle AnimationHandle_Set(Animation* animation)
-{
-  for (u32 i=0;i < 256;i++)
+  if (dstRectangle != NULL)
   {
-    if (gAnimations[i] == NULL)
-    {
-      gAnimations[i] = animation;
-      return i;
-    }
+    quad->dst = *dstRectangle;
   }
-  assert(true);
-  return 0xFF;
+  else
+  {
+    quad->dst.x = 0;
+    quad->dst.y = 0;
+    quad->dst.w = gCanvasSize.w;
+    quad->dst.h = gCanvasSize.h;
+  }
+
+  quad->colour.r = r;
+  quad->colour.g = g;
+  quad->colour.b = b;
+  quad->colour.a = 0xFF;
+  quad->flipFlags = flipFlags;
 }
 
-Animation* AnimationHandle_Get(AnimationHandle handle)
+static void SpriteBatch_AddRect(u8 colour, i32 x, i32 y, i32 w, i32 h)
 {
-  return gAnimations[handle];
-} 
+  Colour rgb = Palette_GetColour(&gSettings.palette, colour);
+  SDL_Rect dst;
+  dst.x = x;
+  dst.y = y;
+  dst.w = w;
+  dst.h = h;
+  SpriteBatch_Add(NULL, &dst, NULL, FF_None, rgb.r, rgb.g, rgb.b);
+}
 
-void Retro_Animation_Load(Animation* inAnimation, Bitmap* bitmap, u8 numFrames, u8 frameLengthMilliseconds, u32 originX, u32 originY, u32 frameWidth, u32 frameHeight, i32 frameOffsetX, i32 frameOffsetY)
+void Canvas_BeginBatch()
 {
-  assert(numFrames <= RETRO_MAX_ANIMATED_SPRITE_FRAMES);
-  assert(inAnimation);
-  assert(bitmap);
-
-  AnimationHandle animationHandle = AnimationHandle_Set(inAnimation);
-
-  inAnimation->bitmap = bitmap;
-  inAnimation->frameCount = numFrames;
-  inAnimation->frameLength = frameLengthMilliseconds;
-  inAnimation->w = frameWidth;
-  inAnimation->h = frameHeight;
-  inAnimation->animationHandle = animationHandle;
-
-  SDL_Rect frame;
-  frame.x = originX;
-  frame.y = originY;
-  frame.w = frameWidth;
-  frame.h = frameHeight;
+  assert(gBatch.active == false);
 
-  for(u8 i=0;i < numFrames;i++)
+#if RETRO_BATCH_GEOMETRY
+  if (gBatch.ready == false)
   {
-    inAnimation->frames[i] = frame;
-    frame.x += frameOffsetX;
-    frame.y += frameOffsetY;
+    for (u32 i=0;i < RETRO_BATCH_MAX_QUADS;i++)
+    {
+      int* index = &gBatch.indices[i * 6];
+      int  vertex = i * 4;
+      index[0] = vertex + 0;
+      index[1] = vertex + 1;
+      index[2] = vertex + 2;
+      index[3] = vertex + 2;
+      index[4] = vertex + 1;
+      index[5] = vertex + 3;
+    }
+    gBatch.ready = true;
   }
+#endif
 
+  gBatch.active = (gSoftwareRenderer == false);
+  gBatch.bitmap = NULL;
+  gBatch.count = 0;
 }
 
-void  Animation_LoadHorizontal(Animation* inAnimatedSprite, Bitmap* bitmap, u8 numFrames, u8 frameLengthMilliseconds, u32 originX, u32 originY, u32 frameWidth, u32 frameHeight)
+void Canvas_EndBatch()
 {
-  Retro_Animation_Load(inAnimatedSprite, bitmap, numFrames, frameLengthMilliseconds, originX, originY, frameWidth, frameHeight, frameWidth, 0);
+  SpriteBatch_Flush();
+  gBatch.active = false;
 }
 
-void  Animation_LoadVertical(Animation* inAnimatedSprite, Bitmap* bitmap, u8 numFrames, u8 frameLengthMilliseconds, u32 originX, u32 originY, u32 frameWidth, u32 frameHeight)
-{
-  Retro_Animation_Load(inAnimatedSprite, bitmap, numFrames, frameLengthMilliseconds, originX, originY, frameWidth, frameHeight, 0, frameHeight);
-}
 
-Size  Screen_GetSize()
+void* Resource_Load(const char* name, u32* outSize)
 {
-  Size size;
-  size.w = gSettings.windowWidth;
-  size.h = gSettings.windowHeight;
-  return size;
-}
+#ifdef RETRO_WINDOWS
+  assert(outSize);
 
-void Canvas_SetSize(Size size)
-{
-  gCanvasSize.w = size.w;
-  gCanvasSize.h = size.h;
-}
+  HRSRC handle = FindResource(0, name, "RESOURCE");
+  assert(handle);
 
-i32 Canvas_GetWidth()
-{
-  return gCanvasSize.w;
-}
+  HGLOBAL data = LoadResource(0, handle);
+  assert(data);
 
-i32 Canvas_GetHeight()
+  void* ptr = LockResource(data);
+  assert(ptr);
+
+  DWORD dataSize = SizeofResource(0, handle);
+  assert(dataSize);
+
+  (*outSize) = dataSize;
+
+  return ptr;
+#elif defined(RETRO_LINUX)
+  assert(outSize);
+
+  RETRO_MAKE_ASSET_PATH(name);
+  FILE* f = fopen(RETRO_ASSET_PATH, "rb");
+
+  if (f == NULL)
+  {
+    printf("Resource Error: Cannot open %s\n", RETRO_ASSET_PATH);
+    return NULL;
+  }
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  void* ptr = malloc(size);
+  fread(ptr, size, 1, f);
+  fclose(f);
+
+  (*outSize) = size;
+
+  return ptr;
+#else
+  RETRO_UNUSED(name);
+  RETRO_UNUSED(outSize);
+  return NULL;
+#endif
+}
+
+char* TextFile_Load(const char* name, u32* outSize)
+{
+  char* data = NULL;
+#if defined(RETRO_WINDOWS)
+  u32 resourceSize = 0;
+  void* resourceData = Resource_Load(name, &resourceSize);
+
+  data = (char*) malloc(resourceSize + 1);
+  memcpy(data, resourceData, resourceSize);
+  data[resourceSize] = 0;
+
+  (*outSize) = resourceSize;
+
+#elif defined(RETRO_FILESYSTEM)
+  RETRO_MAKE_ASSET_PATH(name);
+  FILE* f = fopen(RETRO_ASSET_PATH, "rb");
+  assert(f);
+  fseek(f, 0, SEEK_END);
+  int s = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  data = (char*) malloc(s + 1);
+  fread(data, s, 1, f);
+  fclose(f);
+
+  data[s] = 0;
+  (*outSize) = s;
+
+  #ifdef RETRO_BROWSER
+  printf("%i, %s\n", s, data);
+  #endif
+
+#endif
+
+  return data;
+}
+
+void  Palette_LoadFromBitmap(const char* name, Palette* palette)
+{
+  u32 width, height;
+
+  u8* imageData = NULL;
+
+  char n[256];
+  n[0] = 0;
+  strcat(&n[0], "assets/");
+  strcat(&n[0], name);
+
+  #if defined(RETRO_WINDOWS)
+    u32 resourceSize = 0;
+    void* resourceData = Resource_Load(name, &resourceSize);
+    lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
+  #elif defined(RETRO_FILESYSTEM)
+    RETRO_MAKE_ASSET_PATH(name);
+    lodepng_decode_file(&imageData, &width, &height, RETRO_ASSET_PATH, LCT_RGB, 8);
+  #endif
+
+  assert(imageData);
+
+  //Colour lastColour = Colour_Make(0xCA, 0xFE, 0xBE);
+  
+  for(u32 i=0;i < width * height * 3;i+=3)
+  {
+    Colour colour;
+    colour.r = imageData[i + 0];
+    colour.g = imageData[i + 1];
+    colour.b = imageData[i + 2];
+
+    if (Palette_HasColour(palette, colour) == false)
+    {
+      Palette_Add(palette, colour);
+    }
+
+  }
+}
+
+
+void Bitmap_LoadPaletted(const char* name, Bitmap* outBitmap, u8 colourOffset)
+{
+  u32 width, height;
+
+  u8* imageData = NULL;
+
+#ifdef RETRO_WINDOWS
+  u32 resourceSize = 0;
+  void* resourceData = Resource_Load(name, &resourceSize);
+  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
+#elif defined(RETRO_FILESYSTEM)
+  RETRO_MAKE_ASSET_PATH(name);
+  lodepng_decode_file(&imageData, &width, &height, RETRO_ASSET_PATH, LCT_RGB, 8);
+#endif
+
+  assert(imageData);
+  
+  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, width, height);
+
+  void* pixelsVoid;
+  int pitch;
+  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
+  u8* pixels = (u8*) pixelsVoid;
+  u8* indices = SoftCanvas_MakeIndices(width, height);
+
+  for(u32 i=0, j=0;i < width * height;++i, j+=3)
+  {
+    u32 idx = (imageData[i] + colourOffset) & 0xFF;
+    Colour colour = Palette_GetColour(&gSettings.palette, idx);
+
+    pixels[j+0] = colour.r;
+    pixels[j+1] = colour.g;
+    pixels[j+2] = colour.b;
+
+    if (indices)
+      indices[i] = idx;
+  }
+
+  SDL_UnlockTexture(texture);
+
+  outBitmap->w = width;
+  outBitmap->h = height;
+  outBitmap->texture = texture;
+  outBitmap->imageData = imageData;
+  outBitmap->indices = indices;
+}
+
+void Bitmap_Load(const char* name, Bitmap* outBitmap, u8 transparentIndex)
+{
+  u32 width, height;
+
+  u8* imageData = NULL;
+
+#ifdef RETRO_WINDOWS
+  u32 resourceSize = 0;
+  void* resourceData = Resource_Load(name, &resourceSize);
+  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
+#elif defined(RETRO_FILESYSTEM)
+  RETRO_MAKE_ASSET_PATH(name);
+  lodepng_decode_file(&imageData, &width, &height, RETRO_ASSET_PATH, LCT_RGB, 8);
+#endif
+
+  assert(imageData);
+
+  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  void* pixelsVoid;
+  int pitch;
+  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
+  u8* pixels = (u8*) pixelsVoid;
+
+  Palette* palette = &gSettings.palette;
+  u8* indices = SoftCanvas_MakeIndices(width, height);
+  
+  for(u32 i=0, j=0;i < (width * height * 3);i+=3, j+=4)
+  {
+    Colour col;
+    col.r = imageData[i+0];
+    col.g = imageData[i+1];
+    col.b = imageData[i+2];
+
+    int bestIndex = 0x100;
+    int bestDistance = 10000000;
+
+    // Match nearest colour by using a treating the two colours as vectors, and matching against the closest distance between the two.
+    for (u32 k=0;k < palette->count;k++)
+    {
+      Colour pal = palette->colours[k];
+
+      int distance = ((col.r - pal.r) * (col.r - pal.r)) + 
+                     ((col.g - pal.g) * (col.g - pal.g)) + 
+                     ((col.b - pal.b) * (col.b - pal.b));
+      
+      if (distance < bestDistance)
+      {
+        bestDistance = distance;
+        bestIndex = k;
+      }
+    }
+
+    if (bestIndex == 0x100)
+      bestIndex = palette->fallback;
+    
+    Colour bestColour = palette->colours[bestIndex];
+
+    if (bestIndex == transparentIndex)
+      bestColour.a = 0.0f;
+    else
+      bestColour.a = 255.0f;
+
+    pixels[j+0] = bestColour.a; 
+    pixels[j+1] = bestColour.b;
+    pixels[j+2] = bestColour.g;
+    pixels[j+3] = bestColour.r;
+
+    if (indices)
+      indices[i / 3] = (bestIndex == transparentIndex) ? RETRO_SOFT_HOLE : bestIndex;
+  }
+
+  SDL_UnlockTexture(texture);
+
+  outBitmap->w = width;
+  outBitmap->h = height;
+  outBitmap->texture = texture;
+  outBitmap->imageData = imageData;
+  outBitmap->indices = indices;
+}
+
+void  Bitmap_Load24(const char* name, Bitmap* outBitmap, u8 transparentR, u8 transparentG, u8 transparentB)
+{
+
+  u32 width, height;
+
+  u8* imageData = NULL;
+
+#ifdef RETRO_WINDOWS
+  u32 resourceSize = 0;
+  void* resourceData = Resource_Load(name, &resourceSize);
+  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
+#elif defined(RETRO_FILESYSTEM)
+  RETRO_MAKE_ASSET_PATH(name);
+  lodepng_decode_file(&imageData, &width, &height, RETRO_ASSET_PATH, LCT_RGB, 8);
+#endif
+
+  assert(imageData);
+
+  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  void* pixelsVoid;
+  int pitch;
+  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
+  u8* pixels = (u8*) pixelsVoid;
+
+  Palette* palette = &gSettings.palette;
+  u8* indices = SoftCanvas_MakeIndices(width, height);
+
+  for(u32 i=0, j=0;i < (width * height * 3);i+=3, j+=4)
+  {
+    Colour col;
+    col.r = imageData[i+0];
+    col.g = imageData[i+1];
+    col.b = imageData[i+2];
+
+    if (col.r == transparentR && col.g == transparentG && col.b == transparentB)
+      col.a = 0;
+    else
+      col.a = 255;
+
+    pixels[j+0] = col.a; 
+    pixels[j+1] = col.b;
+    pixels[j+2] = col.g;
+    pixels[j+3] = col.r;
+
+    if (indices)
+      indices[i / 3] = (col.a == 0) ? RETRO_SOFT_HOLE : SoftCanvas_IndexOf(col);
+  }
+
+  SDL_UnlockTexture(texture);
+
+  outBitmap->w = width;
+  outBitmap->h = height;
+  outBitmap->texture = texture;
+  outBitmap->imageData = imageData;
+  outBitmap->indices = indices;
+}
+
+void  Bitmap_Load24_PaletteSwap(const char* name, Bitmap* outBitmap, u8 transparentR, u8 transparentG, u8 transparentB, Palette* src, Palette* dst)
+{
+
+  u32 width, height;
+
+  u8* imageData = NULL;
+
+#ifdef RETRO_WINDOWS
+  u32 resourceSize = 0;
+  void* resourceData = Resource_Load(name, &resourceSize);
+  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
+#elif defined(RETRO_FILESYSTEM)
+  RETRO_MAKE_ASSET_PATH(name);
+  lodepng_decode_file(&imageData, &width, &height, RETRO_ASSET_PATH, LCT_RGB, 8);
+#endif
+
+  assert(imageData);
+
+  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  void* pixelsVoid;
+  int pitch;
+  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
+  u8* pixels = (u8*)pixelsVoid;
+
+  Palette* palette = &gSettings.palette;
+  u8* indices = SoftCanvas_MakeIndices(width, height);
+
+  for (u32 i = 0, j = 0; i < (width * height * 3); i += 3, j += 4)
+  {
+    Colour col;
+    col.r = imageData[i + 0];
+    col.g = imageData[i + 1];
+    col.b = imageData[i + 2];
+
+
+    if (col.r == transparentR && col.g == transparentG && col.b == transparentB)
+      col.a = 0;
+    else
+      col.a = 255;
+
+    for(int j=0;j < src->count;j++)
+    {
+      if (src->colours[j].r == col.r && src->colours[j].g == col.g && src->colours[j].b == col.b)
+      {
+        col.r = dst->colours[j].r;
+        col.g = dst->colours[j].g;
+        col.b = dst->colours[j].b;
+      }
+    }
+
+    pixels[j + 0] = col.a;
+    pixels[j + 1] = col.b;
+    pixels[j + 2] = col.g;
+    pixels[j + 3] = col.r;
+
+    if (indices)
+      indices[i / 3] = (col.a == 0) ? RETRO_SOFT_HOLE : SoftCanvas_IndexOf(col);
+  }
+
+  SDL_UnlockTexture(texture);
+
+  outBitmap->w = width;
+  outBitmap->h = height;
+  outBitmap->texture = texture;
+  outBitmap->imageData = imageData;
+  outBitmap->indices = indices;
+}
+
+
+
+void  Bitmap_Load24_PaletteSwapAtlas(const char* name, Bitmap* outBitmap, u8 transparentR, u8 transparentG, u8 transparentB, Palette* src, Palette** dsts, u32 dstCount, const Colour* tints, u32 tintCount)
+{
+  u32 width, height;
+
+  u8* imageData = NULL;
+
+#ifdef RETRO_WINDOWS
+  u32 resourceSize = 0;
+  void* resourceData = Resource_Load(name, &resourceSize);
+  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
+#elif defined(RETRO_FILESYSTEM)
+  RETRO_MAKE_ASSET_PATH(name);
+  lodepng_decode_file(&imageData, &width, &height, RETRO_ASSET_PATH, LCT_RGB, 8);
+#endif
+
+  assert(imageData);
+  assert(dstCount > 0 && tintCount > 0);
+
+  u32 atlasWidth = width * dstCount;
+  u32 atlasHeight = height * tintCount;
+
+  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, atlasWidth, atlasHeight);
+
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  void* pixelsVoid;
+  int pitch;
+  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
+  u8* pixels = (u8*)pixelsVoid;
+  u8* indices = SoftCanvas_MakeIndices(atlasWidth, atlasHeight);
+
+  for (u32 d = 0; d < dstCount; d++)
+  {
+    Palette* dst = dsts[d];
+
+    for (u32 t = 0; t < tintCount; t++)
+    {
+      Colour tint = tints[t];
+
+      for (u32 y = 0; y < height; y++)
+      {
+        u32 atlasY = t * height + y;
+        u8* row = pixels + atlasY * pitch + (d * width) * 4;
+
+        for (u32 x = 0; x < width; x++)
+        {
+          u32 i = (y * width + x) * 3;
+          Colour col;
+          col.r = imageData[i + 0];
+          col.g = imageData[i + 1];
+          col.b = imageData[i + 2];
+
+          if (col.r == transparentR && col.g == transparentG && col.b == transparentB)
+            col.a = 0;
+          else
+            col.a = 255;
+
+          for (int j = 0; j < src->count; j++)
+          {
+            if (src->colours[j].r == col.r && src->colours[j].g == col.g && src->colours[j].b == col.b)
+            {
+              col.r = dst->colours[j].r;
+              col.g = dst->colours[j].g;
+              col.b = dst->colours[j].b;
+            }
+          }
+
+          // Same arithmetic as a texture colour mod, so it matches the per-draw tints it replaces.
+          col.r = (col.r * tint.r) / 255;
+          col.g = (col.g * tint.g) / 255;
+          col.b = (col.b * tint.b) / 255;
+
+          row[x * 4 + 0] = col.a;
+          row[x * 4 + 1] = col.b;
+          row[x * 4 + 2] = col.g;
+          row[x * 4 + 3] = col.r;
+
+          if (indices)
+            indices[atlasY * atlasWidth + d * width + x] = (col.a == 0) ? RETRO_SOFT_HOLE : SoftCanvas_IndexOf(col);
+        }
+      }
+    }
+  }
+
+  SDL_UnlockTexture(texture);
+
+  outBitmap->w = atlasWidth;
+  outBitmap->h = atlasHeight;
+  outBitmap->texture = texture;
+  outBitmap->imageData = imageData;
+  outBitmap->indices = indices;
+}
+
+void  Bitmap_Create(Bitmap* outBitmap, u32 w, u32 h)
+{
+  assert(outBitmap);
+
+  outBitmap->w = w;
+  outBitmap->h = h;
+  outBitmap->imageData = NULL;
+  outBitmap->texture = NULL;
+  outBitmap->indices = NULL;
+
+  if (gSoftwareRenderer)
+  {
+    outBitmap->indices = malloc(w * h);
+    memset(outBitmap->indices, RETRO_SOFT_HOLE, w * h);
+    return;
+  }
+
+  outBitmap->texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_TARGET, w, h);
+  SDL_SetTextureBlendMode(outBitmap->texture, SDL_BLENDMODE_BLEND);
+}
+
+void  Bitmap_Destroy(Bitmap* bitmap)
+{
+  assert(bitmap);
+
+  if (bitmap->texture != NULL)
+    SDL_DestroyTexture(bitmap->texture);
+
+  free(bitmap->indices);
+  free(bitmap->imageData);
+
+  bitmap->texture = NULL;
+  bitmap->indices = NULL;
+  bitmap->imageData = NULL;
+  bitmap->w = 0;
+  bitmap->h = 0;
+}
+
+void  Bitmap_SetResetFunction(RenderResetFunction fn)
+{
+  gRenderResetFunction = fn;
+}
+
+SpriteHandle SpriteHandle_Set(Sprite* sprite)
+{
+  for (u32 i=0;i < 256;i++)
+  {
+    if (gSprites[i] == NULL)
+    {
+      gSprites[i] = sprite;
+      return i;
+    }
+  }
+  assert(true);
+  return 0xFF;
+}
+
+Sprite* SpriteHandle_Get(SpriteHandle handle)
+{
+  return gSprites[handle];
+} 
+
+void Sprite_Make(Sprite* inSprite, Bitmap* bitmap, u32 x, u32 y, u32 w, u32 h)
+{
+  assert(bitmap);
+
+  SpriteHandle spriteHandle = SpriteHandle_Set(inSprite);
+  
+  inSprite->spriteHandle = spriteHandle;
+  inSprite->bitmap = bitmap;
+  inSprite->rect.x = x;
+  inSprite->rect.y = y;
+  inSprite->rect.w = w;
+  inSprite->rect.h = h;
+
+}
+
+AnimationHandle AnimationHandle_Set(Animation* animation)
+{
+  for (u32 i=0;i < 256;i++)
+  {
+    if (gAnimations[i] == NULL)
+    {
+      gAnimations[i] = animation;
+      return i;
+    }
+  }
+  assert(true);
+  return 0xFF;
+}
+
+Animation* AnimationHandle_Get(AnimationHandle handle)
+{
+  return gAnimations[handle];
+} 
+
+void Retro_Animation_Load(Animation* inAnimation, Bitmap* bitmap, u8 numFrames, u8 frameLengthMilliseconds, u32 originX, u32 originY, u32 frameWidth, u32 frameHeight, i32 frameOffsetX, i32 frameOffsetY)
+{
+  assert(numFrames <= RETRO_MAX_ANIMATED_SPRITE_FRAMES);
+  assert(inAnimation);
+  assert(bitmap);
+
+  AnimationHandle animationHandle = AnimationHandle_Set(inAnimation);
+
+  inAnimation->bitmap = bitmap;
+  inAnimation->frameCount = numFrames;
+  inAnimation->frameLength = frameLengthMilliseconds;
+  inAnimation->w = frameWidth;
+  inAnimation->h = frameHeight;
+  inAnimation->animationHandle = animationHandle;
+
+  SDL_Rect frame;
+  frame.x = originX;
+  frame.y = originY;
+  frame.w = frameWidth;
+  frame.h = frameHeight;
+
+  for(u8 i=0;i < numFrames;i++)
+  {
+    inAnimation->frames[i] = frame;
+    frame.x += frameOffsetX;
+    frame.y += frameOffsetY;
+  }
+
+}
+
+void  Animation_LoadHorizontal(Animation* inAnimatedSprite, Bitmap* bitmap, u8 numFrames, u8 frameLengthMilliseconds, u32 originX, u32 originY, u32 frameWidth, u32 frameHeight)
+{
+  Retro_Animation_Load(inAnimatedSprite, bitmap, numFrames, frameLengthMilliseconds, originX, originY, frameWidth, frameHeight, frameWidth, 0);
+}
+
+void  Animation_LoadVertical(Animation* inAnimatedSprite, Bitmap* bitmap, u8 numFrames, u8 frameLengthMilliseconds, u32 originX, u32 originY, u32 frameWidth, u32 frameHeight)
+{
+  Retro_Animation_Load(inAnimatedSprite, bitmap, numFrames, frameLengthMilliseconds, originX, originY, frameWidth, frameHeight, 0, frameHeight);
+}
+
+Size  Screen_GetSize()
+{
+  Size size;
+  size.w = gSettings.windowWidth;
+  size.h = gSettings.windowHeight;
+  return size;
+}
+
+void Canvas_SetSize(Size size)
+{
+  gCanvasSize.w = size.w;
+  gCanvasSize.h = size.h;
+}
+
+i32 Canvas_GetWidth()
+{
+  return gCanvasSize.w;
+}
+
+i32 Canvas_GetHeight()
+{
+  return gCanvasSize.h;
+}
+
+void Canvas_Set(u8 id)
+{
+  assert(id < RETRO_CANVAS_COUNT);
+
+  SpriteBatch_Flush();
+
+  if (gSoftwareRenderer)
+  {
+    gSoft.canvasId = id;
+    gSoft.target = gSoft.canvases[id];
+    gSoft.targetW = gCanvasSize.w;
+    gSoft.targetH = gCanvasSize.h;
+    return;
+  }
+
+  gCanvasTexture = gCanvasTextures[id];
+  SDL_SetRenderTarget(gRenderer, gCanvasTexture);
+}
+
+void Canvas_SetFlags(u8 id, u8 flags, u8 colour)
+{
+  assert(id < RETRO_CANVAS_COUNT);
+
+  gCanvasFlags[id] = flags;
+  gCanvasBackgroundColour[id] = colour;
+
+  if (flags & CNF_Blend)
+    SDL_SetTextureBlendMode(gCanvasTextures[id], SDL_BLENDMODE_BLEND);
+  else
+    SDL_SetTextureBlendMode(gCanvasTextures[id], SDL_BLENDMODE_NONE);
+
+}
+
+void Canvas_Splat(Bitmap* bitmap, i32 x, i32 y, Rect* srcRectangle)
+{
+  if (gRenderEnabled == false)
+    return;
+
+  SDL_Rect src, dst;
+  SDL_Texture* texture = (SDL_Texture*) bitmap->texture;
+
+  if (srcRectangle == NULL)
+  {
+    src.x = 0;
+    src.y = 0;
+    src.w = bitmap->w;
+    src.h = bitmap->h;
+  }
+  else
+  {
+    src.x = srcRectangle->left;
+    src.y = Rect_GetWidth(srcRectangle);
+    src.w = srcRectangle->top;
+    src.h = Rect_GetHeight(srcRectangle);
+  }
+
+  dst.x = x;
+  dst.y = y;
+  dst.w = src.w;
+  dst.h = src.h;
+
+  if (gSoftwareRenderer)
+  {
+    SoftCanvas_Blit(bitmap, &dst, &src, FF_None, NULL);
+    return;
+  }
+
+  if (gBatch.active)
+  {
+    SpriteBatch_Add(bitmap, &dst, &src, FF_None, 0xFF, 0xFF, 0xFF);
+    return;
+  }
+
+  SDL_RenderCopy(gRenderer, texture, &src, &dst);
+}
+
+void  Canvas_Splat2(Bitmap* bitmap, i32 x, i32 y, SDL_Rect* srcRectangle)
+{
+  if (gRenderEnabled == false)
+    return;
+
+  assert(srcRectangle);
+
+  SDL_Rect dst;
+  SDL_Texture* texture = (SDL_Texture*) bitmap->texture;
+
+  dst.x = x;
+  dst.y = y;
+  dst.w = srcRectangle->w;
+  dst.h = srcRectangle->h;
+
+  if (gSoftwareRenderer)
+  {
+    SoftCanvas_Blit(bitmap, &dst, srcRectangle, FF_None, NULL);
+    return;
+  }
+
+  if (gBatch.active)
+  {
+    SpriteBatch_Add(bitmap, &dst, srcRectangle, FF_None, 0xFF, 0xFF, 0xFF);
+    return;
+  }
+
+  SDL_RenderCopy(gRenderer, texture, srcRectangle, &dst);
+}
+
+void  Canvas_Splat3(Bitmap* bitmap, SDL_Rect* dstRectangle, SDL_Rect* srcRectangle)
+{
+  if (gRenderEnabled == false)
+    return;
+
+  assert(srcRectangle);
+
+  if (gSoftwareRenderer)
+  {
+    SoftCanvas_Blit(bitmap, dstRectangle, srcRectangle, FF_None, NULL);
+    return;
+  }
+
+  if (gBatch.active)
+  {
+    SpriteBatch_Add(bitmap, dstRectangle, srcRectangle, FF_None, 0xFF, 0xFF, 0xFF);
+    return;
+  }
+
+  SDL_Texture* texture = (SDL_Texture*) bitmap->texture;
+  SDL_RenderCopy(gRenderer, texture, srcRectangle, dstRectangle);
+}
+
+void  Canvas_Splat3Colour(Bitmap* bitmap, SDL_Rect* dstRectangle, SDL_Rect* srcRectangle, u8 r, u8 g, u8 b)
+{
+  if (gRenderEnabled == false)
+    return;
+
+  if (gSoftwareRenderer)
+  {
+    SoftCanvas_Blit(bitmap, dstRectangle, srcRectangle, FF_None, SoftCanvas_TintLut(r, g, b));
+    return;
+  }
+
+  if (gBatch.active)
+  {
+    SpriteBatch_Add(bitmap, dstRectangle, srcRectangle, FF_None, r, g, b);
+    return;
+  }
+
+  SDL_Texture* texture = (SDL_Texture*)bitmap->texture;
+  RETRO_SDL_TEXTURE_PUSH_RGB2(t, texture, r, g, b);
+
+  SDL_RenderCopy(gRenderer, texture, srcRectangle, dstRectangle);
+
+  RETRO_SDL_TEXTURE_POP_RGB(t, texture);
+}
+
+void Canvas_SplatFlip(Bitmap* bitmap, SDL_Rect* dstRectangle, SDL_Rect* srcRectangle, u8 flipFlags)
+{
+  if (gRenderEnabled == false)
+    return;
+
+  assert(srcRectangle);
+
+  if (gSoftwareRenderer)
+  {
+    SoftCanvas_Blit(bitmap, dstRectangle, srcRectangle, flipFlags, NULL);
+    return;
+  }
+
+  if (gBatch.active)
+  {
+    SpriteBatch_Add(bitmap, dstRectangle, srcRectangle, flipFlags, 0xFF, 0xFF, 0xFF);
+    return;
+  }
+
+  SDL_Texture* texture = (SDL_Texture*) bitmap->texture;
+  SDL_RenderCopyEx(gRenderer, texture, srcRectangle, dstRectangle, 0.0f, NULL, flipFlags);
+}
+
+void Canvas_SplatFlipColour(Bitmap* bitmap, SDL_Rect* dstRectangle, SDL_Rect* srcRectangle, u8 flipFlags, u8 r, u8 g, u8 b)
+{
+  if (gRenderEnabled == false)
+    return;
+
+  assert(srcRectangle);
+
+  if (gSoftwareRenderer)
+  {
+    SoftCanvas_Blit(bitmap, dstRectangle, srcRectangle, flipFlags, SoftCanvas_TintLut(r, g, b));
+    return;
+  }
+
+  if (gBatch.active)
+  {
+    SpriteBatch_Add(bitmap, dstRectangle, srcRectangle, flipFlags, r, g, b);
+    return;
+  }
+
+  SDL_Texture* texture = (SDL_Texture*)bitmap->texture;
+  RETRO_SDL_TEXTURE_PUSH_RGB2(t, texture, r, g, b);
+  SDL_RenderCopyEx(gRenderer, texture, srcRectangle, dstRectangle, 0.0f, NULL, flipFlags);
+  RETRO_SDL_TEXTURE_POP_RGB(t, texture);
+}
+
+void Canvas_Place(StaticSpriteObject* spriteObject)
+{
+  assert(spriteObject);
+  Sprite* sprite = SpriteHandle_Get(spriteObject->spriteHandle);
+
+  Canvas_Splat2(sprite->bitmap, spriteObject->x, spriteObject->y, &sprite->rect);
+}
+
+void Canvas_Place2(Sprite* sprite, i32 x, i32 y)
+{
+  assert(sprite);
+  Canvas_Splat2(sprite->bitmap, x, y, &sprite->rect);
+}
+
+void Canvas_PlaceAnimated(AnimatedSpriteObject* spriteObject, bool updateTiming)
+{
+  Animation* animation = AnimationHandle_Get(spriteObject->animationHandle);
+
+  if (updateTiming && (spriteObject->flags & SOF_Animation) != 0)
+  {
+    spriteObject->frameTime += gDeltaTime;
+
+    if (spriteObject->frameTime >= 1000)
+      spriteObject->frameTime = 0; // Prevent spiral out of control.
+
+
+    while(spriteObject->frameTime > animation->frameLength)
+    {
+      spriteObject->frameNumber++;
+      spriteObject->frameTime -= animation->frameLength;
+
+      if (spriteObject->frameNumber >= animation->frameCount)
+      {
+        if (spriteObject->flags & SOF_AnimationOnce)
+        {
+          spriteObject->flags &= ~SOF_Animation;
+          spriteObject->frameNumber = animation->frameCount - 1; // Stop
+          break;
+        }
+        else
+        {
+          spriteObject->frameNumber = 0; // Loop around.
+        }
+      }
+    }
+  }
+
+  assert(spriteObject->frameNumber < animation->frameCount);
+  Canvas_PlaceAnimated2(animation, spriteObject->x, spriteObject->y, spriteObject->frameNumber, spriteObject->flags & FF_Mask);
+}
+
+void Canvas_PlaceAnimated2(Animation* animatedSprite, i32 x, i32 y, u8 frame, u8 flipFlags)
+{
+  assert(animatedSprite);
+  assert(frame < animatedSprite->frameCount);
+  SDL_Rect src = animatedSprite->frames[frame];
+  SDL_Rect dst;
+  dst.x = x;
+  dst.y = y;
+  dst.w = src.w;
+  dst.h = src.h;
+  Canvas_SplatFlip(animatedSprite->bitmap, &dst, &src, flipFlags & FF_Mask);
+}
+
+void Canvas_PlaceScaled(Sprite* sprite, u32 x, u32 y, u32 scale)
+{
+  assert(sprite);
+  SDL_Rect dst;
+  dst.x = x;
+  dst.y = y;
+  dst.w = sprite->rect.w * scale;
+  dst.h = sprite->rect.h * scale;
+
+  Canvas_Splat3(sprite->bitmap, &dst, &sprite->rect);
+}
+
+void Canvas_PlaceScaledF(Sprite* sprite, u32 x, u32 y, float scale)
+{
+  assert(sprite);
+  SDL_Rect dst;
+  dst.x = x;
+  dst.y = y;
+  dst.w = sprite->rect.w * scale;
+  dst.h = sprite->rect.h * scale;
+
+  Canvas_Splat3(sprite->bitmap, &dst, &sprite->rect);
+}
+
+void Canvas_Flip()
+{
+  SDL_RenderPresent(gRenderer);
+}
+
+void Canvas_Clear()
+{
+  if (gSoftwareRenderer)
+  {
+    SoftCanvas_Clear(gSoft.canvasId);
+    return;
+  }
+
+  SDL_RenderClear(gRenderer);
+}
+
+void Canvas_BeginBitmap(Bitmap* bitmap)
+{
+  assert(bitmap);
+
+  SpriteBatch_Flush();
+
+  if (gSoftwareRenderer)
+  {
+    assert(bitmap->indices);
+    gSoft.target = bitmap->indices;
+    gSoft.targetW = bitmap->w;
+    gSoft.targetH = bitmap->h;
+    memset(bitmap->indices, RETRO_SOFT_HOLE, bitmap->w * bitmap->h);
+    return;
+  }
+
+  assert(bitmap->texture);
+  SDL_SetRenderTarget(gRenderer, bitmap->texture);
+
+  u8 r, g, b, a;
+  SDL_GetRenderDrawColor(gRenderer, &r, &g, &b, &a);
+  SDL_SetRenderDrawColor(gRenderer, 0x00, 0x00, 0x00, 0x00);
+  SDL_RenderClear(gRenderer);
+  SDL_SetRenderDrawColor(gRenderer, r, g, b, a);
+}
+
+void Canvas_EndBitmap()
+{
+  SpriteBatch_Flush();
+
+  if (gSoftwareRenderer)
+  {
+    Canvas_Set(gSoft.canvasId);
+    return;
+  }
+
+  SDL_SetRenderTarget(gRenderer, gCanvasTexture);
+}
+
+void  Palette_Make(Palette* palette)
+{
+  assert(palette);
+  palette->count = 0;
+  palette->fallback = 1;
+  palette->transparent = 0;
+}
+
+void  Palette_Add(Palette* palette, Colour colour)
+{
+  assert(palette);
+  assert(palette->count <= 255);
+  palette->colours[palette->count] = colour;
+  ++palette->count;
+}
+
+void Palette_AddRGBInt(Palette* palette, u32 rgb)
+{
+  RetroFourByteUnion c;
+  c.q = rgb;
+  
+  Palette_Add(palette, Colour_Make(c.b[2], c.b[1], c.b[0]));
+}
+
+u8 Palette_FindColour(Palette* palette, Colour colour)
+{
+  assert(palette);
+
+  for(int i=0;i < palette->count;++i)
+  {
+    Colour t = palette->colours[i];
+    if (t.r == colour.r && t.g == colour.g && t.b == colour.b)
+      return i;
+  }
+  return palette->fallback;
+}
+
+bool Palette_HasColour(Palette* palette, Colour colour)
+{
+  assert(palette);
+
+  for(int i=0;i < palette->count;++i)
+  {
+    Colour t = palette->colours[i];
+    if (t.r == colour.r && t.g == colour.g && t.b == colour.b)
+      return true;
+  }
+  return false;
+}
+
+void Palette_CopyTo(const Palette* src, Palette* dst)
+{
+  assert(src);
+  assert(dst);
+
+  dst->count = src->count;
+  dst->fallback = src->fallback;
+  dst->transparent = src->transparent;
+  memcpy(dst->colours, src->colours, sizeof(src->colours));
+}
+
+Colour Colour_Make(u8 r, u8 g, u8 b)
+{
+  Colour c;
+  c.r = r;
+  c.g = g;
+  c.b = b;
+  return c;
+}
+
+Colour Colour_ReadRGB(u8* p)
+{
+  Colour c;
+  c.r = *(p + 0);
+  c.g = *(p + 1);
+  c.b = *(p + 2);
+  return c;
+}
+
+Size Size_Make(u32 w, u32 h)
+{
+  Size s;
+  s.w = w;
+  s.h = h;
+  return s;
+}
+
+u8* Arena_Obtain(u32 size)
+{
+  assert(gArena.current + size < gArena.end); // Ensure can fit.
+  u8* mem = gArena.current;
+  gArena.current += size;
+  memset(mem, 0, size);
+  return mem;
+}
+
+void Arena_RewindPtr(u8* mem)
+{
+  assert(mem >= gArena.begin);
+  assert(mem <= gArena.current);
+  gArena.current = mem;
+}
+
+void Arena_RewindU32(u32 offset)
+{
+  assert(offset < RETRO_ARENA_SIZE);
+  gArena.current = gArena.begin + offset;
+}
+
+u32 Arena_Current()
+{
+  return gArena.current - gArena.begin;
+}
+
+int  Arena_PctSize()
+{
+  u32 used = (gArena.current - gArena.begin);
+  float pct = ((float) used / (float) RETRO_ARENA_SIZE);
+  return (int) (pct * 100.0f);
+}
+
+typedef struct
+{
+  u8   header[4];
+  u32  size;
+  u32  scopeStackIndex;
+  u32  musicSamples;
+  char musicName[32];
+} Retro_ArenaSave;
+
+void Arena_Save(const char* filename)
+{
+  u32 size;
+  u8* mem = Arena_SaveToMem(&size);
+  FILE* f = fopen(filename, "wb");
+  fwrite(mem, size, 1, f);
+  fclose(f);
+  free(mem);
+}
+
+void Arena_Load(const char* filename, bool loadMusic)
+{
+  FILE* f = fopen(filename, "rb");
+  fseek(f, 0, SEEK_END);
+  int size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  u8* mem = (u8*) malloc(size);
+  fread(mem, size, 1, f);
+  fclose(f);
+
+  Arena_LoadFromMem(mem, loadMusic);
+  free(mem);
+}
+
+u8* Retro_SaveToMem(u8* mem, void* obj, u32 size)
+{
+  memcpy(mem, obj, size);
+  mem += size;
+  return mem;
+}
+
+u8* Arena_SaveToMem(u32* outSize)
+{
+  u32 memSize = sizeof(Retro_ArenaSave);
+  memSize += (gScopeStackIndex + 1) * sizeof(ScopeStack);
+  memSize += Arena_Current();
+
+  *outSize = memSize;
+
+  printf("Size = %i\n", memSize);
+
+  u8* mem = (u8*) malloc(memSize);
+  u8* p = mem;
+
+  Retro_ArenaSave s;
+  s.header[0] = 'R';
+  s.header[1] = 'E';
+  s.header[2] = 'T';
+  s.header[3] = 'R';
+
+  s.scopeStackIndex = gScopeStackIndex;
+  s.size = (gArena.current - gArena.begin);
+  
+  if (gMusicContext != NULL)
+    s.musicSamples = gMusicContext->samples_remaining;
+  else
+    s.musicSamples = 0;
+
+  p = Retro_SaveToMem(p, &s, sizeof(Retro_ArenaSave));
+
+  for(u32 i=0;i < (s.scopeStackIndex + 1);i++)
+  {
+    //fwrite(&gScopeStack[i], sizeof(ScopeStack), 1,);
+    p = Retro_SaveToMem(p, &gScopeStack[i], sizeof(ScopeStack));
+  }
+
+  p = Retro_SaveToMem(p, gArena.begin, s.size);
+  return mem;
+}
+
+u8* Retro_ReadFromMem(u8* mem, void* obj, u32 size)
+{
+  memcpy(obj, mem, size);
+  mem += size;
+  return mem;
+}
+
+void Arena_LoadFromMem(u8* mem, bool loadMusic)
+{
+  u8* p = (u8*) mem;
+
+  Retro_ArenaSave l;
+
+  p = Retro_ReadFromMem(p, &l, sizeof(Retro_ArenaSave));
+
+  assert(l.header[0] == 'R');
+  assert(l.header[1] == 'E');
+  assert(l.header[2] == 'T');
+  assert(l.header[3] == 'R');
+  assert(l.size < RETRO_ARENA_SIZE);
+ 
+  gScopeStackIndex = l.scopeStackIndex;
+  
+  for(u32 i=0;i < l.scopeStackIndex + 1;i++)
+  {
+    //fread(&gScopeStack[i], sizeof(ScopeStack), 1, f);
+    p = Retro_ReadFromMem(p, &gScopeStack[i], sizeof(ScopeStack));
+  }
+
+  p = Retro_ReadFromMem(p, gArena.begin, l.size);
+
+  gArena.current = gArena.begin + l.size;
+
+
+  if (loadMusic && gMusicContext != NULL)
+  {
+    // gMusicContext->samples_remaining = l.musicSamples;
+    // micromod_set_position(l.musicSamples);
+  }
+
+}
+
+void Scope_Push(int name)
+{
+  assert(gScopeStackIndex < 256);
+
+  ++gScopeStackIndex;
+  ScopeStack* scope = &gScopeStack[gScopeStackIndex];
+
+  scope->name = name;
+  scope->p = Arena_Current();
+}
+
+int Scope_GetName()
+{
+  ScopeStack* scope = &gScopeStack[gScopeStackIndex];
+  return scope->name;
+}
+
+u8* Scope_Obtain(u32 size)
+{
+  ScopeStack* scope = &gScopeStack[gScopeStackIndex];
+  assert(scope->p + size < RETRO_ARENA_SIZE); // Ensure can fit.
+  return Arena_Obtain(size);
+}
+
+void Scope_Rewind()
+{
+  ScopeStack* scope = &gScopeStack[gScopeStackIndex];
+  Arena_RewindU32(scope->p);
+}
+
+void Scope_Pop()
+{
+  assert(gScopeStackIndex > 0);
+  Scope_Rewind();
+  --gScopeStackIndex;
+}
+
+void Canvas_DrawPalette(Palette* palette, u32 Y)
+{
+  int w = Canvas_GetWidth() / 16;
+  int h = 8;
+
+  int x = 0;
+  int y = 0;
+
+  for(int i=0;i < palette->count;i++)
+  {
+    Rect rect;
+    rect.left = x;
+    rect.top = y;
+    rect.right = x + w;
+    rect.bottom = y + h;
+
+    Canvas_DrawFilledRectangle(i, rect);
+
+    if (i > 0 && i % 16 == 0)
+    {
+      x = 0;
+      y += h;
+    }
+    else
+    {
+      x += w;
+    }
+  }
+  
+}
+
+void Canvas_DrawRectangle(u8 colour, Rect rect)
+{
+  if (gRenderEnabled == false)
+    return;
+
+  if (gSoftwareRenderer)
+  {
+    i32 w = rect.right - rect.left;
+    i32 h = rect.bottom - rect.top;
+    SoftCanvas_FillRect(colour, rect.left, rect.top, w, 1);
+    SoftCanvas_FillRect(colour, rect.left, rect.bottom - 1, w, 1);
+    SoftCanvas_FillRect(colour, rect.left, rect.top, 1, h);
+    SoftCanvas_FillRect(colour, rect.right - 1, rect.top, 1, h);
+    return;
+  }
+
+  if (gBatch.active)
+  {
+    i32 w = rect.right - rect.left;
+    i32 h = rect.bottom - rect.top;
+    SpriteBatch_AddRect(colour, rect.left, rect.top, w, 1);
+    SpriteBatch_AddRect(colour, rect.left, rect.bottom - 1, w, 1);
+    SpriteBatch_AddRect(colour, rect.left, rect.top, 1, h);
+    SpriteBatch_AddRect(colour, rect.right - 1, rect.top, 1, h);
+    return;
+  }
+
+  Colour rgb = Palette_GetColour(&gSettings.palette, colour);
+  SDL_Rect dst;
+  RETRO_SDL_TO_RECT(rect, dst);
+
+  RETRO_SDL_DRAW_PUSH_RGB(t, rgb);
+
+  SDL_RenderDrawRect(gRenderer, &dst);
+
+  RETRO_SDL_DRAW_POP_RGB(t);
+}
+
+void Canvas_DrawFilledRectangle(u8 colour, Rect rect)
+{
+  if (gRenderEnabled == false)
+    return;
+
+  if (gSoftwareRenderer)
+  {
+    SoftCanvas_FillRect(colour, rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
+    return;
+  }
+
+  if (gBatch.active)
+  {
+    SpriteBatch_AddRect(colour, rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
+    return;
+  }
+
+  Colour rgb = Palette_GetColour(&gSettings.palette, colour);
+  SDL_Rect dst;
+  RETRO_SDL_TO_RECT(rect, dst);
+
+  RETRO_SDL_DRAW_PUSH_RGB(t, rgb);
+
+  SDL_RenderFillRect(gRenderer, &dst);
+
+  RETRO_SDL_DRAW_POP_RGB(t);
+}
+
+char* gFmtScratch;
+
+static void Canvas_PrintGlyphs(u32 x, u32 y, Font* font, u8 colour, const char* str)
+{
+  Colour rgb = Palette_GetColour(&gSettings.palette, colour);
+
+  SDL_Rect s, d;
+  s.x = 0;
+  s.y = 0;
+  s.w = 0;
+  s.h = font->height;
+  d.x = x;
+  d.y = y;
+  d.w = 0;
+  d.h = s.h; 
+
+  SDL_Color t;
+  bool immediate = (gSoftwareRenderer == false && gBatch.active == false);
+
+  if (gSoftwareRenderer)
+  {
+    memset(gSoft.fill, colour, sizeof(gSoft.fill));
+  }
+
+  if (immediate)
+  {
+    SDL_GetTextureColorMod(font->bitmap.texture, &t.r, &t.g, &t.b);
+    SDL_SetTextureColorMod(font->bitmap.texture, rgb.r, rgb.g, rgb.b);
+  }
+
+  while(true)
+  {
+    u8 c = *str++;
+
+    if (c == 0x0)
+      break;
+    
+    if (c == ' ')
+    {
+      d.x += font->widths[' '];
+      continue;
+    }
+
+    s.x = font->x[c];
+    s.w = font->widths[c];
+    d.w = s.w;
+
+    if (immediate)
+      SDL_RenderCopy(gRenderer, (SDL_Texture*) font->bitmap.texture, &s, &d);
+    else if (gSoftwareRenderer)
+      SoftCanvas_Blit(&font->bitmap, &d, &s, FF_None, gSoft.fill);
+    else
+      SpriteBatch_Add(&font->bitmap, &d, &s, FF_None, rgb.r, rgb.g, rgb.b);
+
+    d.x += d.w;
+  }
+
+  if (immediate)
+  {
+    RETRO_SDL_TEXTURE_POP_RGB(t, (SDL_Texture*) font->bitmap.texture);
+  }
+
+}
+
+i32 Canvas_LengthStr(Font* font, const char* str)
+{
+  assert(font);
+  assert(str);
+
+  SDL_Rect s, d;
+  s.x = 0;
+  s.y = 0;
+  s.w = 0;
+  s.h = font->height;
+  d.x = 0;
+  d.y = 0;
+  d.w = 0;
+  d.h = s.h; 
+
+  while(true)
+  {
+    u8 c = *str++;
+
+    if (c == 0x0)
+      break;
+
+    if (c == ' ')
+    {
+      d.x += font->widths[' '];
+      continue;
+    }
+
+    s.x = font->x[c];
+    s.w = font->widths[c];
+    d.w = s.w;
+
+    d.x += d.w;
+  }
+
+  return d.x;
+}
+
+// Text run cache. Strings are drawn once into a slot of a shared bitmap, keyed by font, colour
+// and text, and afterwards are a single splat. Slots are reused least recently used first.
+
+typedef struct
+{
+  Font* font;
+  u32   hash;
+  u32   lastUsed;
+  u16   w;
+  u8    colour;
+  bool  used;
+  char  text[RETRO_TEXT_CACHE_MAX_LENGTH];
+} TextRun;
+
+typedef struct
+{
+  bool    ready;
+  Bitmap  atlas;
+  u32     clock;
+  u32     hits, misses, evictions;
+  u32     notAdmitted;                               // Drawn uncached, on first sight
+  TextRun runs[RETRO_TEXT_CACHE_SLOTS];
+  u32     seenKey[RETRO_TEXT_CACHE_CANDIDATES];     // Strings drawn uncached, by hash
+  u32     seenFrame[RETRO_TEXT_CACHE_CANDIDATES];
+} TextCache;
+
+TextCache             gTextCache;
+bool                  gTextCacheEnabled = true;
+
+static void TextCache_Rasterise(TextRun* run, u32 slot)
+{
+  Bitmap* atlas = &gTextCache.atlas;
+  i32 slotY = slot * RETRO_TEXT_CACHE_SLOT_H;
+
+  // Glyphs have to land in the atlas now, not in the caller's batch.
+  bool batched = gBatch.active;
+  SpriteBatch_Flush();
+  gBatch.active = false;
+
+  if (gSoftwareRenderer)
+  {
+    u8* target = gSoft.target;
+    i32 targetW = gSoft.targetW;
+    i32 targetH = gSoft.targetH;
+
+    gSoft.target = atlas->indices;
+    gSoft.targetW = atlas->w;
+    gSoft.targetH = atlas->h;
+
+    memset(atlas->indices + slotY * atlas->w, RETRO_SOFT_HOLE, atlas->w * RETRO_TEXT_CACHE_SLOT_H);
+    Canvas_PrintGlyphs(0, slotY, run->font, run->colour, run->text);
+
+    gSoft.target = target;
+    gSoft.targetW = targetW;
+    gSoft.targetH = targetH;
+  }
+  else
+  {
+    SDL_Texture* target = SDL_GetRenderTarget(gRenderer);
+    SDL_SetRenderTarget(gRenderer, atlas->texture);
+
+    SDL_Rect slotRect;
+    slotRect.x = 0;
+    slotRect.y = slotY;
+    slotRect.w = atlas->w;
+    slotRect.h = RETRO_TEXT_CACHE_SLOT_H;
+
+    u8 r, g, b, a;
+    SDL_GetRenderDrawColor(gRenderer, &r, &g, &b, &a);
+    SDL_SetRenderDrawColor(gRenderer, 0x00, 0x00, 0x00, 0x00);
+    SDL_RenderFillRect(gRenderer, &slotRect);
+    SDL_SetRenderDrawColor(gRenderer, r, g, b, a);
+
+    Canvas_PrintGlyphs(0, slotY, run->font, run->colour, run->text);
+
+    SDL_SetRenderTarget(gRenderer, target);
+  }
+
+  gBatch.active = batched;
+}
+
+// The atlas is a render target, so a renderer reset loses every run.
+static void TextCache_Reset()
+{
+  for (u32 i=0;i < RETRO_TEXT_CACHE_SLOTS;i++)
+  {
+    gTextCache.runs[i].used = false;
+  }
+}
+
+// Returns the slot holding the string, drawing it first if needed, or -1 if it isn't cached.
+static i32 TextCache_Get(Font* font, u8 colour, const char* str)
+{
+  if (gTextCacheEnabled == false || font->height > RETRO_TEXT_CACHE_SLOT_H)
+    return -1;
+
+  u32 hash = 2166136261u;
+  u32 length = 0;
+
+  for (const char* c = str; *c != 0; c++, length++)
+  {
+    hash = (hash ^ (u8) *c) * 16777619u;
+  }
+
+  if (length >= RETRO_TEXT_CACHE_MAX_LENGTH)
+    return -1;
+
+  hash = (hash ^ colour) * 16777619u;
+
+  gTextCache.clock++;
+
+  i32 victim = 0;
+
+  for (u32 i=0;i < RETRO_TEXT_CACHE_SLOTS;i++)
+  {
+    TextRun* run = &gTextCache.runs[i];
+
+    if (run->used && run->hash == hash && run->font == font && run->colour == colour && strcmp(run->text, str) == 0)
+    {
+      run->lastUsed = gTextCache.clock;
+      gTextCache.hits++;
+      return i;
+    }
+
+    TextRun* oldest = &gTextCache.runs[victim];
+
+    if (oldest->used && (run->used == false || run->lastUsed < oldest->lastUsed))
+      victim = i;
+  }
+
+  // Not cached. It is drawn directly the first time, and cached if drawn again soon after.
+  u32 key = hash ^ (u32) (uintptr_t) font;
+  u32 candidate = key & (RETRO_TEXT_CACHE_CANDIDATES - 1);
+
+  if (gTextCache.seenKey[candidate] != key || gCountedFrames - gTextCache.seenFrame[candidate] > RETRO_TEXT_CACHE_ADMIT_FRAMES)
+  {
+    gTextCache.seenKey[candidate] = key;
+    gTextCache.seenFrame[candidate] = gCountedFrames;
+    gTextCache.notAdmitted++;
+    return -1;
+  }
+
+  i32 w = Canvas_LengthStr(font, str);
+
+  if (w > RETRO_TEXT_CACHE_SLOT_W)
+    return -1;
+
+  if (gTextCache.ready == false)
+  {
+    Bitmap_Create(&gTextCache.atlas, RETRO_TEXT_CACHE_SLOT_W, RETRO_TEXT_CACHE_SLOT_H * RETRO_TEXT_CACHE_SLOTS);
+    gTextCache.ready = true;
+  }
+
+  TextRun* run = &gTextCache.runs[victim];
+
+  if (run->used)
+    gTextCache.evictions++;
+
+  gTextCache.misses++;
+
+  run->font = font;
+  run->hash = hash;
+  run->lastUsed = gTextCache.clock;
+  run->w = w;
+  run->colour = colour;
+  run->used = true;
+  memcpy(run->text, str, length + 1);
+
+  TextCache_Rasterise(run, victim);
+
+  return victim;
+}
+
+void Canvas_PrintStr(u32 x, u32 y, Font* font, u8 colour, const char* str)
+{
+  if (gRenderEnabled == false)
+    return;
+
+  assert(font);
+  assert(str);
+
+  i32 slot = TextCache_Get(font, colour, str);
+
+  if (slot < 0)
+  {
+    Canvas_PrintGlyphs(x, y, font, colour, str);
+    return;
+  }
+
+  TextRun* run = &gTextCache.runs[slot];
+
+  if (run->w == 0)
+    return;
+
+  SDL_Rect src;
+  src.x = 0;
+  src.y = slot * RETRO_TEXT_CACHE_SLOT_H;
+  src.w = run->w;
+  src.h = font->height;
+
+  Canvas_Splat2(&gTextCache.atlas, x, y, &src);
+}
+
+void Canvas_PrintF(u32 x, u32 y, Font* font, u8 colour, const char* fmt, ...)
+{
+  RETRO_ZONE_BEGIN(Canvas_PrintF);
+
+  assert(font);
+  assert(fmt);
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(gFmtScratch, RETRO_FMT_SCRATCH_SIZE, fmt, args);
+  va_end(args);
+
+  Canvas_PrintStr(x, y, font, colour, gFmtScratch);
+
+  RETRO_ZONE_END(Canvas_PrintF);
+}
+
+i32 Canvas_LengthF(Font* font, const char* fmt, ...)
+{
+  assert(font);
+  assert(fmt);
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(gFmtScratch, RETRO_FMT_SCRATCH_SIZE, fmt, args);
+  va_end(args);
+
+  return Canvas_LengthStr(font, gFmtScratch);
+}
+
+void Canvas_SetPresentation(FramePresentation presentation, float alpha, float beta)
+{
+  gFramePresentation = presentation;
+  gFrameAlpha = alpha;
+  gFrameBeta = beta;
+}
+
+void AnimatedSpriteObject_Make(AnimatedSpriteObject* inAnimatedSpriteObject, Animation* animation, i32 x, i32 y)
+{
+  assert(inAnimatedSpriteObject);
+
+  AnimationHandle handle = AnimationHandle_Set(animation);
+
+  inAnimatedSpriteObject->animationHandle = handle;
+  inAnimatedSpriteObject->flags = 0;
+  inAnimatedSpriteObject->frameNumber = 0;
+  inAnimatedSpriteObject->frameTime = 0;
+  inAnimatedSpriteObject->x = x;
+  inAnimatedSpriteObject->y = y;
+}
+
+void AnimatedSpriteObject_PlayAnimation(AnimatedSpriteObject* inAnimatedSpriteObject, bool playing, bool loop)
+{
+  assert(inAnimatedSpriteObject);
+
+  if (playing)
+    inAnimatedSpriteObject->flags |= SOF_Animation;
+  else
+    inAnimatedSpriteObject->flags &= ~SOF_Animation;
+
+  if (!loop)
+    inAnimatedSpriteObject->flags |= SOF_AnimationOnce;
+  else
+    inAnimatedSpriteObject->flags &= ~SOF_AnimationOnce;
+
+}
+
+void AnimatedSpriteObject_SwitchAnimation(AnimatedSpriteObject* animatedSpriteObject, Animation* newAnimation, bool animate)
+{
+  assert(animatedSpriteObject);
+  assert(newAnimation);
+
+  animatedSpriteObject->animationHandle = newAnimation->animationHandle;
+  if (animate)
+    animatedSpriteObject->flags |= SOF_Animation;
+  else
+    animatedSpriteObject->flags &= ~SOF_Animation;
+  animatedSpriteObject->frameNumber = 0;
+}
+
+const char* kProfilePhaseNames[PP_COUNT] = {
+  "Events",
+  "Input",
+  "Clear",
+  "Step",
+  "Draw",
+  "Present",
+  "Flip",
+  "Frame"
+};
+
+void Profiler_BeginFrame()
+{
+  u64 now = SDL_GetPerformanceCounter();
+  memset(gProfiler.ticks[gProfiler.head], 0, sizeof(gProfiler.ticks[0]));
+  gProfiler.frameBegin = now;
+  gProfiler.phaseBegin = now;
+  gProfiler.inFrame = true;
+}
+
+void Profiler_EndPhase(ProfilePhase phase)
+{
+  u64 now = SDL_GetPerformanceCounter();
+  gProfiler.ticks[gProfiler.head][phase] += now - gProfiler.phaseBegin;
+  gProfiler.phaseBegin = now;
+}
+
+void Profiler_EndFrame()
+{
+  gProfiler.ticks[gProfiler.head][PP_Frame] = SDL_GetPerformanceCounter() - gProfiler.frameBegin;
+  gProfiler.head = (gProfiler.head + 1) % RETRO_PROFILE_FRAMES;
+  gProfiler.inFrame = false;
+
+  if (gProfiler.count < RETRO_PROFILE_FRAMES)
+    gProfiler.count++;
+}
+
+static int Profiler_CompareTicks(const void* a, const void* b)
+{
+  u64 x = *((const u64*) a);
+  u64 y = *((const u64*) b);
+  return (x > y) - (x < y);
+}
+
+void Profiler_Rollup(ProfilePhase phase, ProfileRollup* outRollup)
+{
+  assert(phase < PP_COUNT);
+  assert(outRollup);
+
+  memset(outRollup, 0, sizeof(ProfileRollup));
+
+  // Only completed frames. Mid-frame, a full ring's head slot is the frame still being timed.
+  u32 count = gProfiler.count;
+
+  if (gProfiler.inFrame && count == RETRO_PROFILE_FRAMES)
+    count--;
+
+  if (count == 0)
+    return;
+
+  u32 first = (gProfiler.head + RETRO_PROFILE_FRAMES - count) % RETRO_PROFILE_FRAMES;
+  u64 sorted[RETRO_PROFILE_FRAMES];
+  u64 total = 0;
+
+  for (u32 i=0;i < count;i++)
+  {
+    sorted[i] = gProfiler.ticks[(first + i) % RETRO_PROFILE_FRAMES][phase];
+    total += sorted[i];
+  }
+
+  qsort(sorted, count, sizeof(u64), Profiler_CompareTicks);
+
+  f32 toMs = 1000.0f / (f32) SDL_GetPerformanceFrequency();
+  u32 p99Index = (count * 99 + 99) / 100 - 1;
+
+  outRollup->min  = sorted[0] * toMs;
+  outRollup->max  = sorted[count - 1] * toMs;
+  outRollup->mean = (total / (f32) count) * toMs;
+  outRollup->p99  = sorted[p99Index] * toMs;
+}
+
+void Profiler_SetOverlay(bool enabled)
+{
+  gProfiler.overlay = enabled;
+}
+
+bool Profiler_DumpCsv(const char* filename)
+{
+  FILE* f = fopen(filename, "w");
+
+  if (f == NULL)
+  {
+    printf("Profiler Error: Cannot write %s\n", filename);
+    return false;
+  }
+
+  f64 toMs = 1000.0 / (f64) SDL_GetPerformanceFrequency();
+
+  fprintf(f, "frame");
+  for (u32 j=0;j < PP_COUNT;j++)
+    fprintf(f, ",%s_ms", kProfilePhaseNames[j]);
+  fprintf(f, "\n");
+
+  // Oldest frame first.
+  u32 first = (gProfiler.head + RETRO_PROFILE_FRAMES - gProfiler.count) % RETRO_PROFILE_FRAMES;
+
+  for (u32 i=0;i < gProfiler.count;i++)
+  {
+    u64* ticks = gProfiler.ticks[(first + i) % RETRO_PROFILE_FRAMES];
+
+    fprintf(f, "%u", i);
+    for (u32 j=0;j < PP_COUNT;j++)
+      fprintf(f, ",%.4f", ticks[j] * toMs);
+    fprintf(f, "\n");
+  }
+
+  fprintf(f, "\nphase,min_ms,mean_ms,max_ms,p99_ms\n");
+
+  for (u32 j=0;j < PP_COUNT;j++)
+  {
+    ProfileRollup rollup;
+    Profiler_Rollup(j, &rollup);
+    fprintf(f, "%s,%.4f,%.4f,%.4f,%.4f\n", kProfilePhaseNames[j], rollup.min, rollup.mean, rollup.max, rollup.p99);
+  }
+
+  fclose(f);
+  return true;
+}
+
+#ifdef RETRO_TRACE
+
+void Trace_Init()
+{
+  for (u32 i=0;i < RETRO_TRACE_MAX_THREADS;i++)
+  {
+    gTraceThreads[i].events = malloc(sizeof(TraceEvent) * RETRO_TRACE_MAX_EVENTS);
+    SDL_AtomicSet(&gTraceThreads[i].count, 0);
+  }
+
+  // Threads past RETRO_TRACE_MAX_THREADS land here, and it always reads as full.
+  SDL_AtomicSet(&gTraceOverflowThread.count, RETRO_TRACE_MAX_EVENTS);
+
+  gTraceMainThread = SDL_ThreadID();
+  gTraceBegin = SDL_GetPerformanceCounter();
+  gTraceEnabled = true;
+}
+
+u64 Trace_Now()
+{
+  return gTraceEnabled ? SDL_GetPerformanceCounter() : 0;
+}
+
+void Trace_Record(const char* name, u64 begin, u64 end)
+{
+  if (gTraceEnabled == false)
+    return;
+
+  TraceThread* thread = tTraceThread;
+
+  if (thread == NULL)
+  {
+    int index = SDL_AtomicAdd(&gTraceThreadCount, 1);
+
+    if (index < RETRO_TRACE_MAX_THREADS)
+    {
+      thread = &gTraceThreads[index];
+      thread->threadId = SDL_ThreadID();
+    }
+    else
+    {
+      thread = &gTraceOverflowThread;
+    }
+
+    tTraceThread = thread;
+  }
+
+  // Only the owning thread writes to its buffer, the count is published after the event.
+  int count = SDL_AtomicGet(&thread->count);
+
+  if (count >= RETRO_TRACE_MAX_EVENTS)
+  {
+    SDL_AtomicAdd(&gTraceDropped, 1);
+    return;
+  }
+
+  TraceEvent* event = &thread->events[count];
+  event->name  = name;
+  event->begin = begin;
+  event->end   = end;
+
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&thread->count, count + 1);
+}
+
+bool Trace_Export(const char* filename)
+{
+  FILE* f = fopen(filename, "w");
+
+  if (f == NULL)
+  {
+    printf("Trace Error: Cannot write %s\n", filename);
+    return false;
+  }
+
+  f64 toUs = 1000000.0 / (f64) SDL_GetPerformanceFrequency();
+  int threadCount = SDL_AtomicGet(&gTraceThreadCount);
+  bool first = true;
+
+  if (threadCount > RETRO_TRACE_MAX_THREADS)
+    threadCount = RETRO_TRACE_MAX_THREADS;
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  for (int i=0;i < threadCount;i++)
+  {
+    TraceThread* thread = &gTraceThreads[i];
+    int count = SDL_AtomicGet(&thread->count);
+    SDL_MemoryBarrierAcquire();
+
+    // Threads are named after the main thread, or the first zone they recorded (e.g. the audio callback).
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+      first ? "" : ",\n",
+      i,
+      thread->threadId == gTraceMainThread ? "Main" : (count > 0 ? thread->events[0].name : "Thread")
+    );
+    first = false;
+
+    for (int j=0;j < count;j++)
+    {
+      TraceEvent* event = &thread->events[j];
+      fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f}",
+        event->name,
+        i,
+        (event->begin - gTraceBegin) * toUs,
+        (event->end - event->begin) * toUs
+      );
+    }
+  }
+
+  fprintf(f, "\n]}\n");
+  fclose(f);
+
+  if (SDL_AtomicGet(&gTraceDropped) > 0)
+  {
+    printf("Trace: %i zones were dropped, increase RETRO_TRACE_MAX_EVENTS\n", SDL_AtomicGet(&gTraceDropped));
+  }
+
+  return true;
+}
+
+#endif
+
+static bool Jobs_Take(JobWorker* worker, bool steal, u32* outChunk)
+{
+  bool taken = false;
+
+  SDL_AtomicLock(&worker->lock);
+
+  if (worker->head < worker->tail)
+  {
+    *outChunk = steal ? --worker->tail : worker->head++;
+    taken = true;
+  }
+
+  SDL_AtomicUnlock(&worker->lock);
+  return taken;
+}
+
+static void Jobs_Run(u32 index)
+{
+  u32 chunk;
+
+  while (true)
+  {
+    bool taken = Jobs_Take(&gJobs.workers[index], false, &chunk);
+
+    for (u32 i=1;i < gJobs.workerCount && taken == false;i++)
+    {
+      taken = Jobs_Take(&gJobs.workers[(index + i) % gJobs.workerCount], true, &chunk);
+    }
+
+    if (taken == false)
+      return;
+
+    u32 begin = chunk * gJobs.grain;
+    u32 end = begin + gJobs.grain;
+
+    if (end > gJobs.count)
+      end = gJobs.count;
+
+    gJobs.fn(begin, end, index, gJobs.user);
+
+    if (SDL_AtomicAdd(&gJobs.pending, -1) == 1)
+    {
+      SDL_SemPost(gJobs.done);
+    }
+  }
+}
+
+static int Jobs_Worker(void* data)
+{
+  u32 index = (u32) (uintptr_t) data;
+
+  while (true)
+  {
+    SDL_SemWait(gJobs.workers[index].start);
+
+    if (SDL_AtomicGet(&gJobs.quit))
+      break;
+
+    RETRO_ZONE_BEGIN(Jobs_Worker);
+    Jobs_Run(index);
+    RETRO_ZONE_END(Jobs_Worker);
+  }
+
+  return 0;
+}
+
+void  Jobs_Init(u32 threadCount)
+{
+  memset(&gJobs, 0, sizeof(gJobs));
+
+#ifdef RETRO_BROWSER
+  threadCount = 1;
+#endif
+
+  if (threadCount == 0)
+    threadCount = SDL_GetCPUCount();
+
+  if (threadCount > RETRO_JOB_MAX_THREADS)
+    threadCount = RETRO_JOB_MAX_THREADS;
+  else if (threadCount < 1)
+    threadCount = 1;
+
+  gJobs.workerCount = 1;
+
+  if (threadCount == 1)
+    return;
+
+  gJobs.done = SDL_CreateSemaphore(0);
+
+  for (u32 i=1;i < threadCount;i++)
+  {
+    JobWorker* worker = &gJobs.workers[i];
+    worker->start = SDL_CreateSemaphore(0);
+    worker->thread = SDL_CreateThread(Jobs_Worker, "Jobs_Worker", (void*) (uintptr_t) i);
+
+    if (worker->thread == NULL)
+    {
+      printf("Jobs Error: %s\n", SDL_GetError());
+      SDL_DestroySemaphore(worker->start);
+      worker->start = NULL;
+      break;
+    }
+
+    gJobs.workerCount++;
+  }
+}
+
+void  Jobs_Shutdown()
+{
+  SDL_AtomicSet(&gJobs.quit, 1);
+
+  for (u32 i=1;i < gJobs.workerCount;i++)
+  {
+    JobWorker* worker = &gJobs.workers[i];
+    SDL_SemPost(worker->start);
+    SDL_WaitThread(worker->thread, NULL);
+    SDL_DestroySemaphore(worker->start);
+  }
+
+  if (gJobs.done != NULL)
+  {
+    SDL_DestroySemaphore(gJobs.done);
+  }
+
+  memset(&gJobs, 0, sizeof(gJobs));
+}
+
+u32   Jobs_GetWorkerCount()
+{
+  return gJobs.workerCount > 0 ? gJobs.workerCount : 1;
+}
+
+void  Jobs_ParallelFor(u32 count, u32 grain, JobFunction fn, void* user)
+{
+  if (grain == 0)
+    grain = 1;
+
+  u32 chunks = (count + grain - 1) / grain;
+
+  if (gJobs.workerCount <= 1 || chunks <= 1)
+  {
+    for (u32 begin=0;begin < count;begin += grain)
+    {
+      fn(begin, begin + grain < count ? begin + grain : count, 0, user);
+    }
+    return;
+  }
+
+  gJobs.fn = fn;
+  gJobs.user = user;
+  gJobs.count = count;
+  gJobs.grain = grain;
+  SDL_AtomicSet(&gJobs.pending, chunks);
+
+  // Contiguous runs of chunks per worker, so stealing is only needed when the work is uneven.
+  for (u32 i=0;i < gJobs.workerCount;i++)
+  {
+    JobWorker* worker = &gJobs.workers[i];
+    SDL_AtomicLock(&worker->lock);
+    worker->head = (chunks * i) / gJobs.workerCount;
+    worker->tail = (chunks * (i + 1)) / gJobs.workerCount;
+    SDL_AtomicUnlock(&worker->lock);
+  }
+
+  for (u32 i=1;i < gJobs.workerCount;i++)
+  {
+    SDL_SemPost(gJobs.workers[i].start);
+  }
+
+  Jobs_Run(0);
+
+  SDL_SemWait(gJobs.done);
+}
+
+void  Canvas_Debug(Font* font)
+{
+  assert(font);
+  RetroFourByteUnion f;
+  f.q = Scope_GetName();
+  
+  VoiceStats voices;
+  Sound_GetVoiceStats(&voices);
+
+  AudioRingStats ring;
+  Sound_GetRingStats(&ring);
+
+  int music = -1;
+
+  if (gMusicContext != NULL)
+  {
+    music = (int) 100 - (((float) gMusicContext->samples_remaining / (float) gMusicContext->length) *100.0f);
+  }
+
+  Canvas_PrintF(0, Canvas_GetHeight() - font->height, font, 1, "Scope=%c%c%c%c Mem=%i%% FPS=%.2g Dt=%i Snd=%u/%u/%u Aud=%u/%u/%u, Mus=%i Bat=%u/%u Txt=%u/%u/%u", f.b[3], f.b[2], f.b[1], f.b[0], Arena_PctSize(), gFps, gDeltaTime, voices.playing, voices.steals, voices.drops, ring.fill, ring.lowest, ring.underruns, music, gBatchLastFlushes, gBatchLastQuads, gTextCache.hits, gTextCache.misses, gTextCache.notAdmitted);
+
+  if (gProfiler.overlay)
+  {
+    for (u32 i=0;i < PP_COUNT;i++)
+    {
+      ProfileRollup rollup;
+      Profiler_Rollup(i, &rollup);
+      Canvas_PrintF(0, i * (font->height + 1), font, 1, "%-8s MIN %.2f AVG %.2f MAX %.2f P99 %.2f", kProfilePhaseNames[i], rollup.min, rollup.mean, rollup.max, rollup.p99);
+    }
+  }
+}
+
+void  Sound_Load(Sound* sound, const char* name)
+{
+  Sound_SetLimits(sound, RETRO_SOUND_DEFAULT_PRIORITY, RETRO_SOUND_DEFAULT_MAX_INSTANCES);
+
+  #ifdef RETRO_WINDOWS
+  u32 resourceSize = 0;
+  void* resource = Resource_Load(name, &resourceSize);
+  SDL_LoadWAV_RW(SDL_RWFromConstMem(resource, resourceSize), 0, &sound->spec, &sound->buffer, &sound->length);
+  #elif defined(RETRO_FILESYSTEM)
+  RETRO_MAKE_ASSET_PATH(name);
+  SDL_LoadWAV(RETRO_ASSET_PATH, &sound->spec, &sound->buffer, &sound->length);
+  #endif
+
+  // The mixer works in S16 whatever the device format is.
+  if (sound->spec.format != AUDIO_S16SYS || sound->spec.freq != gSoundDevice.specification.freq || sound->spec.channels != gSoundDevice.specification.channels)
+  {
+    // Do a conversion
+    SDL_AudioCVT cvt;
+    SDL_BuildAudioCVT(&cvt, sound->spec.format, sound->spec.channels, sound->spec.freq, AUDIO_S16SYS, gSoundDevice.specification.channels, gSoundDevice.specification.freq);
+
+    cvt.buf = malloc(sound->length * cvt.len_mult);
+    memcpy(cvt.buf, sound->buffer, sound->length);
+    cvt.len = sound->length;
+    SDL_ConvertAudio(&cvt);
+    SDL_FreeWAV(sound->buffer);
+
+    sound->buffer = cvt.buf;
+    sound->length = cvt.len_cvt;
+    sound->spec = gSoundDevice.specification;
+    sound->spec.format = AUDIO_S16SYS;
+
+    // printf("Loaded Audio %s but had to convert it into a internal format.\n", name);
+  }
+  else
+  {
+   // printf("Loaded Audio %s\n", name);
+  }
+
+}
+
+static void Audio_Queue(u8 type, Sound* sound, u8 volume)
+{
+  AudioCommandQueue* queue = &gAudioCommands;
+  int tail = SDL_AtomicGet(&queue->tail);
+
+  if ((u32) (tail - SDL_AtomicGet(&queue->head)) >= RETRO_AUDIO_COMMAND_COUNT)
+  {
+    queue->dropped++;
+    return;
+  }
+
+  AudioCommand* command = &queue->commands[tail & (RETRO_AUDIO_COMMAND_COUNT - 1)];
+  command->type = type;
+  command->sound = sound;
+  command->volume = volume > SDL_MIX_MAXVOLUME ? SDL_MIX_MAXVOLUME : volume;
+
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&queue->tail, tail + 1);
+}
+
+// Audio thread only. Voices further along count as older.
+static SoundObject* Audio_AllocateVoice(Sound* sound)
+{
+  SoundObject* empty = NULL;
+  SoundObject* oldestOfSound = NULL;
+  SoundObject* victim = NULL;
+  u32 instances = 0;
+
+  for(u32 i=0;i < RETRO_MAX_SOUND_OBJECTS;i++)
+  {
+    SoundObject* soundObj = &gSoundObject[i];
+
+    if (soundObj->sound == NULL)
+    {
+      if (empty == NULL)
+        empty = soundObj;
+      continue;
+    }
+
+    if (soundObj->sound == sound)
+    {
+      instances++;
+      if (oldestOfSound == NULL || soundObj->p > oldestOfSound->p)
+        oldestOfSound = soundObj;
+    }
+
+    if (victim == NULL || soundObj->sound->priority < victim->sound->priority || (soundObj->sound->priority == victim->sound->priority && soundObj->p > victim->p))
+      victim = soundObj;
+  }
+
+  if (oldestOfSound != NULL && instances >= sound->maxInstances)
+  {
+    SDL_AtomicAdd(&gAudioCommands.steals, 1);
+    return oldestOfSound;
+  }
+
+  if (empty != NULL)
+    return empty;
+
+  if (victim != NULL && victim->sound->priority <= sound->priority)
+  {
+    SDL_AtomicAdd(&gAudioCommands.steals, 1);
+    return victim;
+  }
+
+  SDL_AtomicAdd(&gAudioCommands.drops, 1);
+  return NULL;
+}
+
+// Audio thread only.
+static void Audio_ApplyCommands()
+{
+  AudioCommandQueue* queue = &gAudioCommands;
+  int head = SDL_AtomicGet(&queue->head);
+  int tail = SDL_AtomicGet(&queue->tail);
+  SDL_MemoryBarrierAcquire();
+
+  for (; head != tail; head++)
+  {
+    AudioCommand* command = &queue->commands[head & (RETRO_AUDIO_COMMAND_COUNT - 1)];
+
+    switch (command->type)
+    {
+      case AC_Play:
+      {
+        SoundObject* soundObj = Audio_AllocateVoice(command->sound);
+        if (soundObj != NULL)
+        {
+          soundObj->sound = command->sound;
+          soundObj->p = 0;
+          soundObj->volume = command->volume;
+        }
+      }
+      break;
+      case AC_Stop:
+      case AC_Volume:
+      {
+        for(u32 i=0;i < RETRO_MAX_SOUND_OBJECTS;i++)
+        {
+          SoundObject* soundObj = &gSoundObject[i];
+          if (soundObj->sound == NULL || (command->sound != NULL && soundObj->sound != command->sound))
+            continue;
+
+          if (command->type == AC_Volume)
+          {
+            soundObj->volume = command->volume;
+            continue;
+          }
+
+          soundObj->sound = NULL;
+          soundObj->p = 0;
+          soundObj->volume = 0;
+        }
+      }
+      break;
+      case AC_MusicPauseToggle:
+      {
+        gMusicPaused = !gMusicPaused;
+      }
+      break;
+    }
+  }
+
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&queue->head, head);
+}
+
+void  Sound_Play(Sound* sound, u8 volume)
 {
-  return gCanvasSize.h;
+  Audio_Queue(AC_Play, sound, volume);
 }
 
-void Canvas_Set(u8 id)
+void  Sound_Stop(Sound* sound)
 {
-  assert(id < RETRO_CANVAS_COUNT);
-  gCanvasTexture = gCanvasTextures[id];
-  SDL_SetRenderTarget(gRenderer, gCanvasTexture);
+  if (sound != NULL)
+  {
+    Audio_Queue(AC_Stop, sound, 0);
+  }
 }
 
-void Canvas_SetFlags(u8 id, u8 flags, u8 colour)
+void  Sound_SetVolume(Sound* sound, u8 volume)
 {
-  assert(id < RETRO_CANVAS_COUNT);
+  Audio_Queue(AC_Volume, sound, volume);
+}
 
-  gCanvasFlags[id] = flags;
-  gCanvasBackgroundColour[id] = colour;
+void  Sound_Clear()
+{
+  Audio_Queue(AC_Stop, NULL, 0);
+}
 
-  if (flags & CNF_Blend)
-    SDL_SetTextureBlendMode(gCanvasTextures[id], SDL_BLENDMODE_BLEND);
+void  Sound_SetLimits(Sound* sound, u8 priority, u8 maxInstances)
+{
+  sound->priority = priority;
+  sound->maxInstances = maxInstances > 0 ? maxInstances : 1;
+}
+
+void  Sound_GetVoiceStats(VoiceStats* outStats)
+{
+  outStats->playing = SDL_AtomicGet(&gSoundObjectsPlaying);
+  outStats->drops = SDL_AtomicGet(&gAudioCommands.drops);
+  outStats->steals = SDL_AtomicGet(&gAudioCommands.steals);
+  outStats->droppedCommands = gAudioCommands.dropped;
+}
+
+static void Audio_Lock()
+{
+  if (gAudioRing.thread != NULL)
+    SDL_LockMutex(gAudioRing.lock);
   else
-    SDL_SetTextureBlendMode(gCanvasTextures[id], SDL_BLENDMODE_NONE);
+    SDL_LockAudio();
+}
+
+static void Audio_Unlock()
+{
+  if (gAudioRing.thread != NULL)
+    SDL_UnlockMutex(gAudioRing.lock);
+  else
+    SDL_UnlockAudio();
+}
+
+static u32 MusicCache_Hash(const u8* data, u32 length)
+{
+  u32 hash = 2166136261u;
+
+  for (u32 i=0;i < length;i++)
+    hash = (hash ^ data[i]) * 16777619u;
 
+  return hash;
 }
 
-void Canvas_Splat(Bitmap* bitmap, i32 x, i32 y, Rect* srcRectangle)
+static int MusicCache_Render(void* data)
 {
-  SDL_Rect src, dst;
-  SDL_Texture* texture = (SDL_Texture*) bitmap->texture;
+  MusicCache* cache = (MusicCache*) data;
 
-  if (srcRectangle == NULL)
+  // Its own filter state; micromod itself belongs to this thread until the song is done.
+  micromod_sdl_context* context = malloc(sizeof(micromod_sdl_context));
+  memset(context, 0, sizeof(micromod_sdl_context));
+
+  u32 done = 0;
+
+  while (done < cache->length && SDL_AtomicGet(&cache->cancel) == 0)
   {
-    src.x = 0;
-    src.y = 0;
-    src.w = bitmap->w;
-    src.h = bitmap->h;
+    u32 count = cache->length - done;
+
+    if (count > RETRO_MIX_CHUNK)
+      count = RETRO_MIX_CHUNK;
+
+    memset( context->mix_buffer, 0, count * NUM_CHANNELS * sizeof( short ) );
+    micromod_get_audio( context->mix_buffer, count );
+    micromod_sdl_downsample( context, context->mix_buffer, cache->samples + done, count, 4);
+
+    done += count;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&cache->rendered, done);
   }
-  else
+
+  free(context);
+
+#ifdef RETRO_FILESYSTEM
+  if (done < cache->length)
+    return 0;
+
+  FILE* f = fopen(cache->path, "wb");
+
+  if (f == NULL)
   {
-    src.x = srcRectangle->left;
-    src.y = Rect_GetWidth(srcRectangle);
-    src.w = srcRectangle->top;
-    src.h = Rect_GetHeight(srcRectangle);
+    printf("Music Cache Error: Cannot write %s\n", cache->path);
+    return 0;
   }
 
-  dst.x = x;
-  dst.y = y;
-  dst.w = src.w;
-  dst.h = src.h;
+  MusicCacheHeader header;
+  header.magic = RETRO_MUSIC_CACHE_MAGIC;
+  header.version = RETRO_MUSIC_CACHE_VERSION;
+  header.moduleHash = cache->moduleHash;
+  header.moduleSize = cache->moduleSize;
+  header.frequency = SAMPLING_FREQ;
+  header.channels = NUM_CHANNELS;
+  header.length = cache->length;
+
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(cache->samples, sizeof(i16), cache->length, f);
+  fclose(f);
+#endif
 
-  SDL_RenderCopy(gRenderer, texture, &src, &dst);
+  return 0;
 }
 
-void  Canvas_Splat2(Bitmap* bitmap, i32 x, i32 y, SDL_Rect* srcRectangle)
+#ifdef RETRO_FILESYSTEM
+
+// A file that is short, or was written for another module or rate, is ignored and rendered over.
+static bool MusicCache_Valid(MusicCache* cache, MusicCacheHeader* header, u32 size)
 {
-  assert(srcRectangle);
+  return header->magic == RETRO_MUSIC_CACHE_MAGIC
+      && header->version == RETRO_MUSIC_CACHE_VERSION
+      && header->moduleHash == cache->moduleHash
+      && header->moduleSize == cache->moduleSize
+      && header->frequency == SAMPLING_FREQ
+      && header->channels == NUM_CHANNELS
+      && size == sizeof(MusicCacheHeader) + header->length * sizeof(i16);
+}
 
-  SDL_Rect dst;
-  SDL_Texture* texture = (SDL_Texture*) bitmap->texture;
+static bool MusicCache_Load(MusicCache* cache)
+{
+  MusicCacheHeader header;
 
-  dst.x = x;
-  dst.y = y;
-  dst.w = srcRectangle->w;
-  dst.h = srcRectangle->h;
+#ifdef RETRO_LINUX
+  int fd = open(cache->path, O_RDONLY);
 
-  SDL_RenderCopy(gRenderer, texture, srcRectangle, &dst);
-}
+  if (fd < 0)
+    return false;
 
-void  Canvas_Splat3(Bitmap* bitmap, SDL_Rect* dstRectangle, SDL_Rect* srcRectangle)
-{
-  assert(srcRectangle);
+  struct stat st;
 
-  SDL_Texture* texture = (SDL_Texture*) bitmap->texture;
-  SDL_RenderCopy(gRenderer, texture, srcRectangle, dstRectangle);
-}
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(header))
+  {
+    close(fd);
+    return false;
+  }
 
-void  Canvas_Splat3Colour(Bitmap* bitmap, SDL_Rect* dstRectangle, SDL_Rect* srcRectangle, u8 r, u8 g, u8 b)
-{
-  SDL_Texture* texture = (SDL_Texture*)bitmap->texture;
-  RETRO_SDL_TEXTURE_PUSH_RGB2(t, texture, r, g, b);
+  void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
 
-  SDL_RenderCopy(gRenderer, texture, srcRectangle, dstRectangle);
+  if (mapping == MAP_FAILED)
+    return false;
 
-  RETRO_SDL_TEXTURE_POP_RGB(t, texture);
-}
+  memcpy(&header, mapping, sizeof(header));
 
-void Canvas_SplatFlip(Bitmap* bitmap, SDL_Rect* dstRectangle, SDL_Rect* srcRectangle, u8 flipFlags)
-{
-  assert(srcRectangle);
+  if (MusicCache_Valid(cache, &header, st.st_size) == false)
+  {
+    munmap(mapping, st.st_size);
+    return false;
+  }
 
-  SDL_Texture* texture = (SDL_Texture*) bitmap->texture;
-  SDL_RenderCopyEx(gRenderer, texture, srcRectangle, dstRectangle, 0.0f, NULL, flipFlags);
+  cache->mapping = mapping;
+  cache->mappingSize = st.st_size;
+  cache->samples = (i16*) ((u8*) mapping + sizeof(header));
+#else
+  FILE* f = fopen(cache->path, "rb");
+
+  if (f == NULL)
+    return false;
+
+  fseek(f, 0, SEEK_END);
+  u32 size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  if (size < sizeof(header) || fread(&header, sizeof(header), 1, f) != 1 || MusicCache_Valid(cache, &header, size) == false)
+  {
+    fclose(f);
+    return false;
+  }
+
+  cache->samples = malloc(header.length * sizeof(i16));
+  fread(cache->samples, sizeof(i16), header.length, f);
+  fclose(f);
+#endif
+
+  cache->length = header.length;
+  SDL_AtomicSet(&cache->rendered, header.length);
+  return true;
 }
 
-void Canvas_SplatFlipColour(Bitmap* bitmap, SDL_Rect* dstRectangle, SDL_Rect* srcRectangle, u8 flipFlags, u8 r, u8 g, u8 b)
+#endif
+
+static void MusicCache_Free(MusicCache* cache)
 {
-  assert(srcRectangle);
+#ifdef RETRO_LINUX
+  if (cache->mapping != NULL)
+    munmap(cache->mapping, cache->mappingSize);
+  else
+#endif
+    free(cache->samples);
 
-  SDL_Texture* texture = (SDL_Texture*)bitmap->texture;
-  RETRO_SDL_TEXTURE_PUSH_RGB2(t, texture, r, g, b);
-  SDL_RenderCopyEx(gRenderer, texture, srcRectangle, dstRectangle, 0.0f, NULL, flipFlags);
-  RETRO_SDL_TEXTURE_POP_RGB(t, texture);
+  memset(cache, 0, sizeof(MusicCache));
 }
 
-void Canvas_Place(StaticSpriteObject* spriteObject)
+// Loading and stopping music swap the whole module under the mixer, so they lock it instead of
+// queueing. They only happen between levels.
+//
+// With the music cache the module is only played by the render thread, or not at all when the
+// song is already on disk.
+void Music_Play(const char* name)
 {
-  assert(spriteObject);
-  Sprite* sprite = SpriteHandle_Get(spriteObject->spriteHandle);
+  if (gMusicContext != NULL)
+  {
+    Music_Stop();
+  }
 
-  Canvas_Splat2(sprite->bitmap, spriteObject->x, spriteObject->y, &sprite->rect);
+  micromod_sdl_context* context = malloc(sizeof(micromod_sdl_context));
+  memset(context, 0, sizeof(micromod_sdl_context));
+
+  void* data = NULL;
+  u32 dataLength = 0;
+
+#ifdef RETRO_WINDOWS
+  data = Resource_Load(name, &dataLength);
+#endif
+
+#ifdef RETRO_FILESYSTEM
+  RETRO_MAKE_ASSET_PATH(name);
+  FILE* f = fopen(RETRO_ASSET_PATH, "rb");
+  assert(f);
+  fseek(f, 0, SEEK_END);
+  dataLength = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  gMusicFileData = malloc(dataLength);
+  fread(gMusicFileData, dataLength, 1, f);
+  fclose(f);
+
+  data = gMusicFileData;
+#endif
+
+  bool cached = false;
+
+  if (gMusicCacheEnabled)
+  {
+    gMusicCache.moduleHash = MusicCache_Hash(data, dataLength);
+    gMusicCache.moduleSize = dataLength;
+
+#ifdef RETRO_FILESYSTEM
+    snprintf(gMusicCache.path, sizeof(gMusicCache.path), "%s.pcm", RETRO_ASSET_PATH);
+    cached = MusicCache_Load(&gMusicCache);
+#endif
+  }
+
+  Audio_Lock();
+
+  if (cached)
+  {
+    context->samples_remaining = gMusicCache.length;
+  }
+  else
+  {
+    micromod_initialise(data, SAMPLING_FREQ * OVERSAMPLE);
+    context->samples_remaining = micromod_calculate_song_duration();
+
+    if (gMusicCacheEnabled)
+    {
+      gMusicCache.length = context->samples_remaining;
+      gMusicCache.samples = malloc(gMusicCache.length * sizeof(i16));
+    }
+  }
+
+  context->length = context->samples_remaining;
+
+  gMusicContext = context;
+  gMusicPaused = false;
+
+  Audio_Unlock();
+
+  if (gMusicCacheEnabled && cached == false)
+  {
+    gMusicCache.thread = SDL_CreateThread(MusicCache_Render, "MusicCache_Render", &gMusicCache);
+
+    if (gMusicCache.thread == NULL)
+    {
+      printf("Music Cache Error: %s\n", SDL_GetError());
+
+      // Nothing has touched micromod since, so it can play from the start.
+      Audio_Lock();
+      MusicCache_Free(&gMusicCache);
+      Audio_Unlock();
+    }
+  }
 }
 
-void Canvas_Place2(Sprite* sprite, i32 x, i32 y)
+void Music_PauseToggle()
 {
-  assert(sprite);
-  Canvas_Splat2(sprite->bitmap, x, y, &sprite->rect);
+
+  if (gMusicContext == NULL)
+  {
+    return;
+  }
+
+  Audio_Queue(AC_MusicPauseToggle, NULL, 0);
 }
 
-void Canvas_PlaceAnimated(AnimatedSpriteObject* spriteObject, bool updateTiming)
+void Music_Stop()
 {
-  Animation* animation = AnimationHandle_Get(spriteObject->animationHandle);
+  if (gMusicContext == NULL)
+  {
+    return;
+  }
 
-  if (updateTiming && (spriteObject->flags & SOF_Animation) != 0)
+  if (gMusicCache.thread != NULL)
   {
-    spriteObject->frameTime += gDeltaTime;
+    SDL_AtomicSet(&gMusicCache.cancel, 1);
+    SDL_WaitThread(gMusicCache.thread, NULL);
+  }
 
-    if (spriteObject->frameTime >= 1000)
-      spriteObject->frameTime = 0; // Prevent spiral out of control.
+  Audio_Lock();
+  micromod_sdl_context* context = gMusicContext;
+  gMusicContext = NULL;
+  Audio_Unlock();
 
+  MusicCache_Free(&gMusicCache);
 
-    while(spriteObject->frameTime > animation->frameLength)
-    {
-      spriteObject->frameNumber++;
-      spriteObject->frameTime -= animation->frameLength;
+  #if defined(RETRO_FILESYSTEM)
+    free(gMusicFileData);
+    gMusicFileData = NULL;
+  #endif
 
-      if (spriteObject->frameNumber >= animation->frameCount)
-      {
-        if (spriteObject->flags & SOF_AnimationOnce)
-        {
-          spriteObject->flags &= ~SOF_Animation;
-          spriteObject->frameNumber = animation->frameCount - 1; // Stop
-          break;
-        }
-        else
-        {
-          spriteObject->frameNumber = 0; // Loop around.
-        }
-      }
-    }
+  free(context);
+}
+
+// acc += in * gain. Gains are 0 to SDL_MIX_MAXVOLUME, so a voice adds at most 2^22 and the
+// accumulator has room for hundreds of voices.
+static void Mix_Add(i32* acc, const i16* in, u32 count, i32 gain)
+{
+  u32 i = 0;
+
+#if defined(RETRO_MIX_AVX2)
+  __m256i g = _mm256_set1_epi32(gain);
+
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256i samples = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (in + i)));
+    __m256i sum = _mm256_loadu_si256((const __m256i*) (acc + i));
+    _mm256_storeu_si256((__m256i*) (acc + i), _mm256_add_epi32(sum, _mm256_mullo_epi32(samples, g)));
+  }
+#elif defined(RETRO_MIX_SSE2)
+  // The low and high halves of the 16x16 products, interleaved, are the 32-bit products.
+  __m128i g = _mm_set1_epi16((i16) gain);
+
+  for (; i + 8 <= count; i += 8)
+  {
+    __m128i samples = _mm_loadu_si128((const __m128i*) (in + i));
+    __m128i lo = _mm_mullo_epi16(samples, g);
+    __m128i hi = _mm_mulhi_epi16(samples, g);
+    __m128i sum0 = _mm_loadu_si128((const __m128i*) (acc + i));
+    __m128i sum1 = _mm_loadu_si128((const __m128i*) (acc + i + 4));
+    _mm_storeu_si128((__m128i*) (acc + i),     _mm_add_epi32(sum0, _mm_unpacklo_epi16(lo, hi)));
+    _mm_storeu_si128((__m128i*) (acc + i + 4), _mm_add_epi32(sum1, _mm_unpackhi_epi16(lo, hi)));
   }
+#endif
 
-  assert(spriteObject->frameNumber < animation->frameCount);
-  Canvas_PlaceAnimated2(animation, spriteObject->x, spriteObject->y, spriteObject->frameNumber, spriteObject->flags & FF_Mask);
+  for (; i < count; i++)
+    acc[i] += in[i] * gain;
 }
 
-void Canvas_PlaceAnimated2(Animation* animatedSprite, i32 x, i32 y, u8 frame, u8 flipFlags)
+// The only place the mix is saturated.
+static void Mix_Output(u8* stream, const i32* acc, u32 count, SDL_AudioFormat format)
 {
-  assert(animatedSprite);
-  assert(frame < animatedSprite->frameCount);
-  SDL_Rect src = animatedSprite->frames[frame];
-  SDL_Rect dst;
-  dst.x = x;
-  dst.y = y;
-  dst.w = src.w;
-  dst.h = src.h;
-  Canvas_SplatFlip(animatedSprite->bitmap, &dst, &src, flipFlags & FF_Mask);
-}
+  u32 i = 0;
 
-void Canvas_PlaceScaled(Sprite* sprite, u32 x, u32 y, u32 scale)
-{
-  assert(sprite);
-  SDL_Rect dst;
-  dst.x = x;
-  dst.y = y;
-  dst.w = sprite->rect.w * scale;
-  dst.h = sprite->rect.h * scale;
+  if (format == AUDIO_F32)
+  {
+    f32* out = (f32*) stream;
+    const f32 scale = 1.0f / (SDL_MIX_MAXVOLUME * 32768.0f);
 
-  Canvas_Splat3(sprite->bitmap, &dst, &sprite->rect);
-}
+#if defined(RETRO_MIX_SSE2)
+    __m128 s = _mm_set1_ps(scale), lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
 
-void Canvas_PlaceScaledF(Sprite* sprite, u32 x, u32 y, float scale)
-{
-  assert(sprite);
-  SDL_Rect dst;
-  dst.x = x;
-  dst.y = y;
-  dst.w = sprite->rect.w * scale;
-  dst.h = sprite->rect.h * scale;
+    for (; i + 4 <= count; i += 4)
+    {
+      __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*) (acc + i))), s);
+      _mm_storeu_ps(out + i, _mm_min_ps(_mm_max_ps(x, lo), hi));
+    }
+#endif
 
-  Canvas_Splat3(sprite->bitmap, &dst, &sprite->rect);
-}
+    for (; i < count; i++)
+    {
+      f32 x = acc[i] * scale;
+      out[i] = x < -1.0f ? -1.0f : (x > 1.0f ? 1.0f : x);
+    }
+  }
+  else
+  {
+    i16* out = (i16*) stream;
 
-void Canvas_Flip()
-{
-  SDL_RenderPresent(gRenderer);
-}
+#if defined(RETRO_MIX_SSE2)
+    for (; i + 8 <= count; i += 8)
+    {
+      __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i*) (acc + i)), 7);
+      __m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i*) (acc + i + 4)), 7);
+      _mm_storeu_si128((__m128i*) (out + i), _mm_packs_epi32(a, b));
+    }
+#endif
 
-void Canvas_Clear()
-{
-  SDL_RenderClear(gRenderer);
+    for (; i < count; i++)
+    {
+      i32 x = acc[i] >> 7;
+      out[i] = (i16) (x < -32768 ? -32768 : (x > 32767 ? 32767 : x));
+    }
+  }
 }
 
-void  Palette_Make(Palette* palette)
+// Renders count samples of the music into out, or returns false when there are none this time.
+static bool Mix_Music(i16* out, u32 count)
 {
-  assert(palette);
-  palette->count = 0;
-  palette->fallback = 1;
-  palette->transparent = 0;
-}
+  if (gMusicContext == NULL || gMusicPaused)
+    return false;
 
-void  Palette_Add(Palette* palette, Colour colour)
-{
-  assert(palette);
-  assert(palette->count <= 255);
-  palette->colours[palette->count] = colour;
-  ++palette->count;
-}
+  long remaining = gMusicContext->samples_remaining;
 
-void Palette_AddRGBInt(Palette* palette, u32 rgb)
-{
-  RetroFourByteUnion c;
-  c.q = rgb;
-  
-  Palette_Add(palette, Colour_Make(c.b[2], c.b[1], c.b[0]));
-}
+  if (remaining <= 0)
+  {
+    // Loop on the next buffer.
+    gMusicContext->samples_remaining = gMusicContext->length;
+    return false;
+  }
 
-u8 Palette_FindColour(Palette* palette, Colour colour)
-{
-  assert(palette);
+  long rendered = (long) count < remaining ? (long) count : remaining;
 
-  for(int i=0;i < palette->count;++i)
+  if (gMusicCache.samples != NULL)
   {
-    Colour t = palette->colours[i];
-    if (t.r == colour.r && t.g == colour.g && t.b == colour.b)
-      return i;
+    u32 position = gMusicContext->length - remaining;
+
+    // Still rendering; hold the position rather than skip.
+    if (position + rendered > (u32) SDL_AtomicGet(&gMusicCache.rendered))
+      return false;
+
+    SDL_MemoryBarrierAcquire();
+    memcpy(out, gMusicCache.samples + position, rendered * sizeof(i16));
   }
-  return palette->fallback;
+  else
+  {
+    memset( gMusicContext->mix_buffer, 0, rendered * NUM_CHANNELS * sizeof( short ) );
+    micromod_get_audio( gMusicContext->mix_buffer, rendered );
+    micromod_sdl_downsample( gMusicContext, gMusicContext->mix_buffer, out, rendered, 4);
+  }
+
+  if (rendered < (long) count)
+    memset(out + rendered, 0, (count - rendered) * sizeof(i16));
+
+  gMusicContext->samples_remaining -= rendered;
+  return true;
 }
 
-bool Palette_HasColour(Palette* palette, Colour colour)
+// The music and every voice are summed into a 32-bit accumulator, RETRO_MIX_CHUNK samples at a
+// time, with their own gain. Sounds are all loaded as S16, whatever the device format.
+void Retro_MixSoundObjects(u8* stream, int streamLength)
 {
-  assert(palette);
+  i32* acc = gMixAccumulator;
+  i16* music = gMixMusic;
 
-  for(int i=0;i < palette->count;++i)
+  SDL_AudioFormat format = gSoundDevice.specification.format;
+  u32 sampleSize = (format == AUDIO_F32) ? sizeof(f32) : sizeof(i16);
+  u32 total = streamLength / sampleSize;
+  u32 playing = 0;
+
+  for (u32 begin = 0; begin < total; begin += RETRO_MIX_CHUNK)
   {
-    Colour t = palette->colours[i];
-    if (t.r == colour.r && t.g == colour.g && t.b == colour.b)
-      return true;
+    u32 count = total - begin < RETRO_MIX_CHUNK ? total - begin : RETRO_MIX_CHUNK;
+
+    memset(acc, 0, count * sizeof(i32));
+
+    if (Mix_Music(music, count))
+    {
+      Mix_Add(acc, music, count, SDL_MIX_MAXVOLUME);
+    }
+
+    playing = 0;
+
+    for(u32 i=0;i < RETRO_MAX_SOUND_OBJECTS;i++)
+    {
+      SoundObject* soundObj = &gSoundObject[i];
+
+      if (soundObj->sound == NULL)
+        continue;
+
+      playing++;
+
+      u32 available = (soundObj->sound->length - soundObj->p) / sizeof(i16);
+      u32 mixCount = available < count ? available : count;
+
+      Mix_Add(acc, (const i16*) (soundObj->sound->buffer + soundObj->p), mixCount, soundObj->volume);
+
+      soundObj->p += mixCount * sizeof(i16);
+
+      if (soundObj->p >= (i32) soundObj->sound->length)
+      {
+        // Finished
+        soundObj->sound = NULL;
+        soundObj->p = 0;
+        soundObj->volume = 0;
+      }
+    }
+
+    Mix_Output(stream + begin * sampleSize, acc, count, format);
   }
-  return false;
+
+  SDL_AtomicSet(&gSoundObjectsPlaying, playing);
 }
 
-void Palette_CopyTo(const Palette* src, Palette* dst)
+// Tops the ring up to `ahead` frames whenever the callback has taken some.
+static int Audio_RenderThread(void* data)
 {
-  assert(src);
-  assert(dst);
+  AudioRing* ring = &gAudioRing;
+  const u32 mask = RETRO_AUDIO_RING_SAMPLES - 1;
 
-  dst->count = src->count;
-  dst->fallback = src->fallback;
-  dst->transparent = src->transparent;
-  memcpy(dst->colours, src->colours, sizeof(src->colours));
-}
+  while (SDL_AtomicGet(&ring->quit) == 0)
+  {
+    u32 tail = (u32) SDL_AtomicGet(&ring->tail);
+    u32 fill = tail - (u32) SDL_AtomicGet(&ring->head);
 
-Colour Colour_Make(u8 r, u8 g, u8 b)
-{
-  Colour c;
-  c.r = r;
-  c.g = g;
-  c.b = b;
-  return c;
-}
+    if (fill >= ring->ahead)
+    {
+      SDL_SemWaitTimeout(ring->wake, 10);
+      continue;
+    }
 
-Colour Colour_ReadRGB(u8* p)
-{
-  Colour c;
-  c.r = *(p + 0);
-  c.g = *(p + 1);
-  c.b = *(p + 2);
-  return c;
-}
+    RETRO_ZONE_BEGIN(Audio_RenderThread);
 
-Size Size_Make(u32 w, u32 h)
-{
-  Size s;
-  s.w = w;
-  s.h = h;
-  return s;
-}
+    u32 count = ring->ahead - fill;
+    u32 offset = tail & mask;
+    u32 first = count < RETRO_AUDIO_RING_SAMPLES - offset ? count : RETRO_AUDIO_RING_SAMPLES - offset;
 
-u8* Arena_Obtain(u32 size)
-{
-  assert(gArena.current + size < gArena.end); // Ensure can fit.
-  u8* mem = gArena.current;
-  gArena.current += size;
-  memset(mem, 0, size);
-  return mem;
-}
+    SDL_LockMutex(ring->lock);
+    Audio_ApplyCommands();
+    Retro_MixSoundObjects(ring->buffer + offset * ring->frameSize, first * ring->frameSize);
 
-void Arena_RewindPtr(u8* mem)
-{
-  assert(mem >= gArena.begin);
-  assert(mem <= gArena.current);
-  gArena.current = mem;
-}
+    if (count > first)
+      Retro_MixSoundObjects(ring->buffer, (count - first) * ring->frameSize);
 
-void Arena_RewindU32(u32 offset)
-{
-  assert(offset < RETRO_ARENA_SIZE);
-  gArena.current = gArena.begin + offset;
-}
+    SDL_UnlockMutex(ring->lock);
 
-u32 Arena_Current()
-{
-  return gArena.current - gArena.begin;
-}
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&ring->tail, (int) (tail + count));
 
-int  Arena_PctSize()
-{
-  u32 used = (gArena.current - gArena.begin);
-  float pct = ((float) used / (float) RETRO_ARENA_SIZE);
-  return (int) (pct * 100.0f);
+    RETRO_ZONE_END(Audio_RenderThread);
+  }
+
+  return 0;
 }
 
-typedef struct
+static void Audio_StopRenderThread()
 {
-  u8   header[4];
-  u32  size;
-  u32  scopeStackIndex;
-  u32  musicSamples;
-  char musicName[32];
-} Retro_ArenaSave;
+  AudioRing* ring = &gAudioRing;
 
-void Arena_Save(const char* filename)
-{
-  u32 size;
-  u8* mem = Arena_SaveToMem(&size);
-  FILE* f = fopen(filename, "wb");
-  fwrite(mem, size, 1, f);
-  fclose(f);
-  free(mem);
-}
+  if (ring->thread != NULL)
+  {
+    SDL_AtomicSet(&ring->quit, 1);
+    SDL_SemPost(ring->wake);
+    SDL_WaitThread(ring->thread, NULL);
+  }
 
-void Arena_Load(const char* filename, bool loadMusic)
-{
-  FILE* f = fopen(filename, "rb");
-  fseek(f, 0, SEEK_END);
-  int size = ftell(f);
-  fseek(f, 0, SEEK_SET);
-  u8* mem = (u8*) malloc(size);
-  fread(mem, size, 1, f);
-  fclose(f);
+  if (ring->wake != NULL)
+    SDL_DestroySemaphore(ring->wake);
 
-  Arena_LoadFromMem(mem, loadMusic);
-  free(mem);
-}
+  if (ring->lock != NULL)
+    SDL_DestroyMutex(ring->lock);
 
-u8* Retro_SaveToMem(u8* mem, void* obj, u32 size)
-{
-  memcpy(mem, obj, size);
-  mem += size;
-  return mem;
+  free(ring->buffer);
+  memset(ring, 0, sizeof(AudioRing));
 }
 
-u8* Arena_SaveToMem(u32* outSize)
+// Must be before the device is unpaused. Without a thread the callback mixes by itself.
+static bool Audio_StartRenderThread()
 {
-  u32 memSize = sizeof(Retro_ArenaSave);
-  memSize += (gScopeStackIndex + 1) * sizeof(ScopeStack);
-  memSize += Arena_Current();
+  SDL_AudioSpec* spec = &gSoundDevice.specification;
+  AudioRing* ring = &gAudioRing;
 
-  *outSize = memSize;
+  memset(ring, 0, sizeof(AudioRing));
 
-  printf("Size = %i\n", memSize);
+  if (gAudioAhead == 0 || spec->channels == 0)
+    return false;
 
-  u8* mem = (u8*) malloc(memSize);
-  u8* p = mem;
+  // Less than a device buffer ahead would run out on every callback.
+  ring->ahead = gAudioAhead < spec->samples ? spec->samples : gAudioAhead;
 
-  Retro_ArenaSave s;
-  s.header[0] = 'R';
-  s.header[1] = 'E';
-  s.header[2] = 'T';
-  s.header[3] = 'R';
+  if (ring->ahead > RETRO_AUDIO_RING_SAMPLES)
+    ring->ahead = RETRO_AUDIO_RING_SAMPLES;
 
-  s.scopeStackIndex = gScopeStackIndex;
-  s.size = (gArena.current - gArena.begin);
-  
-  if (gMusicContext != NULL)
-    s.musicSamples = gMusicContext->samples_remaining;
-  else
-    s.musicSamples = 0;
+  ring->frameSize = spec->channels * (SDL_AUDIO_BITSIZE(spec->format) / 8);
+  ring->buffer = malloc(RETRO_AUDIO_RING_SAMPLES * ring->frameSize);
+  ring->wake = SDL_CreateSemaphore(0);
+  ring->lock = SDL_CreateMutex();
+  SDL_AtomicSet(&ring->lowest, (int) ring->ahead);
 
-  p = Retro_SaveToMem(p, &s, sizeof(Retro_ArenaSave));
+  ring->thread = SDL_CreateThread(Audio_RenderThread, "Audio_RenderThread", NULL);
 
-  for(u32 i=0;i < (s.scopeStackIndex + 1);i++)
+  if (ring->thread == NULL)
   {
-    //fwrite(&gScopeStack[i], sizeof(ScopeStack), 1,);
-    p = Retro_SaveToMem(p, &gScopeStack[i], sizeof(ScopeStack));
+    printf("Sound Init Error: %s\n", SDL_GetError());
+    Audio_StopRenderThread();
+    return false;
   }
 
-  p = Retro_SaveToMem(p, gArena.begin, s.size);
-  return mem;
+  return true;
+}
+
+// S16, or F32 when the device won't do S16.
+static bool Audio_Open(SDL_AudioSpec* want, SDL_AudioSpec* got)
+{
+  want->format = AUDIO_S16;
+
+  if (SDL_OpenAudio(want, got) == 0)
+    return true;
+
+  want->format = AUDIO_F32;
+
+  if (SDL_OpenAudio(want, got) == 0)
+    return true;
+
+  printf("Sound Init Error: %s\n", SDL_GetError());
+  memset(got, 0, sizeof(SDL_AudioSpec));
+  return false;
 }
 
-u8* Retro_ReadFromMem(u8* mem, void* obj, u32 size)
+void Sound_GetRingStats(AudioRingStats* outStats)
 {
-  memcpy(obj, mem, size);
-  mem += size;
-  return mem;
+  AudioRing* ring = &gAudioRing;
+  memset(outStats, 0, sizeof(AudioRingStats));
+
+  if (ring->thread == NULL)
+    return;
+
+  outStats->ahead = ring->ahead;
+  outStats->fill = (u32) SDL_AtomicGet(&ring->tail) - (u32) SDL_AtomicGet(&ring->head);
+  outStats->lowest = (u32) SDL_AtomicSet(&ring->lowest, (int) ring->ahead);
+  outStats->underruns = (u32) SDL_AtomicGet(&ring->underruns);
 }
 
-void Arena_LoadFromMem(u8* mem, bool loadMusic)
+static void Audio_ReadRing(u8* stream, u32 streamLength)
 {
-  u8* p = (u8*) mem;
-
-  Retro_ArenaSave l;
+  AudioRing* ring = &gAudioRing;
+  const u32 mask = RETRO_AUDIO_RING_SAMPLES - 1;
 
-  p = Retro_ReadFromMem(p, &l, sizeof(Retro_ArenaSave));
+  u32 frames = streamLength / ring->frameSize;
+  u32 head = (u32) SDL_AtomicGet(&ring->head);
+  u32 fill = (u32) SDL_AtomicGet(&ring->tail) - head;
+  SDL_MemoryBarrierAcquire();
 
-  assert(l.header[0] == 'R');
-  assert(l.header[1] == 'E');
-  assert(l.header[2] == 'T');
-  assert(l.header[3] == 'R');
-  assert(l.size < RETRO_ARENA_SIZE);
- 
-  gScopeStackIndex = l.scopeStackIndex;
-  
-  for(u32 i=0;i < l.scopeStackIndex + 1;i++)
-  {
-    //fread(&gScopeStack[i], sizeof(ScopeStack), 1, f);
-    p = Retro_ReadFromMem(p, &gScopeStack[i], sizeof(ScopeStack));
-  }
+  int lowest = SDL_AtomicGet(&ring->lowest);
 
-  p = Retro_ReadFromMem(p, gArena.begin, l.size);
+  if ((int) fill < lowest)
+    SDL_AtomicCAS(&ring->lowest, lowest, (int) fill);
 
-  gArena.current = gArena.begin + l.size;
+  u32 count = fill < frames ? fill : frames;
+  u32 offset = head & mask;
+  u32 first = count < RETRO_AUDIO_RING_SAMPLES - offset ? count : RETRO_AUDIO_RING_SAMPLES - offset;
 
+  memcpy(stream, ring->buffer + offset * ring->frameSize, first * ring->frameSize);
+  memcpy(stream + first * ring->frameSize, ring->buffer, (count - first) * ring->frameSize);
 
-  if (loadMusic && gMusicContext != NULL)
+  if (count < frames)
   {
-    // gMusicContext->samples_remaining = l.musicSamples;
-    // micromod_set_position(l.musicSamples);
+    // Silence is zero in S16 and F32 alike.
+    memset(stream + count * ring->frameSize, 0, streamLength - count * ring->frameSize);
+    SDL_AtomicAdd(&ring->underruns, 1);
   }
 
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&ring->head, (int) (head + count));
+
+  if (SDL_SemValue(ring->wake) == 0)
+    SDL_SemPost(ring->wake);
 }
 
-void Scope_Push(int name)
+void Retro_SDL_SoundCallback(void* userdata, u8* stream, int streamLength)
 {
-  assert(gScopeStackIndex < 256);
+  RETRO_ZONE_BEGIN(Retro_SDL_SoundCallback);
 
-  ++gScopeStackIndex;
-  ScopeStack* scope = &gScopeStack[gScopeStackIndex];
+  if (gAudioRing.thread != NULL)
+  {
+    Audio_ReadRing(stream, streamLength);
+  }
+  else
+  {
+    Audio_ApplyCommands();
+    Retro_MixSoundObjects(stream, streamLength);
+  }
 
-  scope->name = name;
-  scope->p = Arena_Current();
+  RETRO_ZONE_END(Retro_SDL_SoundCallback);
 }
 
-int Scope_GetName()
+void  Font_Make(Font* font)
 {
-  ScopeStack* scope = &gScopeStack[gScopeStackIndex];
-  return scope->name;
+  assert(font);
+  memset(font->widths, 0, sizeof(font->widths));
+  font->height = 0;
+  font->bitmap.w = 0;
+  font->bitmap.h = 0;
+  font->bitmap.texture = NULL;
+  font->bitmap.imageData = NULL;
+  font->bitmap.indices = NULL;
 }
 
-u8* Scope_Obtain(u32 size)
+void Font_Load(const char* name, Font* outFont, Colour markerColour, Colour transparentColour)
 {
-  ScopeStack* scope = &gScopeStack[gScopeStackIndex];
-  assert(scope->p + size < RETRO_ARENA_SIZE); // Ensure can fit.
-  return Arena_Obtain(size);
-}
+  u32 width, height;
 
-void Scope_Rewind()
-{
-  ScopeStack* scope = &gScopeStack[gScopeStackIndex];
-  Arena_RewindU32(scope->p);
-}
+  u8* imageData = NULL;
 
-void Scope_Pop()
-{
-  assert(gScopeStackIndex > 0);
-  Scope_Rewind();
-  --gScopeStackIndex;
-}
+#ifdef RETRO_WINDOWS
+  u32 resourceSize = 0;
+  void* resourceData = Resource_Load(name, &resourceSize);
+  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
+#elif defined(RETRO_FILESYSTEM)
+  RETRO_MAKE_ASSET_PATH(name);
+  lodepng_decode_file(&imageData, &width, &height, RETRO_ASSET_PATH, LCT_RGB, 8);
+#endif
 
-void Canvas_DrawPalette(Palette* palette, u32 Y)
-{
-  int w = Canvas_GetWidth() / 16;
-  int h = 8;
+  assert(imageData);
 
-  int x = 0;
-  int y = 0;
+  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, width, height - 1);
 
-  for(int i=0;i < palette->count;i++)
-  {
-    Rect rect;
-    rect.left = x;
-    rect.top = y;
-    rect.right = x + w;
-    rect.bottom = y + h;
+  void* pixelsVoid;
+  int pitch;
 
-    Canvas_DrawFilledRectangle(i, rect);
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
+  u8* pixels = (u8*) pixelsVoid;
+  
+  u32 i, j;
 
-    if (i > 0 && i % 16 == 0)
-    {
-      x = 0;
-      y += h;
-    }
-    else
+  u32 lx = 0xCAFEBEEF;
+  u8  ch = '!';
+
+  // Scan the first line for markers.
+  for(i=0;i < width * 3;i+=3)
+  {
+    Colour col = Colour_ReadRGB(&imageData[i]);
+    if (Colour_Equals(col, markerColour))
     {
-      x += w;
+      int x = i / 3;
+
+      if (lx == 0xCAFEBEEF)
+      {
+        lx = 0;
+      }
+      else
+      {
+        outFont->x[ch] = lx;
+        outFont->widths[ch] = x - lx;
+        ch++;
+        lx = x;
+      }
     }
   }
-  
-}
 
-void Canvas_DrawRectangle(u8 colour, Rect rect)
-{
-  Colour rgb = Palette_GetColour(&gSettings.palette, colour);
-  SDL_Rect dst;
-  RETRO_SDL_TO_RECT(rect, dst);
+  outFont->widths[' '] = outFont->widths['M'];
 
-  RETRO_SDL_DRAW_PUSH_RGB(t, rgb);
+  // Copy rest of image into the texture.
+  u8* indices = SoftCanvas_MakeIndices(width, height - 1);
 
-  SDL_RenderDrawRect(gRenderer, &dst);
+  for(i=0, j=width * 3;i < width * (height - 1) * 4;i+=4, j+=3)
+  {
+    Colour col = Colour_ReadRGB(&imageData[j]);
 
-  RETRO_SDL_DRAW_POP_RGB(t);
-}
+    pixels[i+0] = 0xFF;
+    pixels[i+1] = 0xFF;
+    pixels[i+2] = 0xFF;
 
-void Canvas_DrawFilledRectangle(u8 colour, Rect rect)
-{
-  Colour rgb = Palette_GetColour(&gSettings.palette, colour);
-  SDL_Rect dst;
-  RETRO_SDL_TO_RECT(rect, dst);
+    if (Colour_Equals(col, transparentColour))
+    {
+      pixels[i+3] = 0x00;
+    }
+    else
+    {
+      pixels[i+3] = 0xFF;
+    }
 
-  RETRO_SDL_DRAW_PUSH_RGB(t, rgb);
+    // Glyphs are drawn in a single colour, so only coverage is kept.
+    if (indices)
+      indices[i / 4] = pixels[i+3] ? 0 : RETRO_SOFT_HOLE;
+  }
 
-  SDL_RenderFillRect(gRenderer, &dst);
+  SDL_UnlockTexture(texture);
 
-  RETRO_SDL_DRAW_POP_RGB(t);
+  outFont->height = height - 1;
+  outFont->bitmap.w = width;
+  outFont->bitmap.h = height - 1;
+  outFont->bitmap.texture = texture;
+  outFont->bitmap.imageData = imageData;
+  outFont->bitmap.indices = indices;
 }
 
-char* gFmtScratch;
-
-void Canvas_PrintStr(u32 x, u32 y, Font* font, u8 colour, const char* str)
+int Input_TextInput(char* str, u32 capacity)
 {
-  assert(font);
   assert(str);
+  u32 len = strlen(str);
 
-  Colour rgb = Palette_GetColour(&gSettings.palette, colour);
-
-  SDL_Rect s, d;
-  s.x = 0;
-  s.y = 0;
-  s.w = 0;
-  s.h = font->height;
-  d.x = x;
-  d.y = y;
-  d.w = 0;
-  d.h = s.h; 
-
-  RETRO_SDL_TEXTURE_PUSH_RGB(t, font->bitmap.texture, rgb);
+  switch(gInputCharState)
+  {
+    default:
+    case ICS_None:
+    return 0;
+    case ICS_Character:
+    {
+      if (len < capacity)
+      {
+        str[len] = gInputChar;
+        return 1;
+      }
+    }
+    return 0;
+    case ICS_Backspace:
+    {
+      if (len > 0)
+      {
+        str[len-1] = 0;
+        return 1;
+      }
+    }
+    return 0;
+    case ICS_Enter:
+      if (len > 0)
+        return 2;
+    return 0;
+  }
+  return 0;
+}
 
-  while(true)
+InputActionBinding* Input_GetAction(int action)
+{
+  for(int i=0;i < RETRO_MAX_INPUT_ACTIONS;++i)
   {
-    u8 c = *str++;
+    InputActionBinding* binding = &gInputActions[i];
+    if (binding->action == action)
+      return binding;
+  }
+  return NULL;
+}
 
-    if (c == 0x0)
-      break;
-    
-    if (c == ' ')
+InputActionBinding* Input_MakeAction(int action)
+{
+  for(int i=0;i < RETRO_MAX_INPUT_ACTIONS;++i)
+  {
+    InputActionBinding* binding = &gInputActions[i];
+    if (binding->action == 0xDEADBEEF)
     {
-      d.x += font->widths[' '];
-      continue;
+      binding->action = action;
+      return binding;
     }
+  }
+  assert(true); // Ran out of InputActionBindings
+  return NULL;
+}
 
-    s.x = font->x[c];
-    s.w = font->widths[c];
-    d.w = s.w;
-
-    SDL_RenderCopy(gRenderer, (SDL_Texture*) font->bitmap.texture, &s, &d);
 
-    d.x += d.w;
+void  Input_BindKey(int key, int action)
+{
+  InputActionBinding* binding = Input_GetAction(action);
+  
+  if (binding == NULL)
+  {
+    binding = Input_MakeAction(action);
   }
 
-  RETRO_SDL_TEXTURE_POP_RGB(t, (SDL_Texture*) font->bitmap.texture);
+  for (u32 i=0;i < RETRO_MAX_INPUT_BINDINGS;i++)
+  {
+    if (binding->keys[i] == 0)
+    {
+      binding->keys[i] = key;
+      return;
+    }
+  }
 
+  assert(true); // To many keys to bound
 }
 
-i32 Canvas_LengthStr(Font* font, const char* str)
+void  Input_BindAxis(int axis, int action)
 {
-  assert(font);
-  assert(str);
-
-  SDL_Rect s, d;
-  s.x = 0;
-  s.y = 0;
-  s.w = 0;
-  s.h = font->height;
-  d.x = 0;
-  d.y = 0;
-  d.w = 0;
-  d.h = s.h; 
+  InputActionBinding* binding = Input_GetAction(action);
 
-  while(true)
+  if (binding == NULL)
   {
-    u8 c = *str++;
-
-    if (c == 0x0)
-      break;
+    binding = Input_MakeAction(action);
+  }
 
-    if (c == ' ')
+  for (u32 i=0;i < RETRO_MAX_INPUT_BINDINGS;i++)
+  {
+    if (binding->axis[i] == 0)
     {
-      d.x += font->widths[' '];
-      continue;
+      binding->axis[i] = axis;
+      return;
     }
+  }
 
-    s.x = font->x[c];
-    s.w = font->widths[c];
-    d.w = s.w;
+  assert(true); // To many keys to bound
+}
 
-    d.x += d.w;
-  }
+bool  Input_GetActionDown(int action)
+{
+  InputActionBinding* binding = Input_GetAction(action);
+  assert(binding);
 
-  return d.x;
+  return binding->state == 1;
 }
 
-void Canvas_PrintF(u32 x, u32 y, Font* font, u8 colour, const char* fmt, ...)
+bool  Input_GetActionReleased(int action)
 {
-  assert(font);
-  assert(fmt);
-  va_list args;
-  va_start(args, fmt);
-  vsprintf(gFmtScratch, fmt, args);
-  va_end(args);
+  InputActionBinding* binding = Input_GetAction(action);
+  assert(binding);
 
-  Canvas_PrintStr(x, y, font, colour, gFmtScratch);
+  return binding->state == 0 && binding->lastState == 1;
 }
 
-i32 Canvas_LengthF(Font* font, const char* fmt, ...)
+bool  Input_GetActionPressed(int action)
 {
-  assert(font);
-  assert(fmt);
-  va_list args;
-  va_start(args, fmt);
-  vsprintf(gFmtScratch, fmt, args);
-  va_end(args);
+  InputActionBinding* binding = Input_GetAction(action);
+  assert(binding);
 
-  return Canvas_LengthStr(font, gFmtScratch);
+  return binding->state == 1 && binding->lastState == 0;
 }
 
-void Canvas_SetPresentation(FramePresentation presentation, float alpha, float beta)
+i16   Input_GetActionNowAxis(int action)
 {
-  gFramePresentation = presentation;
-  gFrameAlpha = alpha;
-  gFrameBeta = beta;
+  InputActionBinding* binding = Input_GetAction(action);
+  assert(binding);
+
+  return binding->state;
 }
 
-void AnimatedSpriteObject_Make(AnimatedSpriteObject* inAnimatedSpriteObject, Animation* animation, i32 x, i32 y)
+i16   Input_GetActionDeltaAxis(int action)
 {
-  assert(inAnimatedSpriteObject);
+  InputActionBinding* binding = Input_GetAction(action);
+  assert(binding);
 
-  AnimationHandle handle = AnimationHandle_Set(animation);
+  return binding->state - binding->lastState;
+}
 
-  inAnimatedSpriteObject->animationHandle = handle;
-  inAnimatedSpriteObject->flags = 0;
-  inAnimatedSpriteObject->frameNumber = 0;
-  inAnimatedSpriteObject->frameTime = 0;
-  inAnimatedSpriteObject->x = x;
-  inAnimatedSpriteObject->y = y;
+bool sLastMouse = false, sNowMouse = false;
+float sMouseDownTime = 0.0f;
+
+Point Input_MousePosition()
+{
+  Point mouse;
+  mouse.x = sMouseX;
+  mouse.y = sMouseY;
+  return mouse;
 }
 
-void AnimatedSpriteObject_PlayAnimation(AnimatedSpriteObject* inAnimatedSpriteObject, bool playing, bool loop)
+bool Input_MouseReleased()
 {
-  assert(inAnimatedSpriteObject);
+  return sLastMouse && !sNowMouse;
+}
 
-  if (playing)
-    inAnimatedSpriteObject->flags |= SOF_Animation;
-  else
-    inAnimatedSpriteObject->flags &= ~SOF_Animation;
+bool Input_MousePressed()
+{
+  return !sLastMouse && sNowMouse;
+}
 
-  if (!loop)
-    inAnimatedSpriteObject->flags |= SOF_AnimationOnce;
-  else
-    inAnimatedSpriteObject->flags &= ~SOF_AnimationOnce;
+bool Input_MouseDown()
+{
+  return sLastMouse && sNowMouse;
+}
 
+bool Input_MouseHeldDown()
+{
+  return Input_MouseDown() && sMouseDownTime >= 0.1f;
 }
 
-void AnimatedSpriteObject_SwitchAnimation(AnimatedSpriteObject* animatedSpriteObject, Animation* newAnimation, bool animate)
+typedef enum
 {
-  assert(animatedSpriteObject);
-  assert(newAnimation);
+  TF_None    = 0,
+  TF_Started = 1,
+  TF_Paused  = 2
+} Retro_TimerFlags;
 
-  animatedSpriteObject->animationHandle = newAnimation->animationHandle;
-  if (animate)
-    animatedSpriteObject->flags |= SOF_Animation;
-  else
-    animatedSpriteObject->flags &= ~SOF_Animation;
-  animatedSpriteObject->frameNumber = 0;
+void  Timer_Make(Timer* timer)
+{
+  assert(timer);
+  timer->start = 0;
+  timer->paused = 0;
+  timer->flags = TF_None;
 }
 
-void  Canvas_Debug(Font* font)
+void  Timer_Start(Timer* timer)
 {
-  assert(font);
-  RetroFourByteUnion f;
-  f.q = Scope_GetName();
-  
-  u32 soundObjectCount = 0;
-  for(u32 i=0;i < RETRO_MAX_SOUND_OBJECTS;i++)
-  {
-    SoundObject* soundObj = &gSoundObject[i];
+  assert(timer);
+  timer->flags = TF_Started;
+  timer->start = SDL_GetTicks();
+  timer->paused = 0;
+}
 
-    if (soundObj->sound != NULL)
-      soundObjectCount++;
-  }
+void  Timer_Stop(Timer* timer)
+{
+  assert(timer);
 
-  int music = -1;
+  timer->start = 0;
+  timer->paused = 0;
+  timer->flags = TF_None;
+}
 
-  if (gMusicContext != NULL)
+void  Timer_Pause(Timer* timer)
+{
+  assert(timer);
+
+  if (timer->flags == TF_Started)
   {
-    music = (int) 100 - (((float) gMusicContext->samples_remaining / (float) gMusicContext->length) *100.0f);
+    timer->flags |= TF_Paused;
+    timer->paused = SDL_GetTicks() - timer->start;
+    timer->start = 0;
   }
-
-  Canvas_PrintF(0, Canvas_GetHeight() - font->height, font, 1, "Scope=%c%c%c%c Mem=%i%% FPS=%.2g Dt=%i Snd=%i, Mus=%i", f.b[3], f.b[2], f.b[1], f.b[0], Arena_PctSize(), gFps, gDeltaTime, soundObjectCount, music);
 }
 
-void  Sound_Load(Sound* sound, const char* name)
+void  Timer_Unpause(Timer* timer)
 {
+  assert(timer);
 
-  #ifdef RETRO_WINDOWS
-  u32 resourceSize = 0;
-  void* resource = Resource_Load(name, &resourceSize);
-  SDL_LoadWAV_RW(SDL_RWFromConstMem(resource, resourceSize), 0, &sound->spec, &sound->buffer, &sound->length);
-  #else
-  RETRO_MAKE_BROWSER_PATH(name);
-  SDL_LoadWAV(RETRO_BROWSER_PATH, &sound->spec, &sound->buffer, &sound->length);
-  #endif
-
-  if (sound->spec.format != gSoundDevice.specification.format || sound->spec.freq != gSoundDevice.specification.freq || sound->spec.channels != gSoundDevice.specification.channels)
+  if (timer->flags == 3 /* Started | Paused */)
   {
-    // Do a conversion
-    SDL_AudioCVT cvt;
-    SDL_BuildAudioCVT(&cvt, sound->spec.format, sound->spec.channels, sound->spec.freq, gSoundDevice.specification.format, gSoundDevice.specification.channels, gSoundDevice.specification.freq);
+    timer->flags = TF_Started; // &= ~Paused
+    timer->start = SDL_GetTicks() - timer->paused;
+    timer->paused = 0;
+  }
+}
 
-    cvt.buf = malloc(sound->length * cvt.len_mult);
-    memcpy(cvt.buf, sound->buffer, sound->length);
-    cvt.len = sound->length;
-    SDL_ConvertAudio(&cvt);
-    SDL_FreeWAV(sound->buffer);
+u32   Timer_GetTicks(Timer* timer)
+{
+  assert(timer);
 
-    sound->buffer = cvt.buf;
-    sound->length = cvt.len_cvt;
-    sound->spec = gSoundDevice.specification;
+  u32 time = 0;
 
-    // printf("Loaded Audio %s but had to convert it into a internal format.\n", name);
-  }
-  else
+  if (timer->flags != 0) // Started || Paused
   {
-   // printf("Loaded Audio %s\n", name);
+    if (timer->flags > TF_Started) // Paused
+    {
+      time = timer->paused;
+    }
+    else
+    {
+      time = SDL_GetTicks() - timer->start;
+    }
   }
 
+  return time;
 }
 
-void  Sound_Play(Sound* sound, u8 volume)
+bool  Timer_IsStarted(Timer* timer)
 {
-  for(u32 i=0;i < RETRO_MAX_SOUND_OBJECTS;i++)
-  {
-    SoundObject* soundObj = &gSoundObject[i];
-    if (soundObj->sound != NULL)
-     continue;
-
-    soundObj->sound = sound;
-    soundObj->p = 0;
-    soundObj->volume = volume > SDL_MIX_MAXVOLUME ? SDL_MIX_MAXVOLUME : volume;
-
-    return;
-  }
+  return timer->flags >= TF_Started;
 }
 
-void  Sound_Clear()
+bool  Timer_IsPaused(Timer* timer)
 {
-  for(u32 i=0;i < RETRO_MAX_SOUND_OBJECTS;i++)
-  {
-    SoundObject* soundObj = &gSoundObject[i];
+  return timer->flags >= TF_Paused;
+}
 
-    soundObj->sound = NULL;
-    soundObj->p = 0;
-    soundObj->volume = 0;
-  }
+static u32 Random_Pcg32(RandomState* rng)
+{
+  u64 old = rng->state;
+  rng->state = old * 6364136223846793005ULL + rng->inc;
+  u32 xorshifted = (u32) (((old >> 18) ^ old) >> 27);
+  u32 rot = (u32) (old >> 59);
+  return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
 }
 
-void Music_Play(const char* name)
+void Random_Seed(u32 seed)
 {
-  if (gMusicContext != NULL)
+  gRandomSeed = seed;
+
+  // The stream index picks the increment, so each stream is a different sequence.
+  for (u32 i=0;i < RS_COUNT;i++)
   {
-    Music_Stop();
+    RandomState* rng = &gRandom[i];
+    rng->state = 0;
+    rng->inc = ((u64) i << 1) | 1;
+    Random_Pcg32(rng);
+    rng->state += seed;
+    Random_Pcg32(rng);
   }
+}
 
-  gMusicContext = malloc(sizeof(micromod_sdl_context));
-  memset(gMusicContext, 0, sizeof(micromod_sdl_context));
-  gMusicPaused = false;
-
-  void* data = NULL;
-  u32 dataLength = 0;
+u32 Random_GetSeed()
+{
+  return gRandomSeed;
+}
 
-#ifdef RETRO_WINDOWS
-  data = Resource_Load(name, &dataLength);
-#endif
+u32 Random_Next(RandomStream stream)
+{
+  return Random_Pcg32(&gRandom[stream]);
+}
 
-#ifdef RETRO_BROWSER
-  RETRO_MAKE_BROWSER_PATH(name);
-  FILE* f = fopen(RETRO_BROWSER_PATH, "rb");
-  fseek(f, 0, SEEK_END);
-  dataLength = ftell(f);
-  fseek(f, 0, SEEK_SET);
+u32 Random_Below(RandomStream stream, u32 bound)
+{
+  return (u32) (((u64) Random_Pcg32(&gRandom[stream]) * bound) >> 32);
+}
 
-  gMusicFileData = malloc(dataLength);
-  fread(gMusicFileData, dataLength, 1, f);
-  fclose(f);
+int Random_Range(int min, int max)
+{
+  if (min == max)
+    return min;
+  return min + (int) Random_Below(RS_Simulation, (u32) (max - min + 1));
+}
 
-  data = gMusicFileData;
-#endif
+int Random_Roll2(int Dice, int EqualsOrHigher)
+{
+  return Random_Range(0, Dice) >= EqualsOrHigher;
+}
 
-  micromod_initialise(data, SAMPLING_FREQ * OVERSAMPLE);
-  gMusicContext->samples_remaining = micromod_calculate_song_duration();
-  gMusicContext->length = gMusicContext->samples_remaining;
+int Random_Roll(int dice)
+{
+  return Random_Roll2(dice, dice);
+}
 
+char* Text_SkipWhitespace(char* s)
+{
+  while(*s != 0 && isspace(*s))
+    s++;
+  return s;
 }
 
-void Music_PauseToggle()
+char* Text_SkipToDigit(char* s)
 {
+  while(*s != 0 && !isdigit(*s))
+    s++;
+  return s;
+}
 
-  if (gMusicContext == NULL)
-  {
-    return;
-  }
+char* Text_SkipString(char* s, const char* str)
+{
+  s = Text_SkipWhitespace(s);
+  s += strlen(str);
+  s = Text_SkipWhitespace(s);
+  return s;
+}
 
-  gMusicPaused = !gMusicPaused;
+bool Text_SkipToString(char* s, char** t, const char* str)
+{
+  (*t) = strstr(s, str);
+  if ((*t) == NULL)
+    return false;
+  return true;
 }
 
-void Music_Stop()
+char* Text_ReadUInt(char* s, u32* i)
 {
-  if (gMusicContext == NULL)
+  (*i) = 0;
+
+  while(*s != 0 && isdigit(*s))
   {
-    return;
+    (*i) = (*i) * 10  + ((*s) - '0');
+    s++;
   }
 
-  #if defined(RETRO_BROWSER)
-    free(gMusicFileData);
-    gMusicFileData = NULL;
-  #endif
+  return s;
+}
 
-  free(gMusicContext);
-  gMusicContext = NULL;
+i32  Map_XYToIndex(u32 x, u32 y)
+{
+  return Map_XYToIndex2(x, y, RETRO_MAP_WIDTH, RETRO_MAP_HEIGHT);
 }
 
-void Retro_SDL_SoundCallback(void* userdata, u8* stream, int streamLength)
+i32  Map_XYToIndex2(u32 x, u32 y, u32 mapWidth, u32 mapHeight)
 {
-  SDL_memset(stream, 0, streamLength);
+  if (x >= mapWidth)
+    return -1;
+  if (y >= mapHeight)
+    return -1;
+  return (x + (y * mapWidth));
+}
 
-  if (gMusicContext != NULL && gMusicPaused == false)
-  {
+bool Map_MouseToMapXY(i32* x, i32* y, i32 mapScreenOriginX, i32 mapScreenOriginY)
+{
+  return Map_MouseToMapXY2(x, y, mapScreenOriginX, mapScreenOriginY, RETRO_MAP_WIDTH, RETRO_MAP_HEIGHT, RETRO_TILE_SIZE);
+}
 
-    // int uSize = (gSoundDevice.specification.format == AUDIO_S16 ? sizeof(short) : sizeof(float));
+bool Map_MouseToMapXY2(i32* x, i32* y, i32 mapScreenOriginX, i32 mapScreenOriginY, u32 mapWidth, u32 mapHeight, u32 tileSize)
+{
+  i32 mmx = sMouseX;
+  i32 mmy = sMouseY;
 
-    long count = 0;
+  u32 xx = 0;
 
-    if (gSoundDevice.specification.format == AUDIO_S16)
-      count = streamLength / 2;
-    else
-      count = streamLength / 4;
+  if (mmx < mapScreenOriginX)
+    return false;
+  else if (mmx > Canvas_GetWidth() - mapScreenOriginX)
+    return false;
+  else
+    xx = mmx;
     
-    if( gMusicContext->samples_remaining < count ) {
-      /* Clear output.*/
-      count = gMusicContext->samples_remaining;
-    }
-
-    if( count > 0 ) {
-      /* Get audio from replay.*/
-
-      memset( gMusicContext->mix_buffer, 0, count * NUM_CHANNELS * sizeof( short ) );
-      micromod_get_audio( gMusicContext->mix_buffer, count );
-      
-      if (gSoundDevice.specification.format == AUDIO_S16)
-        micromod_sdl_downsample( gMusicContext, gMusicContext->mix_buffer, (short *) stream, count, 4);
-      else
-        micromod_sdl_downsample_float( gMusicContext, gMusicContext->mix_buffer, (float*) stream, count, 0.25f);
-      
-      gMusicContext->samples_remaining -= count;
-    }
-    else
-    {
-      gMusicContext->samples_remaining = gMusicContext->length;
-    }
-  }
+  xx -= mapScreenOriginX;
+  xx /= tileSize;
 
-  for(u32 i=0;i < RETRO_MAX_SOUND_OBJECTS;i++)
-  {
-    SoundObject* soundObj = &gSoundObject[i];
+  if (xx >= mapWidth)
+    return false;
 
-    if (soundObj->sound == NULL)
-      continue;
+  u32 yy = 0;
 
-    i32 soundLength = soundObj->sound->length;
-    
-    i32 mixLength = (streamLength > soundLength ? soundLength : streamLength);
+  if (mmy < mapScreenOriginY)
+    return false;
+  else if (mmy > Canvas_GetHeight() - mapScreenOriginY)
+    return false;
+  else
+    yy = mmy;
     
+  yy -= mapScreenOriginY;
+  yy /= tileSize;
 
-    if (soundObj->p + mixLength >= soundLength)
-    {
-      mixLength = soundLength - soundObj->p;
-    }
-
-    
-    SDL_MixAudioFormat(stream, 
-    soundObj->sound->buffer + soundObj->p, 
-    soundObj->sound->spec.format,
-    mixLength, 
-    SDL_MIX_MAXVOLUME); // / 2);
+  if (yy >= mapHeight)
+    return false;
 
-    soundObj->p += mixLength;
+  *x = xx;
+  *y = yy;
 
-    if (soundObj->p >= soundObj->sound->length)
-    {
-      // Finished
-      soundObj->sound = NULL;
-      soundObj->p = 0;
-      soundObj->volume = 0;
-    }
-  }
+  return true;
 }
 
-void  Font_Make(Font* font)
+void Tile_Draw(Bitmap* bitmap, i32 x, i32 y, u32 tileX, u32 tileY)
 {
-  assert(font);
-  memset(font->widths, 0, sizeof(font->widths));
-  font->height = 0;
-  font->bitmap.w = 0;
-  font->bitmap.h = 0;
-  font->bitmap.texture = NULL;
-  font->bitmap.imageData = NULL;
+  Tile_Draw2(bitmap, x, y, tileX, tileY, RETRO_TILE_SIZE);
 }
 
-void Font_Load(const char* name, Font* outFont, Colour markerColour, Colour transparentColour)
+void Tile_Draw2(Bitmap* bitmap, i32 x, i32 y, u32 tileX, u32 tileY, u32 tileSize)
 {
-  u32 width, height;
-
-  u8* imageData = NULL;
-
-#ifdef RETRO_WINDOWS
-  u32 resourceSize = 0;
-  void* resourceData = Resource_Load(name, &resourceSize);
-  lodepng_decode_memory(&imageData, &width, &height, resourceData, resourceSize, LCT_RGB, 8);
-#elif defined(RETRO_BROWSER)
-  RETRO_MAKE_BROWSER_PATH(name);
-  lodepng_decode_file(&imageData, &width, &height, RETRO_BROWSER_PATH, LCT_RGB, 8);
-#endif
-
-  assert(imageData);
-
-  SDL_Texture* texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, width, height - 1);
-
-  void* pixelsVoid;
-  int pitch;
-
-  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-  SDL_LockTexture(texture, NULL, &pixelsVoid, &pitch);
-  u8* pixels = (u8*) pixelsVoid;
+  SDL_Rect src, dst;
   
-  u32 i, j;
+  src.x = tileX * tileSize;
+  src.y = tileY * tileSize;
+  
+  src.w = tileSize;
+  src.h = tileSize;
 
-  u32 lx = 0xCAFEBEEF;
-  u8  ch = '!';
+  dst.x = x;
+  dst.y = y;
+  dst.w = tileSize;
+  dst.h = tileSize;
 
-  // Scan the first line for markers.
-  for(i=0;i < width * 3;i+=3)
-  {
-    Colour col = Colour_ReadRGB(&imageData[i]);
-    if (Colour_Equals(col, markerColour))
-    {
-      int x = i / 3;
+  Canvas_Splat3(bitmap, &dst, &src);
+}
 
-      if (lx == 0xCAFEBEEF)
-      {
-        lx = 0;
-      }
-      else
-      {
-        outFont->x[ch] = lx;
-        outFont->widths[ch] = x - lx;
-        ch++;
-        lx = x;
-      }
-    }
-  }
+void Restart()
+{
+  gArena.current = gArena.begin;
+  
+  gScopeStackIndex = 0;
+  gScopeStack[0].p = 0;
+  gScopeStack[0].name = 'INIT';
 
-  outFont->widths[' '] = outFont->widths['M'];
+  Start();
+}
 
-  // Copy rest of image into the texture.
-  for(i=0, j=width * 3;i < width * (height - 1) * 4;i+=4, j+=3)
+// Copies the visible canvases to the window, or the composited canvas of the software renderer.
+static void Canvas_PresentCopy(SDL_Rect* src, SDL_Rect* dst)
+{
+  if (gSoftwareRenderer)
   {
-    Colour col = Colour_ReadRGB(&imageData[j]);
-
-    pixels[i+0] = 0xFF;
-    pixels[i+1] = 0xFF;
-    pixels[i+2] = 0xFF;
-
-    if (Colour_Equals(col, transparentColour))
-    {
-      pixels[i+3] = 0x00;
-    }
-    else
-    {
-      pixels[i+3] = 0xFF;
-    }
+    SDL_RenderCopy(gRenderer, gSoft.texture, src, dst);
+    return;
   }
 
-  SDL_UnlockTexture(texture);
-
-  outFont->height = height - 1;
-  outFont->bitmap.w = width;
-  outFont->bitmap.h = height - 1;
-  outFont->bitmap.texture = texture;
-  outFont->bitmap.imageData = imageData;
+  for (int i=0;i < RETRO_CANVAS_COUNT;i++)
+  {
+    if (gCanvasFlags[i] & CNF_Render)
+    {
+      SDL_RenderCopy(gRenderer, gCanvasTextures[i], src, dst);
+    }
+  }
 }
 
-int Input_TextInput(char* str, u32 capacity)
+void Canvas_Present()
 {
-  assert(str);
-  u32 len = strlen(str);
+  if (gSoftwareRenderer)
+  {
+    SoftCanvas_Upload();
+  }
 
-  switch(gInputCharState)
+  switch(gFramePresentation)
   {
-    default:
-    case ICS_None:
-    return 0;
-    case ICS_Character:
+    case FP_Normal:
     {
-      if (len < capacity)
+      Canvas_PresentCopy(NULL, NULL);
+    }
+    break;
+    case FP_WaveH:
+    {
+      u32 accuracy = 2;
+
+      for (u32 u=0;u < RETRO_WINDOW_DEFAULT_HEIGHT;u+=accuracy)
       {
-        str[len] = gInputChar;
-        return 1;
+        SDL_Rect src;
+        SDL_Rect dst;
+        src.x = 0;
+        src.y = u;
+        src.w = RETRO_CANVAS_DEFAULT_WIDTH;
+        src.h = accuracy;
+
+        dst = src;
+
+        float x0 = (float) u / (float) RETRO_WINDOW_DEFAULT_HEIGHT;
+        dst.x = (sin((gCountedFrames % 1000) * gFrameAlpha + x0 * 3.14f) * gFrameBeta);
+        dst.y = u * 2;
+        dst.w = RETRO_WINDOW_DEFAULT_WIDTH;
+        dst.h = accuracy * 2;
+
+        Canvas_PresentCopy(&src, &dst);
       }
     }
-    return 0;
-    case ICS_Backspace:
+    break;
+    case FP_WaveV:
     {
-      if (len > 0)
+      u32 accuracy = 2;
+
+      for (u32 u=0;u < RETRO_WINDOW_DEFAULT_HEIGHT;u+=accuracy)
       {
-        str[len-1] = 0;
-        return 1;
+        SDL_Rect src;
+        SDL_Rect dst;
+        src.x = u;
+        src.y = 0;
+        src.w = accuracy;
+        src.h = RETRO_CANVAS_DEFAULT_HEIGHT;
+
+        dst = src;
+
+        float y0 = (float) u / (float) RETRO_WINDOW_DEFAULT_HEIGHT;
+        dst.x = u * 2;
+        dst.y = (sin((gCountedFrames % 1000) * gFrameAlpha + y0 * 3.14f) * gFrameBeta);
+        dst.w = accuracy * 2;
+        dst.h = RETRO_WINDOW_DEFAULT_HEIGHT;
+
+        Canvas_PresentCopy(&src, &dst);
       }
     }
-    return 0;
-    case ICS_Enter:
-      if (len > 0)
-        return 2;
-    return 0;
+    break;
+    case FP_Scale:
+    {
+
+      SDL_Rect src;
+      SDL_Rect dst;
+      src.w = (float) RETRO_CANVAS_DEFAULT_WIDTH * gFrameAlpha;
+      src.h = (float) RETRO_CANVAS_DEFAULT_HEIGHT * gFrameBeta;
+      src.x = 0; //src.w / 2;
+      src.y = 0; //src.h / 2;
+
+      dst = src;
+      dst.x = RETRO_WINDOW_DEFAULT_WIDTH / 2 - (src.w);
+      dst.y = RETRO_WINDOW_DEFAULT_HEIGHT / 2 - (src.h);
+      dst.w *= 2;
+      dst.h *= 2;
+
+      Canvas_PresentCopy(&src, &dst);
+    }
+    break;
   }
-  return 0;
 }
 
-InputActionBinding* Input_GetAction(int action)
+f32 Retro_GetTickAlpha()
 {
-  for(int i=0;i < RETRO_MAX_INPUT_ACTIONS;++i)
-  {
-    InputActionBinding* binding = &gInputActions[i];
-    if (binding->action == action)
-      return binding;
-  }
-  return NULL;
+  return gTickAlpha;
 }
 
-InputActionBinding* Input_MakeAction(int action)
+void Replay_SetStateHash(StateHashFunction fn)
 {
-  for(int i=0;i < RETRO_MAX_INPUT_ACTIONS;++i)
-  {
-    InputActionBinding* binding = &gInputActions[i];
-    if (binding->action == 0xDEADBEEF)
-    {
-      binding->action = action;
-      return binding;
-    }
-  }
-  assert(true); // Ran out of InputActionBindings
-  return NULL;
+  gReplay.hash = fn;
 }
 
-
-void  Input_BindKey(int key, int action)
+static void Replay_PutByte(u8 value)
 {
-  InputActionBinding* binding = Input_GetAction(action);
-  
-  if (binding == NULL)
+  if (gReplay.size == gReplay.capacity)
   {
-    binding = Input_MakeAction(action);
+    gReplay.capacity = gReplay.capacity == 0 ? Kilobytes(4) : gReplay.capacity * 2;
+    gReplay.data = realloc(gReplay.data, gReplay.capacity);
   }
 
-  for (u32 i=0;i < RETRO_MAX_INPUT_BINDINGS;i++)
+  gReplay.data[gReplay.size++] = value;
+}
+
+static void Replay_PutVarint(u32 value)
+{
+  while (value >= 0x80)
   {
-    if (binding->keys[i] == 0)
-    {
-      binding->keys[i] = key;
-      return;
-    }
+    Replay_PutByte((u8) (value | 0x80));
+    value >>= 7;
   }
-
-  assert(true); // To many keys to bound
+  Replay_PutByte((u8) value);
 }
 
-void  Input_BindAxis(int axis, int action)
+static bool Replay_GetVarint(u32* outValue)
 {
-  InputActionBinding* binding = Input_GetAction(action);
+  u32 value = 0;
 
-  if (binding == NULL)
+  for (u32 shift = 0; shift < 35; shift += 7)
   {
-    binding = Input_MakeAction(action);
-  }
+    if (gReplay.read == gReplay.size)
+      return false;
 
-  for (u32 i=0;i < RETRO_MAX_INPUT_BINDINGS;i++)
-  {
-    if (binding->axis[i] == 0)
+    u8 b = gReplay.data[gReplay.read++];
+    value |= (u32) (b & 0x7F) << shift;
+
+    if ((b & 0x80) == 0)
     {
-      binding->axis[i] = axis;
-      return;
+      *outValue = value;
+      return true;
     }
   }
 
-  assert(true); // To many keys to bound
+  return false;
 }
 
-bool  Input_GetActionDown(int action)
+// Entries are the ticks since the previous entry and the kind packed into one varint, then the
+// value as a varint. Input entries hold the action bits that changed.
+static void Replay_PutEntry(ReplayKind kind, u32 value)
 {
-  InputActionBinding* binding = Input_GetAction(action);
-  assert(binding);
-
-  return binding->state == 1;
+  Replay_PutVarint(((gReplay.tick - gReplay.entryTick) << 1) | kind);
+  Replay_PutVarint(value);
+  gReplay.entryTick = gReplay.tick;
 }
 
-bool  Input_GetActionReleased(int action)
+static void Replay_NextEntry()
 {
-  InputActionBinding* binding = Input_GetAction(action);
-  assert(binding);
+  u32 header, value;
+  gReplay.entryValid = Replay_GetVarint(&header) && Replay_GetVarint(&value);
 
-  return binding->state == 0 && binding->lastState == 1;
+  if (gReplay.entryValid)
+  {
+    gReplay.entryTick += header >> 1;
+    gReplay.entryKind = header & 1;
+    gReplay.entryValue = value;
+  }
 }
 
-bool  Input_GetActionPressed(int action)
+static void Replay_PutU32(u32 value)
 {
-  InputActionBinding* binding = Input_GetAction(action);
-  assert(binding);
+  for (u32 i=0;i < 4;i++)
+    Replay_PutByte((u8) (value >> (i * 8)));
+}
 
-  return binding->state == 1 && binding->lastState == 0;
+static u32 Replay_GetU32(u32 offset)
+{
+  u8* b = gReplay.data + offset;
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((u32) b[3] << 24);
 }
 
-i16   Input_GetActionNowAxis(int action)
+void Replay_BeginRecording(u32 seed)
 {
-  InputActionBinding* binding = Input_GetAction(action);
-  assert(binding);
+  gReplay.recording = true;
+  gReplay.size = 0;
 
-  return binding->state;
+  // The tick count is filled in by Replay_Save.
+  Replay_PutU32(RETRO_REPLAY_MAGIC);
+  Replay_PutByte(RETRO_REPLAY_VERSION);
+  Replay_PutU32(seed);
+  Replay_PutU32(0);
 }
 
-i16   Input_GetActionDeltaAxis(int action)
+bool Replay_Save(const char* filename)
 {
-  InputActionBinding* binding = Input_GetAction(action);
-  assert(binding);
+  FILE* f = fopen(filename, "wb");
 
-  return binding->state - binding->lastState;
-}
+  if (f == NULL)
+  {
+    printf("Replay Error: Cannot write %s\n", filename);
+    return false;
+  }
 
-bool sLastMouse = false, sNowMouse = false;
-float sMouseDownTime = 0.0f;
+  u8* ticks = gReplay.data + 9;
+  for (u32 i=0;i < 4;i++)
+    ticks[i] = (u8) (gReplay.tick >> (i * 8));
 
-Point Input_MousePosition()
-{
-  Point mouse;
-  mouse.x = sMouseX;
-  mouse.y = sMouseY;
-  return mouse;
-}
+  fwrite(gReplay.data, gReplay.size, 1, f);
+  fclose(f);
 
-bool Input_MouseReleased()
-{
-  return sLastMouse && !sNowMouse;
+  printf("Replay: Recorded %u ticks in %u bytes to %s\n", gReplay.tick, gReplay.size, filename);
+  return true;
 }
 
-bool Input_MousePressed()
+bool Replay_Load(const char* filename)
 {
-  return !sLastMouse && sNowMouse;
-}
+  FILE* f = fopen(filename, "rb");
 
-bool Input_MouseDown()
-{
-  return sLastMouse && sNowMouse;
-}
+  if (f == NULL)
+  {
+    printf("Replay Error: Cannot open %s\n", filename);
+    return false;
+  }
 
-bool Input_MouseHeldDown()
-{
-  return Input_MouseDown() && sMouseDownTime >= 0.1f;
-}
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
 
-typedef enum
-{
-  TF_None    = 0,
-  TF_Started = 1,
-  TF_Paused  = 2
-} Retro_TimerFlags;
+  gReplay.data = malloc(size > 0 ? size : 1);
+  gReplay.size = (u32) size;
+  gReplay.capacity = gReplay.size;
+  fread(gReplay.data, size, 1, f);
+  fclose(f);
 
-void  Timer_Make(Timer* timer)
-{
-  assert(timer);
-  timer->start = 0;
-  timer->paused = 0;
-  timer->flags = TF_None;
+  if (gReplay.size < 13 || Replay_GetU32(0) != RETRO_REPLAY_MAGIC || gReplay.data[4] != RETRO_REPLAY_VERSION)
+  {
+    printf("Replay Error: %s is not a replay\n", filename);
+    free(gReplay.data);
+    gReplay.data = NULL;
+    gReplay.size = 0;
+    return false;
+  }
+
+  gRandomSeed = Replay_GetU32(5);
+  gReplay.ticks = Replay_GetU32(9);
+  gReplay.read = 13;
+  gReplay.replaying = true;
+
+  Replay_NextEntry();
+  return true;
 }
 
-void  Timer_Start(Timer* timer)
+// Returns the action states for this tick, from the recording.
+static u32 Replay_ReadInputs()
 {
-  assert(timer);
-  timer->flags = TF_Started;
-  timer->start = SDL_GetTicks();
-  timer->paused = 0;
+  while (gReplay.entryValid && gReplay.entryTick == gReplay.tick && gReplay.entryKind == RK_Input)
+  {
+    gReplay.actions ^= gReplay.entryValue;
+    Replay_NextEntry();
+  }
+
+  return gReplay.actions;
 }
 
-void  Timer_Stop(Timer* timer)
+static void Replay_WriteInputs(u32 actions)
 {
-  assert(timer);
-
-  timer->start = 0;
-  timer->paused = 0;
-  timer->flags = TF_None;
+  if (actions != gReplay.actions)
+  {
+    Replay_PutEntry(RK_Input, actions ^ gReplay.actions);
+    gReplay.actions = actions;
+  }
 }
 
-void  Timer_Pause(Timer* timer)
+// After each Step()
+static void Replay_EndTick()
 {
-  assert(timer);
+  bool hashTick = gReplay.hash != NULL && ((gReplay.tick + 1) % RETRO_REPLAY_HASH_INTERVAL) == 0;
 
-  if (timer->flags == TF_Started)
+  if (gReplay.recording && hashTick)
   {
-    timer->flags |= TF_Paused;
-    timer->paused = SDL_GetTicks() - timer->start;
-    timer->start = 0;
+    Replay_PutEntry(RK_Hash, gReplay.hash());
+  }
+
+  if (gReplay.replaying)
+  {
+    while (gReplay.entryValid && gReplay.entryTick == gReplay.tick && gReplay.entryKind == RK_Hash)
+    {
+      gReplay.hashes++;
+
+      if (gReplay.hash != NULL)
+      {
+        u32 hash = gReplay.hash();
+        if (hash != gReplay.entryValue)
+        {
+          if (gReplay.mismatches == 0)
+            printf("Replay: Diverged at tick %u (hash %08x, recorded %08x)\n", gReplay.tick, hash, gReplay.entryValue);
+          gReplay.mismatches++;
+        }
+      }
+
+      Replay_NextEntry();
+    }
   }
-}
 
-void  Timer_Unpause(Timer* timer)
-{
-  assert(timer);
+  gReplay.tick++;
 
-  if (timer->flags == 3 /* Started | Paused */)
+  if (gReplay.replaying && gReplay.tick >= gReplay.ticks)
   {
-    timer->flags = TF_Started; // &= ~Paused
-    timer->start = SDL_GetTicks() - timer->paused;
-    timer->paused = 0;
+    gQuit = true;
   }
 }
 
-u32   Timer_GetTicks(Timer* timer)
+void Snapshot_SetFunction(SnapshotFunction fn)
 {
-  assert(timer);
-
-  u32 time = 0;
+  gSnapshots.fn = fn;
 
-  if (timer->flags != 0) // Started || Paused
+  if (gSnapshots.newest == NULL)
   {
-    if (timer->flags > TF_Started) // Paused
-    {
-      time = timer->paused;
-    }
-    else
-    {
-      time = SDL_GetTicks() - timer->start;
-    }
+    gSnapshots.newest  = calloc(1, RETRO_SNAPSHOT_SIZE);
+    gSnapshots.work    = calloc(1, RETRO_SNAPSHOT_SIZE);
+    gSnapshots.encoded = malloc(RETRO_SNAPSHOT_SIZE * 2);
+    gSnapshots.pool    = malloc(RETRO_SNAPSHOT_POOL_SIZE);
   }
-
-  return time;
 }
 
-bool  Timer_IsStarted(Timer* timer)
+void Snapshot_Bytes(void* data, u32 size)
 {
-  return timer->flags >= TF_Started;
-}
+  if (gSnapshots.cursor + size > RETRO_SNAPSHOT_SIZE)
+  {
+    if (gSnapshots.overflow == false)
+      printf("Snapshot Error: State is larger than RETRO_SNAPSHOT_SIZE (%u)\n", RETRO_SNAPSHOT_SIZE);
+    gSnapshots.overflow = true;
+    return;
+  }
 
-bool  Timer_IsPaused(Timer* timer)
-{
-  return timer->flags >= TF_Paused;
-}
+  if (gSnapshots.restoring)
+    memcpy(data, gSnapshots.newest + gSnapshots.cursor, size);
+  else
+    memcpy(gSnapshots.work + gSnapshots.cursor, data, size);
 
-int Random_Range(int min, int max)
-{
-  if (min == max)
-    return min;
-  double scaled = (double)rand()/RAND_MAX;
-  return (int) ((max - min + 1)*scaled + min);
+  gSnapshots.cursor += size;
 }
 
-int Random_Roll2(int Dice, int EqualsOrHigher)
+bool Snapshot_IsRestoring()
 {
-  return Random_Range(0, Dice) >= EqualsOrHigher;
+  return gSnapshots.restoring;
 }
 
-int Random_Roll(int dice)
+bool Snapshot_IsEnabled()
 {
-  return Random_Roll2(dice, dice);
+  return gSnapshots.fn != NULL;
 }
 
-char* Text_SkipWhitespace(char* s)
+u32 Snapshot_GetDepth()
 {
-  while(*s != 0 && isspace(*s))
-    s++;
-  return s;
+  return gSnapshots.deltaCount;
 }
 
-char* Text_SkipToDigit(char* s)
+static void Snapshot_Engine()
 {
-  while(*s != 0 && !isdigit(*s))
-    s++;
-  return s;
+  Snapshot_Bytes(&gRandom[RS_Simulation], sizeof(RandomState));
+
+  for (u32 i=0;i < RETRO_MAX_INPUT_ACTIONS;i++)
+  {
+    Snapshot_Bytes(&gInputActions[i].state, sizeof(i16));
+    Snapshot_Bytes(&gInputActions[i].lastState, sizeof(i16));
+  }
 }
 
-char* Text_SkipString(char* s, const char* str)
+static u8* Snapshot_PutVarint(u8* p, u32 value)
 {
-  s = Text_SkipWhitespace(s);
-  s += strlen(str);
-  s = Text_SkipWhitespace(s);
-  return s;
+  while (value >= 0x80)
+  {
+    *p++ = (u8) (value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (u8) value;
+  return p;
 }
 
-bool Text_SkipToString(char* s, char** t, const char* str)
+static const u8* Snapshot_GetVarint(const u8* p, u32* outValue)
 {
-  (*t) = strstr(s, str);
-  if ((*t) == NULL)
-    return false;
-  return true;
+  u32 value = 0;
+  for (u32 shift = 0; ; shift += 7)
+  {
+    u8 b = *p++;
+    value |= (u32) (b & 0x7F) << shift;
+    if ((b & 0x80) == 0)
+      break;
+  }
+  *outValue = value;
+  return p;
 }
 
-char* Text_ReadUInt(char* s, u32* i)
+// Runs of (equal bytes to skip, differing bytes) each followed by the differing bytes XORed. A
+// run of differing bytes only ends at two equal bytes in a row, so lone matches don't cost a run.
+static u32 Snapshot_Encode(u8* out, const u8* a, const u8* b, u32 size)
 {
-  (*i) = 0;
+  u8* p = out;
+  u32 i = 0;
 
-  while(*s != 0 && isdigit(*s))
+  while (i < size)
   {
-    (*i) = (*i) * 10  + ((*s) - '0');
-    s++;
+    u32 skipBegin = i;
+
+    while (i + 8 <= size)
+    {
+      u64 x, y;
+      memcpy(&x, a + i, 8);
+      memcpy(&y, b + i, 8);
+      if (x != y)
+        break;
+      i += 8;
+    }
+
+    while (i < size && a[i] == b[i])
+      i++;
+
+    u32 literalBegin = i;
+
+    while (i < size && (a[i] != b[i] || (i + 1 < size && a[i + 1] != b[i + 1])))
+      i++;
+
+    p = Snapshot_PutVarint(p, literalBegin - skipBegin);
+    p = Snapshot_PutVarint(p, i - literalBegin);
+
+    for (u32 j = literalBegin; j < i; j++)
+      *p++ = a[j] ^ b[j];
   }
 
-  return s;
+  return (u32) (p - out);
 }
 
-i32  Map_XYToIndex(u32 x, u32 y)
+static void Snapshot_Decode(u8* dst, const u8* in, u32 encodedSize)
 {
-  return Map_XYToIndex2(x, y, RETRO_MAP_WIDTH, RETRO_MAP_HEIGHT);
-}
+  const u8* end = in + encodedSize;
+  u32 i = 0;
 
-i32  Map_XYToIndex2(u32 x, u32 y, u32 mapWidth, u32 mapHeight)
-{
-  if (x >= mapWidth)
-    return -1;
-  if (y >= mapHeight)
-    return -1;
-  return (x + (y * mapWidth));
+  while (in < end)
+  {
+    u32 skip, literals;
+    in = Snapshot_GetVarint(in, &skip);
+    in = Snapshot_GetVarint(in, &literals);
+    i += skip;
+
+    for (u32 j = 0; j < literals; j++)
+      dst[i++] ^= *in++;
+  }
 }
 
-bool Map_MouseToMapXY(i32* x, i32* y, i32 mapScreenOriginX, i32 mapScreenOriginY)
+static bool Snapshot_PoolOverlaps(u32 offset, u32 size)
 {
-  return Map_MouseToMapXY2(x, y, mapScreenOriginX, mapScreenOriginY, RETRO_MAP_WIDTH, RETRO_MAP_HEIGHT, RETRO_TILE_SIZE);
+  for (u32 i=0;i < gSnapshots.deltaCount;i++)
+  {
+    SnapshotDelta* delta = &gSnapshots.deltas[(gSnapshots.deltaHead + RETRO_SNAPSHOT_COUNT - 1 - i) % RETRO_SNAPSHOT_COUNT];
+    if (offset < delta->offset + delta->encodedSize && delta->offset < offset + size)
+      return true;
+  }
+  return false;
 }
 
-bool Map_MouseToMapXY2(i32* x, i32* y, i32 mapScreenOriginX, i32 mapScreenOriginY, u32 mapWidth, u32 mapHeight, u32 tileSize)
+static void Snapshot_PushDelta(u32 encodedSize, u32 size)
 {
-  i32 mmx = sMouseX;
-  i32 mmy = sMouseY;
-
-  u32 xx = 0;
-
-  if (mmx < mapScreenOriginX)
-    return false;
-  else if (mmx > Canvas_GetWidth() - mapScreenOriginX)
-    return false;
-  else
-    xx = mmx;
-    
-  xx -= mapScreenOriginX;
-  xx /= tileSize;
-
-  if (xx >= mapWidth)
-    return false;
+  if (encodedSize > RETRO_SNAPSHOT_POOL_SIZE)
+  {
+    gSnapshots.deltaCount = 0;
+    return;
+  }
 
-  u32 yy = 0;
+  u32 offset = gSnapshots.poolHead;
+  if (offset + encodedSize > RETRO_SNAPSHOT_POOL_SIZE)
+    offset = 0;
 
-  if (mmy < mapScreenOriginY)
-    return false;
-  else if (mmy > Canvas_GetHeight() - mapScreenOriginY)
-    return false;
-  else
-    yy = mmy;
-    
-  yy -= mapScreenOriginY;
-  yy /= tileSize;
+  // Oldest first, so the deltas left are always a chain back from the newest state.
+  if (gSnapshots.deltaCount == RETRO_SNAPSHOT_COUNT)
+    gSnapshots.deltaCount--;
 
-  if (yy >= mapHeight)
-    return false;
+  while (gSnapshots.deltaCount > 0 && Snapshot_PoolOverlaps(offset, encodedSize))
+    gSnapshots.deltaCount--;
 
-  *x = xx;
-  *y = yy;
+  memcpy(gSnapshots.pool + offset, gSnapshots.encoded, encodedSize);
 
-  return true;
-}
+  SnapshotDelta* delta = &gSnapshots.deltas[gSnapshots.deltaHead];
+  delta->offset = offset;
+  delta->encodedSize = encodedSize;
+  delta->size = size;
 
-void Tile_Draw(Bitmap* bitmap, i32 x, i32 y, u32 tileX, u32 tileY)
-{
-  Tile_Draw2(bitmap, x, y, tileX, tileY, RETRO_TILE_SIZE);
+  gSnapshots.deltaHead = (gSnapshots.deltaHead + 1) % RETRO_SNAPSHOT_COUNT;
+  gSnapshots.deltaCount++;
+  gSnapshots.poolHead = offset + encodedSize;
 }
 
-void Tile_Draw2(Bitmap* bitmap, i32 x, i32 y, u32 tileX, u32 tileY, u32 tileSize)
+void Snapshot_Capture()
 {
-  SDL_Rect src, dst;
-  
-  src.x = tileX * tileSize;
-  src.y = tileY * tileSize;
-  
-  src.w = tileSize;
-  src.h = tileSize;
+  if (gSnapshots.fn == NULL)
+    return;
 
-  dst.x = x;
-  dst.y = y;
-  dst.w = tileSize;
-  dst.h = tileSize;
+  RETRO_ZONE_BEGIN(Snapshot_Capture);
 
-  Canvas_Splat3(bitmap, &dst, &src);
-}
+  u32 lastWorkSize = gSnapshots.workSize;
 
-void Restart()
-{
-  gArena.current = gArena.begin;
-  
-  gScopeStackIndex = 0;
-  gScopeStack[0].p = 0;
-  gScopeStack[0].name = 'INIT';
+  gSnapshots.restoring = false;
+  gSnapshots.overflow = false;
+  gSnapshots.cursor = 0;
+  Snapshot_Engine();
+  gSnapshots.fn();
+  gSnapshots.workSize = gSnapshots.cursor;
 
-  Start();
-}
+  if (gSnapshots.workSize < lastWorkSize)
+    memset(gSnapshots.work + gSnapshots.workSize, 0, lastWorkSize - gSnapshots.workSize);
 
-void Canvas_Present()
-{
-  switch(gFramePresentation)
+  if (gSnapshots.overflow)
   {
-    case FP_Normal:
+    gSnapshots.valid = false;
+    gSnapshots.deltaCount = 0;
+  }
+  else
+  {
+    if (gSnapshots.valid)
     {
-      for (int i=0;i < RETRO_CANVAS_COUNT;i++)
-      {
-        if (gCanvasFlags[i] & CNF_Render)
-        {
-          SDL_RenderCopy(gRenderer, gCanvasTextures[i], NULL, NULL);
-        }
-      }
+      u32 size = Max(gSnapshots.workSize, gSnapshots.newestSize);
+      u32 encodedSize = Snapshot_Encode(gSnapshots.encoded, gSnapshots.work, gSnapshots.newest, size);
+      Snapshot_PushDelta(encodedSize, gSnapshots.newestSize);
     }
-    break;
-    case FP_WaveH:
-    {
-      u32 accuracy = 2;
 
-      for (u32 u=0;u < RETRO_WINDOW_DEFAULT_HEIGHT;u+=accuracy)
-      {
-        SDL_Rect src;
-        SDL_Rect dst;
-        src.x = 0;
-        src.y = u;
-        src.w = RETRO_CANVAS_DEFAULT_WIDTH;
-        src.h = accuracy;
+    u8* newest = gSnapshots.newest;
+    gSnapshots.newest = gSnapshots.work;
+    gSnapshots.work = newest;
 
-        dst = src;
+    u32 newestSize = gSnapshots.newestSize;
+    gSnapshots.newestSize = gSnapshots.workSize;
+    gSnapshots.workSize = newestSize;
+    gSnapshots.valid = true;
+  }
 
-        float x0 = (float) u / (float) RETRO_WINDOW_DEFAULT_HEIGHT;
-        dst.x = (sin((gCountedFrames % 1000) * gFrameAlpha + x0 * 3.14f) * gFrameBeta);
-        dst.y = u * 2;
-        dst.w = RETRO_WINDOW_DEFAULT_WIDTH;
-        dst.h = accuracy * 2;
+  RETRO_ZONE_END(Snapshot_Capture);
+}
 
-        for (int i=0;i < RETRO_CANVAS_COUNT;i++)
-        {
-          if (gCanvasFlags[i] & CNF_Render)
-          {
-            SDL_RenderCopy(gRenderer, gCanvasTextures[i], &src, &dst);
-          }
-        }
-      }
-    }
-    break;
-    case FP_WaveV:
-    {
-      u32 accuracy = 2;
+bool Snapshot_Restore(u32 ticksAgo)
+{
+  if (gSnapshots.fn == NULL || gSnapshots.valid == false || ticksAgo > gSnapshots.deltaCount)
+    return false;
 
-      for (u32 u=0;u < RETRO_WINDOW_DEFAULT_HEIGHT;u+=accuracy)
-      {
-        SDL_Rect src;
-        SDL_Rect dst;
-        src.x = u;
-        src.y = 0;
-        src.w = accuracy;
-        src.h = RETRO_CANVAS_DEFAULT_HEIGHT;
+  RETRO_ZONE_BEGIN(Snapshot_Restore);
 
-        dst = src;
+  for (u32 i=0;i < ticksAgo;i++)
+  {
+    gSnapshots.deltaHead = (gSnapshots.deltaHead + RETRO_SNAPSHOT_COUNT - 1) % RETRO_SNAPSHOT_COUNT;
+    gSnapshots.deltaCount--;
 
-        float y0 = (float) u / (float) RETRO_WINDOW_DEFAULT_HEIGHT;
-        dst.x = u * 2;
-        dst.y = (sin((gCountedFrames % 1000) * gFrameAlpha + y0 * 3.14f) * gFrameBeta);
-        dst.w = accuracy * 2;
-        dst.h = RETRO_WINDOW_DEFAULT_HEIGHT;
+    SnapshotDelta* delta = &gSnapshots.deltas[gSnapshots.deltaHead];
+    Snapshot_Decode(gSnapshots.newest, gSnapshots.pool + delta->offset, delta->encodedSize);
+    gSnapshots.newestSize = delta->size;
+  }
 
-        for (int i=0;i < RETRO_CANVAS_COUNT;i++)
-        {
-          if (gCanvasFlags[i] & CNF_Render)
-          {
-            SDL_RenderCopy(gRenderer, gCanvasTextures[i], &src, &dst);
-          }
-        }
-      }
-    }
-    break;
-    case FP_Scale:
+  gSnapshots.restoring = true;
+  gSnapshots.cursor = 0;
+  Snapshot_Engine();
+  gSnapshots.fn();
+  gSnapshots.restoring = false;
+
+  RETRO_ZONE_END(Snapshot_Restore);
+  return true;
+}
+
+// Samples the bound actions and the mouse once per tick, so presses and releases are seen by
+// exactly one Step().
+static void Input_Sample()
+{
+  sLastMouse = sNowMouse;
+  sNowMouse = sMouseButton;
+
+  if (sNowMouse == false)
+  {
+    sMouseDownTime = 0.0f;
+  }
+  else if (sNowMouse)
+  {
+    sMouseDownTime += 1000.0f / RETRO_TICK_RATE;
+  }
+
+  const Uint8 *state = SDL_GetKeyboardState(NULL);
+  u32 actions = gReplay.replaying ? Replay_ReadInputs() : 0;
+
+  for (u32 i=0;i < RETRO_MAX_INPUT_ACTIONS;i++)
+  {
+    InputActionBinding* binding = &gInputActions[i];
+    if (binding->action == 0xDEADBEEF)
+      break;
+
+    binding->lastState = binding->state;
+    binding->state = 0;
+
+    if (gReplay.replaying)
     {
+      binding->state = (actions >> i) & 1;
+      continue;
+    }
 
-      SDL_Rect src;
-      SDL_Rect dst;
-      src.w = (float) RETRO_CANVAS_DEFAULT_WIDTH * gFrameAlpha;
-      src.h = (float) RETRO_CANVAS_DEFAULT_HEIGHT * gFrameBeta;
-      src.x = 0; //src.w / 2;
-      src.y = 0; //src.h / 2;
+    for (u32 j=0; j < RETRO_MAX_INPUT_BINDINGS;j++)
+    {
+      int key = binding->keys[j];
 
-      dst = src;
-      dst.x = RETRO_WINDOW_DEFAULT_WIDTH / 2 - (src.w);
-      dst.y = RETRO_WINDOW_DEFAULT_HEIGHT / 2 - (src.h);
-      dst.w *= 2;
-      dst.h *= 2;
+      if (key == SDL_SCANCODE_UNKNOWN || key >= SDL_NUM_SCANCODES)
+        break;
 
-      for (int i=0;i < RETRO_CANVAS_COUNT;i++)
-      {
-        if (gCanvasFlags[i] & CNF_Render)
-        {
-          SDL_RenderCopy(gRenderer, gCanvasTextures[i], &src, &dst);
-        }
-      }
+      binding->state |= (state[key] != 0) ? 1 : 0;
     }
-    break;
+
+    actions |= (u32) binding->state << i;
+
+    // @TODO Axis
   }
+
+  if (gReplay.recording)
+  {
+    Replay_WriteInputs(actions);
+  }
+
+  sMouseButton =  SDL_GetMouseState(&sMouseX, &sMouseY) & SDL_BUTTON(SDL_BUTTON_LEFT);
+
+  sMouseX /= 2;
+  sMouseY /= 2;   // HARDCODED - Is Canvas_Width/Canvas_Width,  Height
 }
 
 void Frame()
 {
 
+  RETRO_ZONE_BEGIN(Frame);
+
+  Profiler_BeginFrame();
+
   Timer_Start(&gCapTimer);
 
   gDeltaTime = Timer_GetTicks(&gDeltaTimer);
@@ -2202,6 +5200,15 @@ void Frame()
         gQuit = true;
       }
       break;
+      case SDL_RENDER_TARGETS_RESET:
+      case SDL_RENDER_DEVICE_RESET:
+      {
+        TextCache_Reset();
+
+        if (gRenderResetFunction != NULL)
+          gRenderResetFunction();
+      }
+      break;
       case SDL_TEXTINPUT:
       {
         gInputChar = event.text.text[0];
@@ -2224,56 +5231,61 @@ void Frame()
     }
   }
 
+  Profiler_EndPhase(PP_Events);
+
   gFps = gCountedFrames / (Timer_GetTicks(&gFpsTimer) / 1000.0f);
   if (gFps > 200000.0f)
   {
     gFps = 0.0f;
   }
-  
-  sLastMouse = sNowMouse;
-  sNowMouse = sMouseButton;
 
-  if (sNowMouse == false)
-  {
-    sMouseDownTime = 0.0f;
-  }
-  else if (sNowMouse)
+  // Step() runs at RETRO_TICK_RATE whatever the frame rate is. When frames fall too far behind,
+  // the ticks beyond RETRO_MAX_CATCHUP_TICKS are dropped and the game slows down instead.
+  u64 now = SDL_GetPerformanceCounter();
+  u64 tickLength = SDL_GetPerformanceFrequency() / RETRO_TICK_RATE;
+
+  gTickAccumulator += now - gTickLast;
+  gTickLast = now;
+
+  if (gFastForwardFrames > 0)
   {
-    sMouseDownTime += gDeltaTime;
+    gTickAccumulator = tickLength;
   }
 
-  const Uint8 *state = SDL_GetKeyboardState(NULL);
+  Profiler_EndPhase(PP_Input);
 
-  for (u32 i=0;i < RETRO_MAX_INPUT_ACTIONS;i++)
+  u32 ticks = 0;
+  while (gTickAccumulator >= tickLength)
   {
-    InputActionBinding* binding = &gInputActions[i];
-    if (binding->action == 0xDEADBEEF)
+    if (ticks == RETRO_MAX_CATCHUP_TICKS)
+    {
+      gTickAccumulator %= tickLength;
       break;
+    }
 
-    binding->lastState = binding->state;
-    binding->state = 0;
+    Input_Sample();
 
-    for (u32 j=0; j < RETRO_MAX_INPUT_BINDINGS;j++)
-    {
-      int key = binding->keys[j];
+    Profiler_EndPhase(PP_Input);
 
-      if (key == SDL_SCANCODE_UNKNOWN || key >= SDL_NUM_SCANCODES)
-        break;
+    RETRO_ZONE_BEGIN(Step);
 
-      binding->state |= (state[key] != 0) ? 1 : 0;
-    }
+    Step();
 
-    // @TODO Axis
-  }
+    RETRO_ZONE_END(Step);
 
-  sMouseButton =  SDL_GetMouseState(&sMouseX, &sMouseY) & SDL_BUTTON(SDL_BUTTON_LEFT);
+    Replay_EndTick();
 
-  sMouseX /= 2;
-  sMouseY /= 2;   // HARDCODED - Is Canvas_Width/Canvas_Width,  Height
+    Snapshot_Capture();
+
+    Profiler_EndPhase(PP_Step);
 
+    gTickAccumulator -= tickLength;
+    ticks++;
+  }
 
+  gTickAlpha = (f32) gTickAccumulator / (f32) tickLength;
 
-  for (u8 i=0;i < RETRO_CANVAS_COUNT;i++)
+  for (u8 i=0;i < RETRO_CANVAS_COUNT && gRenderEnabled;i++)
   {
     if (gCanvasFlags[i] & CNF_Clear)
     {
@@ -2286,21 +5298,248 @@ void Frame()
   }
 
   Canvas_Set(0);
+
+  gBatchLastFlushes = gBatch.flushes;
+  gBatchLastQuads = gBatch.quads;
+  gBatch.flushes = 0;
+  gBatch.quads = 0;
+
+  Profiler_EndPhase(PP_Clear);
   
-  Step();
+  RETRO_ZONE_BEGIN(Draw);
+
+  Draw();
+
+  RETRO_ZONE_END(Draw);
+
+  Profiler_EndPhase(PP_Draw);
+
+  SpriteBatch_Flush();
   SDL_SetRenderTarget(gRenderer, NULL);
 
-  Canvas_Present();
+  if (gRenderEnabled && gPresentEnabled)
+  {
+    Canvas_Present();
+
+    Profiler_EndPhase(PP_Present);
 
-  Canvas_Flip();
+    Canvas_Flip();
+
+    Profiler_EndPhase(PP_Flip);
+  }
   
   ++gCountedFrames;
+
+  Profiler_EndFrame();
+
+  RETRO_ZONE_END(Frame);
   
   Timer_Start(&gDeltaTimer);
 }
 
 
-#ifdef RETRO_WINDOWS
+#if defined(RETRO_WINDOWS) || defined(RETRO_LINUX)
+
+u32 Retro_GetPeakMemoryKb()
+{
+#if defined(RETRO_LINUX)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    return usage.ru_maxrss;
+#elif defined(RETRO_WINDOWS)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return (u32) (counters.PeakWorkingSetSize / 1024);
+#endif
+  return 0;
+}
+
+static int Retro_CompareU64(const void* a, const void* b)
+{
+  u64 x = *((const u64*) a);
+  u64 y = *((const u64*) b);
+  return (x > y) - (x < y);
+}
+
+// Runs frames back to back without the frame rate cap, then reports the throughput.
+void Retro_FastForward(u32 frameCount)
+{
+  u64* frameCosts = malloc(sizeof(u64) * frameCount);
+  f64  frequency  = (f64) SDL_GetPerformanceFrequency();
+  u64  begin      = SDL_GetPerformanceCounter();
+  u32  frames     = 0;
+
+  while(gQuit == false && frames < frameCount)
+  {
+    u64 frameBegin = SDL_GetPerformanceCounter();
+    Frame();
+    frameCosts[frames++] = SDL_GetPerformanceCounter() - frameBegin;
+  }
+
+  f64 seconds = (SDL_GetPerformanceCounter() - begin) / frequency;
+  u64 total = 0;
+
+  for (u32 i=0;i < frames;i++)
+    total += frameCosts[i];
+
+  qsort(frameCosts, frames, sizeof(u64), Retro_CompareU64);
+
+  f64 meanMs = 0.0, p99Ms = 0.0;
+
+  if (frames > 0)
+  {
+    u32 p99Index = (frames * 99 + 99) / 100 - 1;
+    meanMs = (total / (f64) frames) * 1000.0 / frequency;
+    p99Ms  = frameCosts[p99Index] * 1000.0 / frequency;
+  }
+
+  printf("fast-forward frames=%u seconds=%.3f fps=%.1f mean_ms=%.4f p99_ms=%.4f peak_kb=%u render=%i present=%i\n",
+    frames,
+    seconds,
+    seconds > 0.0 ? frames / seconds : 0.0,
+    meanMs,
+    p99Ms,
+    Retro_GetPeakMemoryKb(),
+    gRenderEnabled,
+    gRenderEnabled && gPresentEnabled
+  );
+
+  free(frameCosts);
+}
+
+#endif
+
+void Retro_ParseArguments(int argc, char** argv)
+{
+  for (int i=1;i < argc;i++)
+  {
+    const char* arg = argv[i];
+
+#ifdef RETRO_LINUX
+    if (strcmp(arg, "--headless") == 0)
+    {
+      gHeadless = true;
+      continue;
+    }
+#endif
+
+    if (strcmp(arg, "--fast") == 0 && i + 1 < argc)
+    {
+      gFastForwardFrames = strtoul(argv[++i], NULL, 10);
+      continue;
+    }
+
+    if (strcmp(arg, "--profile-csv") == 0 && i + 1 < argc)
+    {
+      gProfileCsvFilename = argv[++i];
+      continue;
+    }
+
+    if (strcmp(arg, "--trace") == 0 && i + 1 < argc)
+    {
+      gTraceFilename = argv[++i];
+#ifndef RETRO_TRACE
+      printf("Tracing is compiled out, rebuild with RETRO_TRACE defined to use --trace\n");
+#endif
+      continue;
+    }
+
+    if (strcmp(arg, "--renderer") == 0 && i + 1 < argc)
+    {
+      const char* name = argv[++i];
+
+      if (strcmp(name, "soft") == 0)
+        gSoftwareRenderer = true;
+      else if (strcmp(name, "sdl") == 0)
+        gSoftwareRenderer = false;
+      else
+        printf("Unknown renderer: %s (expected sdl or soft)\n", name);
+
+      continue;
+    }
+
+    if (strcmp(arg, "--record") == 0 && i + 1 < argc)
+    {
+      gRecordFilename = argv[++i];
+      continue;
+    }
+
+    if (strcmp(arg, "--replay") == 0 && i + 1 < argc)
+    {
+      gReplayFilename = argv[++i];
+      continue;
+    }
+
+    if (strcmp(arg, "--seed") == 0 && i + 1 < argc)
+    {
+      gRandomSeed = strtoul(argv[++i], NULL, 10);
+      continue;
+    }
+
+    if (strcmp(arg, "--threads") == 0 && i + 1 < argc)
+    {
+      gJobThreads = strtoul(argv[++i], NULL, 10);
+      continue;
+    }
+
+    if (strcmp(arg, "--no-text-cache") == 0)
+    {
+      gTextCacheEnabled = false;
+      continue;
+    }
+
+    if (strcmp(arg, "--audio-ahead") == 0 && i + 1 < argc)
+    {
+      gAudioAhead = strtoul(argv[++i], NULL, 10);
+      continue;
+    }
+
+    if (strcmp(arg, "--no-music-cache") == 0)
+    {
+      gMusicCacheEnabled = false;
+      continue;
+    }
+
+    if (strcmp(arg, "--no-present") == 0)
+    {
+      gPresentEnabled = false;
+      continue;
+    }
+
+    if (strcmp(arg, "--no-render") == 0)
+    {
+      gRenderEnabled = false;
+      continue;
+    }
+
+#ifdef RETRO_FILESYSTEM
+    if (strcmp(arg, "--assets") == 0 && i + 1 < argc)
+    {
+      const char* dir = argv[++i];
+      u32 length = strlen(dir);
+
+      if (length + 2 > sizeof(gAssetDirectory))
+      {
+        printf("Asset directory is too long: %s\n", dir);
+        continue;
+      }
+
+      strcpy(gAssetDirectory, dir);
+
+      if (length > 0 && dir[length - 1] != '/')
+        strcat(gAssetDirectory, "/");
+
+      continue;
+    }
+#endif
+
+    printf("Unknown argument: %s\n", arg);
+  }
+}
+
+#ifndef RETRO_NO_MAIN
+
+#if defined(RETRO_WINDOWS) || defined(RETRO_LINUX)
 int main(int argc, char *argv[])
 #endif
 #ifdef RETRO_BROWSER
@@ -2308,15 +5547,48 @@ int main(int argc, char **argv)
 #endif
 {
 
+  Retro_ParseArguments(argc, argv);
+
+#ifdef RETRO_LINUX
+  if (gHeadless)
+  {
+    // Existing environment settings win, so SDL_VIDEODRIVER=offscreen can be used instead.
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+    SDL_setenv("SDL_AUDIODRIVER", "dummy", 0);
+  }
+#endif
+
   SDL_Init(SDL_INIT_EVERYTHING);
 
+#ifdef RETRO_TRACE
+  if (gTraceFilename != NULL)
+  {
+    Trace_Init();
+  }
+#endif
+
+  Jobs_Init(gJobThreads);
+
+  // A replay runs with its own seed, as fast as it can.
+  if (gReplayFilename != NULL && Replay_Load(gReplayFilename) && gFastForwardFrames == 0)
+  {
+    gFastForwardFrames = gReplay.ticks;
+  }
+
+  Random_Seed(gRandomSeed);
+
+  if (gRecordFilename != NULL)
+  {
+    Replay_BeginRecording(gRandomSeed);
+  }
+
   gArena.begin = malloc(RETRO_ARENA_SIZE);
   gArena.current = gArena.begin;
   gArena.end = gArena.begin + RETRO_ARENA_SIZE;
 
   memset(gArena.begin, 0, RETRO_ARENA_SIZE);
 
-  gFmtScratch = malloc(1024);
+  gFmtScratch = malloc(RETRO_FMT_SCRATCH_SIZE);
 
   memset(gInputActions, 0, sizeof(gInputActions));
 
@@ -2339,13 +5611,20 @@ int main(int argc, char **argv)
   memset(gAnimations, 0, 256 * sizeof(Animation*));
   memset(gSprites, 0, 256 * sizeof(Sprite*));
 
+  u32 windowFlags = SDL_WINDOW_SHOWN;
+
+#ifdef RETRO_LINUX
+  if (gHeadless)
+    windowFlags = SDL_WINDOW_HIDDEN;
+#endif
+
   gWindow = SDL_CreateWindow( 
     RETRO_WINDOW_CAPTION,
     SDL_WINDOWPOS_UNDEFINED, 
     SDL_WINDOWPOS_UNDEFINED,
     gSettings.windowWidth,
     gSettings.windowHeight,
-    SDL_WINDOW_SHOWN
+    windowFlags
   );
 
   memset(&gSoundObject, 0, sizeof(gSoundObject));
@@ -2358,29 +5637,42 @@ int main(int argc, char **argv)
   memset(&got, 0, sizeof(got));
 
   want.freq = RETRO_AUDIO_FREQUENCY;
-  want.format = AUDIO_S16;
   want.channels = RETRO_AUDIO_CHANNELS;
-  want.samples = RETRO_AUDIO_SAMPLES;
+  want.samples = gAudioAhead > 0 ? RETRO_AUDIO_THREAD_SAMPLES : RETRO_AUDIO_SAMPLES;
   want.callback = Retro_SDL_SoundCallback;
   want.userdata = NULL;
 
-  if (SDL_OpenAudio(&want, &got) < 0)
+  Audio_Open(&want, &got);
+  gSoundDevice.specification = got;
+
+  // No thread after all, so the callback mixes and gets the larger buffer.
+  if (Audio_StartRenderThread() == false && got.channels != 0 && want.samples != RETRO_AUDIO_SAMPLES)
   {
-    want.format = AUDIO_F32;
-    if (SDL_OpenAudio(&want, &got) < 0)
-    {
-      printf("Sound Init Error: %s\n", SDL_GetError());
-    }
+    SDL_CloseAudio();
+    want.samples = RETRO_AUDIO_SAMPLES;
+    Audio_Open(&want, &got);
+    gSoundDevice.specification = got;
   }
 
-  gSoundDevice.specification = got;
   gMusicContext = NULL;
 
-#ifdef RETRO_BROWSER
+#ifdef RETRO_FILESYSTEM
   gMusicFileData = NULL;
 #endif
 
   gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
+
+  if (gRenderer == NULL)
+  {
+    // No GPU (dummy/offscreen video driver), so fallback to SDL's software renderer.
+    gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE);
+  }
+
+  if (gRenderer == NULL)
+  {
+    printf("Renderer Init Error: %s\n", SDL_GetError());
+    return 1;
+  }
   gFramePresentation = FP_Normal;
   gFrameAlpha = 0.78f;
   gFrameBeta = 0.78f;
@@ -2400,6 +5692,11 @@ int main(int argc, char **argv)
     Canvas_SetFlags(i, flags, 0);
   }
 
+  if (gSoftwareRenderer)
+  {
+    SoftCanvas_Init();
+  }
+
   Canvas_Set(0);
 
   gQuit = false;
@@ -2411,9 +5708,18 @@ int main(int argc, char **argv)
   Timer_Start(&gFpsTimer);
   Timer_Start(&gDeltaTimer);
 
-  #ifdef RETRO_WINDOWS
+  // The first frame runs a tick, so there is something to draw.
+  gTickLast = SDL_GetPerformanceCounter();
+  gTickAccumulator = SDL_GetPerformanceFrequency() / RETRO_TICK_RATE;
+
+  #if defined(RETRO_WINDOWS) || defined(RETRO_LINUX)
+
+  if (gFastForwardFrames > 0)
+  {
+    Retro_FastForward(gFastForwardFrames);
+  }
 
-  while(gQuit == false)
+  while(gQuit == false && gFastForwardFrames == 0)
   {
     Frame();
     
@@ -2432,12 +5738,46 @@ int main(int argc, char **argv)
 
   #endif
 
+  if (gProfileCsvFilename != NULL)
+  {
+    Profiler_DumpCsv(gProfileCsvFilename);
+  }
+
+  if (gReplay.recording)
+  {
+    Replay_Save(gRecordFilename);
+  }
+
+  if (gReplay.replaying)
+  {
+    printf("Replay: ticks=%u hashes=%u mismatches=%u\n", gReplay.tick, gReplay.hashes, gReplay.mismatches);
+  }
+
+#ifdef RETRO_TRACE
+  if (gTraceFilename != NULL)
+  {
+    SDL_PauseAudio(1);
+    Trace_Export(gTraceFilename);
+  }
+#endif
+
+  Music_Stop();
+  Jobs_Shutdown();
+  free(gReplay.data);
+  free(gSnapshots.newest);
+  free(gSnapshots.work);
+  free(gSnapshots.encoded);
+  free(gSnapshots.pool);
   free(gArena.begin);
+  SDL_PauseAudio(1);
+  Audio_StopRenderThread();
   SDL_CloseAudio();
   SDL_Quit();
-  return 0;
+  return gReplay.mismatches > 0 ? 1 : 0;
 }
 
+#endif
+
 #undef RETRO_SDL_DRAW_PUSH_RGB
 #undef RETRO_SDL_DRAW_POP_RGB
 #undef RETRO_SDL_TO_RECT
@@ -9,6 +9,14 @@
 #define RETRO_BROWSER
 #endif
 
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define RETRO_LINUX
+#endif
+
+#if defined(RETRO_BROWSER) || defined(RETRO_LINUX)
+#define RETRO_FILESYSTEM
+#endif
+
 #define Kilobytes(N) ((N) * 1024)
 #define Megabytes(N) (Kilobytes(N) * 1024)
 
@@ -16,6 +24,10 @@
 #define RETRO_WINDOW_CAPTION "Retro"
 #endif
 
+#ifndef RETRO_ASSET_DIRECTORY
+#define RETRO_ASSET_DIRECTORY "assets/"
+#endif
+
 #ifndef RETRO_WINDOW_DEFAULT_WIDTH
 #define RETRO_WINDOW_DEFAULT_WIDTH 640
 #endif
@@ -37,7 +49,35 @@
 #endif
 
 #ifndef RETRO_FRAME_RATE
-#define RETRO_FRAME_RATE 30
+#define RETRO_FRAME_RATE 60
+#endif
+
+#ifndef RETRO_TICK_RATE
+#define RETRO_TICK_RATE 30
+#endif
+
+#ifndef RETRO_MAX_CATCHUP_TICKS
+#define RETRO_MAX_CATCHUP_TICKS 4
+#endif
+
+#ifndef RETRO_RANDOM_SEED
+#define RETRO_RANDOM_SEED 1
+#endif
+
+#ifndef RETRO_REPLAY_HASH_INTERVAL
+#define RETRO_REPLAY_HASH_INTERVAL 30
+#endif
+
+#ifndef RETRO_SNAPSHOT_SIZE
+#define RETRO_SNAPSHOT_SIZE Kilobytes(512)
+#endif
+
+#ifndef RETRO_SNAPSHOT_COUNT
+#define RETRO_SNAPSHOT_COUNT 64
+#endif
+
+#ifndef RETRO_SNAPSHOT_POOL_SIZE
+#define RETRO_SNAPSHOT_POOL_SIZE Megabytes(2)
 #endif
 
 #ifndef RETRO_ARENA_SIZE
@@ -60,10 +100,74 @@
 #define RETRO_CANVAS_COUNT 2
 #endif
 
+#ifndef RETRO_SOFT_TINT_CACHE
+#define RETRO_SOFT_TINT_CACHE 8
+#endif
+
+#ifndef RETRO_BATCH_MAX_QUADS
+#define RETRO_BATCH_MAX_QUADS 1024
+#endif
+
+#ifndef RETRO_TEXT_CACHE_SLOTS
+#define RETRO_TEXT_CACHE_SLOTS 32
+#endif
+
+#ifndef RETRO_TEXT_CACHE_SLOT_W
+#define RETRO_TEXT_CACHE_SLOT_W 256
+#endif
+
+#ifndef RETRO_TEXT_CACHE_SLOT_H
+#define RETRO_TEXT_CACHE_SLOT_H 16
+#endif
+
+#ifndef RETRO_TEXT_CACHE_MAX_LENGTH
+#define RETRO_TEXT_CACHE_MAX_LENGTH 48
+#endif
+
+// A string only gets a slot when drawn again within this many frames, so text that changes every
+// frame is drawn directly instead of evicting text that doesn't.
+#ifndef RETRO_TEXT_CACHE_ADMIT_FRAMES
+#define RETRO_TEXT_CACHE_ADMIT_FRAMES 2
+#endif
+
+#ifndef RETRO_TEXT_CACHE_CANDIDATES
+#define RETRO_TEXT_CACHE_CANDIDATES 64    // Must be a power of two
+#endif
+
+#ifndef RETRO_FMT_SCRATCH_SIZE
+#define RETRO_FMT_SCRATCH_SIZE 1024
+#endif
+
 #ifndef RETRO_MAX_SOUND_OBJECTS
 #define RETRO_MAX_SOUND_OBJECTS 16
 #endif
 
+#ifndef RETRO_SOUND_DEFAULT_PRIORITY
+#define RETRO_SOUND_DEFAULT_PRIORITY 128
+#endif
+
+#ifndef RETRO_SOUND_DEFAULT_MAX_INSTANCES
+#define RETRO_SOUND_DEFAULT_MAX_INSTANCES 4
+#endif
+
+#ifndef RETRO_MIX_CHUNK
+#define RETRO_MIX_CHUNK 1024
+#endif
+
+// Music is rendered once, in the background, and played from memory. The rendered song is kept
+// next to the module as <name>.pcm for later runs.
+#ifndef RETRO_MUSIC_CACHE
+#ifdef RETRO_BROWSER
+#define RETRO_MUSIC_CACHE 0
+#else
+#define RETRO_MUSIC_CACHE 1
+#endif
+#endif
+
+#ifndef RETRO_AUDIO_COMMAND_COUNT
+#define RETRO_AUDIO_COMMAND_COUNT 64    // Must be a power of two
+#endif
+
 #ifndef RETRO_AUDIO_FREQUENCY
 #define RETRO_AUDIO_FREQUENCY 44100 // 48000
 #endif
@@ -72,9 +176,49 @@
 #define RETRO_AUDIO_CHANNELS 2
 #endif
 
+// Device buffer when the callback mixes by itself, which needs the larger buffer to be safe.
 #ifndef RETRO_AUDIO_SAMPLES
 #define RETRO_AUDIO_SAMPLES 1024 //16384
-#endif 
+#endif
+
+// Device buffer when the render thread mixes ahead and the callback only copies.
+#ifndef RETRO_AUDIO_THREAD_SAMPLES
+#define RETRO_AUDIO_THREAD_SAMPLES 256
+#endif
+
+// Music and sounds are mixed on their own thread, RETRO_AUDIO_AHEAD_SAMPLES frames ahead of the
+// device, and the callback only copies them out.
+#ifndef RETRO_AUDIO_THREAD
+#ifdef RETRO_BROWSER
+#define RETRO_AUDIO_THREAD 0
+#else
+#define RETRO_AUDIO_THREAD 1
+#endif
+#endif
+
+#ifndef RETRO_AUDIO_AHEAD_SAMPLES
+#define RETRO_AUDIO_AHEAD_SAMPLES 512
+#endif
+
+#ifndef RETRO_AUDIO_RING_SAMPLES
+#define RETRO_AUDIO_RING_SAMPLES 4096   // Must be a power of two
+#endif
+
+#ifndef RETRO_PROFILE_FRAMES
+#define RETRO_PROFILE_FRAMES 256
+#endif
+
+#ifndef RETRO_JOB_MAX_THREADS
+#define RETRO_JOB_MAX_THREADS 8
+#endif
+
+#ifndef RETRO_TRACE_MAX_THREADS
+#define RETRO_TRACE_MAX_THREADS 8
+#endif
+
+#ifndef RETRO_TRACE_MAX_EVENTS
+#define RETRO_TRACE_MAX_EVENTS 65536 // Per thread
+#endif
 
 #ifndef RETRO_TILE_SIZE
 #define RETRO_TILE_SIZE 8
@@ -89,6 +233,7 @@
 #endif
 
 #define RETRO_UNUSED(X) (void)X
+#define RETRO_SOFT_HOLE 0xFF
 #define RETRO_ARRAY_COUNT(X) (sizeof(X) / sizeof((X)[0]))
 
 #include <stdint.h>
@@ -99,6 +244,7 @@
 typedef uint8_t  u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 typedef int8_t   i8;
 typedef int16_t  i16;
 typedef int32_t  i32;
@@ -116,6 +262,7 @@ typedef struct
 {
   SDL_Texture*  texture;
   u8*    imageData;
+  u8*    indices;   // Palette indices for the software renderer, RETRO_SOFT_HOLE is transparent.
   u16    w, h;
 } Bitmap;
 
@@ -219,8 +366,26 @@ typedef struct
   i32 length;
   u8* buffer;
   SDL_AudioSpec spec;
+  u8  priority;       // A busy pool steals from lower or equal priorities
+  u8  maxInstances;   // Playing it more often steals its oldest instance
 } Sound;
 
+typedef struct
+{
+  u32 playing;
+  u32 drops;            // Plays with no voice to be had
+  u32 steals;           // Voices cut short for a new play
+  u32 droppedCommands;  // Commands lost to a full queue
+} VoiceStats;
+
+typedef struct
+{
+  u32 ahead;            // Frames the render thread keeps queued
+  u32 fill;             // Frames queued now
+  u32 lowest;           // Lowest fill the callback has seen since the last call
+  u32 underruns;        // Callbacks that ran out
+} AudioRingStats;
+
 #define Point_Translate(P, X_VALUE, Y_VALUE) \
   (P)->x += X_VALUE; \
   (P)->y += Y_VALUE;
@@ -254,6 +419,31 @@ u8* Arena_SaveToMem(u32* size);
 
 void Arena_LoadFromMem(u8* mem, bool loadMusic);
 
+typedef void (*SnapshotFunction)();
+
+// Ring of the simulation state of the last RETRO_SNAPSHOT_COUNT ticks, captured after every
+// Step() once a function is set. The function passes every piece of state through
+// Snapshot_Bytes, which copies it into the snapshot when capturing, and back out when restoring.
+// The newest state is kept whole, older ones as XOR deltas against the next newer one, run length
+// encoded. All memory is allocated when the function is set.
+void Snapshot_SetFunction(SnapshotFunction fn);
+
+void Snapshot_Bytes(void* data, u32 size);
+
+bool Snapshot_IsRestoring();
+
+// Whether a function is set, so state must fit in RETRO_SNAPSHOT_SIZE.
+bool Snapshot_IsEnabled();
+
+void Snapshot_Capture();
+
+// Goes back to the state of ticksAgo ticks before the newest, which becomes the newest. 0 undoes
+// anything since the last capture.
+bool Snapshot_Restore(u32 ticksAgo);
+
+// How many ticks back Snapshot_Restore can go.
+u32  Snapshot_GetDepth();
+
 void Scope_Push(int name);
 
 int  Scope_GetName();
@@ -285,6 +475,21 @@ void  Bitmap_Load24(const char* name, Bitmap* outBitmap, u8 transparentR, u8 tra
 // Loads a bitmap, and swaps the palette with the given one.
 void  Bitmap_Load24_PaletteSwap(const char* name, Bitmap* outBitmap, u8 transparentR, u8 transparentG, u8 transparentB,  Palette* src, Palette* dst);
 
+// Loads a bitmap once for each palette swap and colour tint, into one atlas with
+// the swaps laid out horizontally and the tints vertically.
+void  Bitmap_Load24_PaletteSwapAtlas(const char* name, Bitmap* outBitmap, u8 transparentR, u8 transparentG, u8 transparentB, Palette* src, Palette** dsts, u32 dstCount, const Colour* tints, u32 tintCount);
+
+// Creates an empty, transparent bitmap that can be drawn into between Canvas_BeginBitmap/Canvas_EndBitmap.
+void  Bitmap_Create(Bitmap* outBitmap, u32 w, u32 h);
+
+void  Bitmap_Destroy(Bitmap* bitmap);
+
+typedef void (*RenderResetFunction)();
+
+// Called when the renderer loses what was drawn into bitmaps made by Bitmap_Create (render targets
+// or device reset), so they can be drawn again.
+void  Bitmap_SetResetFunction(RenderResetFunction fn);
+
 void  Sprite_Make(Sprite* inSprite, Bitmap* bitmap, u32 x, u32 y, u32 w, u32 h);
 
 Sprite* SpriteHandle_Get(SpriteHandle id);
@@ -352,12 +557,29 @@ void  Canvas_Flip();
 
 void  Canvas_Clear();
 
+// Collects the following splats, text and rectangles, and submits them as one draw per texture.
+void  Canvas_BeginBatch();
+
+// Submits anything left in the batch and goes back to immediate drawing.
+void  Canvas_EndBatch();
+
+// Redirects drawing into the bitmap (made by Bitmap_Create), which is cleared first.
+void  Canvas_BeginBitmap(Bitmap* bitmap);
+
+// Restores drawing to the current canvas.
+void  Canvas_EndBitmap();
+
 void  Canvas_DrawPalette(Palette* palette, u32 Y);
 
 void  Canvas_DrawRectangle(u8 Colour, Rect rect);
 
 void  Canvas_DrawFilledRectangle(u8 Colour, Rect rect);
 
+// Strings that fit are drawn once into a cache and afterwards splatted as a single copy.
+void  Canvas_PrintStr(u32 x, u32 y, Font* font, u8 colour, const char* str);
+
+i32   Canvas_LengthStr(Font* font, const char* str);
+
 void  Canvas_PrintF(u32 x, u32 y, Font* font, u8 colour, const char* fmt, ...);
 
 i32  Canvas_LengthF(Font* font, const char* fmt, ...);
@@ -376,6 +598,90 @@ typedef enum
 
 void  Canvas_SetPresentation(FramePresentation presentation, float alpha, float beta);
 
+void  Canvas_Debug(Font* font);
+
+typedef enum
+{
+  // SDL_PollEvent loop
+  PP_Events,
+  // Input binding and mouse refresh
+  PP_Input,
+  // Canvas clears
+  PP_Clear,
+  // Step(), over every tick run in the frame
+  PP_Step,
+  // Draw()
+  PP_Draw,
+  // Canvas_Present
+  PP_Present,
+  // Canvas_Flip
+  PP_Flip,
+  // Whole of Frame()
+  PP_Frame,
+  PP_COUNT
+} ProfilePhase;
+
+typedef struct
+{
+  f32 min, mean, max, p99;
+} ProfileRollup;
+
+// Calculates min/mean/max/p99 in milliseconds of a phase over the recorded frames.
+void  Profiler_Rollup(ProfilePhase phase, ProfileRollup* outRollup);
+
+// Shows the rollups through Canvas_Debug
+void  Profiler_SetOverlay(bool enabled);
+
+bool  Profiler_DumpCsv(const char* filename);
+
+// How far the frame is between the last tick and the next one, from 0 to 1. Draw() blends the
+// previous and current tick by it.
+f32   Retro_GetTickAlpha();
+
+typedef u32 (*StateHashFunction)();
+
+// Input recording (--record FILE) and playback (--replay FILE). A recording holds the seed and
+// the input action states of every tick, stored only when they change, and a hash of the game
+// state every RETRO_REPLAY_HASH_INTERVAL ticks. Playback feeds the states back in place of the
+// keyboard, one tick per frame without the frame rate cap, and reports every hash that differs.
+void  Replay_SetStateHash(StateHashFunction fn);
+
+typedef void (*JobFunction)(u32 begin, u32 end, u32 worker, void* user);
+
+// Worker threads for data-parallel loops, including the calling thread as worker 0. A thread count
+// of 0 is one per core, capped at RETRO_JOB_MAX_THREADS. The browser build is always one thread.
+void  Jobs_Init(u32 threadCount);
+
+void  Jobs_Shutdown();
+
+u32   Jobs_GetWorkerCount();
+
+// Splits [0, count) into chunks of grain items and runs them over the workers, which steal chunks
+// from each other once their own run out. Returns when every chunk is done. Chunks may run in any
+// order and on any worker, so fn must only write to state owned by its items (or by its worker).
+void  Jobs_ParallelFor(u32 count, u32 grain, JobFunction fn, void* user);
+
+// Scoped zones for timeline tracing. Compiled out unless RETRO_TRACE is defined, and recorded
+// only when tracing is switched on at runtime (--trace FILE). Each thread records into its own
+// buffer, so recording never takes a lock. NAME must be an identifier.
+#ifdef RETRO_TRACE
+
+u64   Trace_Now();
+
+void  Trace_Record(const char* name, u64 begin, u64 end);
+
+bool  Trace_Export(const char* filename);
+
+#define RETRO_ZONE_BEGIN(NAME) u64 retroZone_##NAME = Trace_Now()
+#define RETRO_ZONE_END(NAME)   Trace_Record(#NAME, retroZone_##NAME, Trace_Now())
+
+#else
+
+#define RETRO_ZONE_BEGIN(NAME)
+#define RETRO_ZONE_END(NAME)
+
+#endif
+
 void  AnimatedSpriteObject_Make(AnimatedSpriteObject* inAnimatedSpriteObject, Animation* animation, i32 x, i32 y);
 
 void  AnimatedSpriteObject_PlayAnimation(AnimatedSpriteObject* animatedSpriteObject, bool playing, bool loop);
@@ -384,10 +690,31 @@ void  AnimatedSpriteObject_SwitchAnimation(AnimatedSpriteObject* animatedSpriteO
 
 void  Sound_Load(Sound* sound, const char* name);
 
+// Loaded sounds have RETRO_SOUND_DEFAULT_PRIORITY and RETRO_SOUND_DEFAULT_MAX_INSTANCES. Set them
+// before playing the sound.
+void  Sound_SetLimits(Sound* sound, u8 priority, u8 maxInstances);
+
+// The Sound_ and Music_ calls below never touch the mixer's state. They queue a command, which
+// the mixer applies before mixing its next buffer. When the queue is full the command
+// is dropped.
+//
+// With every voice busy, a play takes the oldest voice of the lowest priority, if that is not
+// higher than its own, or else is dropped.
 void  Sound_Play(Sound* sound, u8 volume);
 
+// Stops every playing instance of the sound.
+void  Sound_Stop(Sound* sound);
+
+// Sets the volume of every playing instance of the sound.
+void  Sound_SetVolume(Sound* sound, u8 volume);
+
 void  Sound_Clear();
 
+void  Sound_GetVoiceStats(VoiceStats* outStats);
+
+// All zero when the callback mixes by itself.
+void  Sound_GetRingStats(AudioRingStats* outStats);
+
 void  Music_Play(const char* name);
 
 void  Music_Stop();
@@ -466,6 +793,32 @@ void  Start();
 
 void  Step();
 
+void  Draw();
+
+typedef enum
+{
+  // Anything that changes the game state
+  RS_Simulation,
+  // Sound choices
+  RS_Audio,
+  // Screen shake and other rolls that are only drawn
+  RS_Cosmetic,
+  RS_COUNT
+} RandomStream;
+
+// Seeds every stream from the one value (--seed N, else RETRO_RANDOM_SEED). The streams are
+// PCG32 and independent, so extra rolls in one never shift another. They are not locked, so only
+// the main thread may roll them.
+void  Random_Seed(u32 seed);
+
+u32   Random_GetSeed();
+
+u32   Random_Next(RandomStream stream);
+
+// 0 to bound - 1
+u32   Random_Below(RandomStream stream, u32 bound);
+
+// Rolls from RS_Simulation
 int   Random_Range(int min, int max);
 
 int   Random_Roll(int Dice);